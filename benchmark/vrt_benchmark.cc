@@ -5,6 +5,10 @@
  * @Last Modified time: 2024-04-05 19:01:54
  */
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <random>
 #include <thread>
 #include <utility>
@@ -58,8 +62,9 @@ static void RunInsertPhmapByMutex(benchmark::State& state) {
   }
 }
 
+template <class Policy>
 static void RunInsertVrt(benchmark::State& state) {
-  vrt::Vrt<std::string, true, 8> vrt;
+  vrt::Vrt<std::string, true, 8, Policy> vrt;
   for (int i = 0; i < kKeySize; i++) {
     vrt.Upsert(keys[i], "123");
   }
@@ -84,6 +89,44 @@ static void RunInsertVrt(benchmark::State& state) {
   }
 }
 
+struct PartitionedOptimisticPolicy : public vrt::VrtOptimisticWritePolicy {
+  static constexpr bool kPartitionedRoot = true;
+};
+
+// 前一半key常驻，多个写线程各自插入再删除后一半key中的一段，每轮结束后树恢复原状。
+// 乐观写时写线程也要占用读线程的位置，kReadThreadNum按最多64个线程设置
+template <class Policy>
+static void RunMultiWriterVrt(benchmark::State& state) {
+  vrt::Vrt<std::string, true, 64, Policy> vrt;
+  auto half = kKeySize / 2;
+  for (int i = 0; i < half; i++) {
+    vrt.Upsert(keys[i], "123");
+  }
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto thread_num = state.range(0);
+    std::vector<std::thread> ts(thread_num);
+    auto batch = half / thread_num;
+    state.ResumeTiming();
+
+    auto func = [&](int start, int end) {
+      for (int i = start; i < end; i++) {
+        vrt.Insert(keys[i], nullptr, "123");
+      }
+      for (int i = start; i < end; i++) {
+        vrt.Delete(keys[i]);
+      }
+    };
+    for (int i = 0; i < thread_num; i++) {
+      ts[i] = std::thread(func, half + i * batch, half + (i + 1) * batch);
+    }
+    for (int i = 0; i < thread_num; i++) {
+      ts[i].join();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (half / state.range(0)) * state.range(0) * 2);
+}
+
 static void RunFindPhmapByMutex(benchmark::State& state) {
   phmap::parallel_flat_hash_map<std::string, std::string, phmap::priv::hash_default_hash<std::string>,
                                 phmap::priv::hash_default_eq<std::string>,
@@ -140,6 +183,74 @@ static void RunFindVrt(benchmark::State& state) {
   }
 }
 
+// 比较不同回收方式下的读吞吐，QSBR的读线程每查找kQuiescentInterval个key调用一次Quiescent，hazard pointer的读线程不需要额外调用
+template <class Policy>
+static void RunFindReclaimVrt(benchmark::State& state) {
+  constexpr int kQuiescentInterval = 64;
+  vrt::Vrt<std::string, true, 8, Policy> vrt;
+  for (int i = 0; i < kKeySize; i++) {
+    vrt.Upsert(keys[i], "123");
+  }
+  std::vector<std::string> values(kKeySize);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto thread_num = state.range(0);
+    std::vector<std::thread> ts(thread_num);
+    auto batch = kKeySize / thread_num;
+    state.ResumeTiming();
+    auto func = [&](int start, int end) {
+      for (int i = start; i < end; i++) {
+        vrt.Find(keys[i], &values[i]);
+        if constexpr (Policy::kReclaimScheme == vrt::VrtReclaimScheme::kQsbr) {
+          if (0 == (i - start + 1) % kQuiescentInterval) {
+            vrt.Quiescent();
+          }
+        }
+      }
+      if constexpr (Policy::kReclaimScheme == vrt::VrtReclaimScheme::kQsbr) {
+        vrt.Offline();
+      }
+    };
+    for (int i = 0; i < thread_num; i++) {
+      ts[i] = std::thread(func, i * batch, (i + 1) * batch);
+    }
+    for (int i = 0; i < thread_num; i++) {
+      ts[i].join();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kKeySize);
+}
+
+static void RunMultiFindVrt(benchmark::State& state) {
+  constexpr size_t kBatchSize = 64;
+  vrt::Vrt<std::string, true, 8> vrt;
+  for (int i = 0; i < kKeySize; i++) {
+    vrt.Upsert(keys[i], "123");
+  }
+  std::vector<std::string_view> key_views(keys.begin(), keys.end());
+  std::vector<std::string> values(kKeySize);
+  std::vector<uint64_t> found_bitmap((kKeySize + 63) / 64);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto thread_num = state.range(0);
+    std::vector<std::thread> ts(thread_num);
+    auto batch = kKeySize / thread_num;
+    state.ResumeTiming();
+    auto func = [&](int start, int end) {
+      uint64_t bitmap[kBatchSize / 64];
+      for (int i = start; i < end; i += kBatchSize) {
+        vrt.MultiFind(&key_views[i], std::min<size_t>(kBatchSize, end - i), &values[i], bitmap);
+      }
+    };
+    for (int i = 0; i < thread_num; i++) {
+      ts[i] = std::thread(func, i * batch, (i + 1) * batch);
+    }
+    for (int i = 0; i < thread_num; i++) {
+      ts[i].join();
+    }
+  }
+}
+
 static void RunDeletePhmapByMutex(benchmark::State& state) {
   for (auto _ : state) {
     state.PauseTiming();
@@ -168,13 +279,14 @@ static void RunDeletePhmapByMutex(benchmark::State& state) {
   }
 }
 
+template <class Policy>
 static void RunDeleteVrt(benchmark::State& state) {
   for (auto _ : state) {
     state.PauseTiming();
     auto thread_num = state.range(0);
     std::vector<std::thread> ts(thread_num);
     auto batch = kKeySize / thread_num;
-    vrt::Vrt<std::string, true, 8> vrt;
+    vrt::Vrt<std::string, true, 8, Policy> vrt;
     for (int i = 0; i < kKeySize; i++) {
       vrt.Upsert(keys[i], "123");
     }
@@ -193,12 +305,326 @@ static void RunDeleteVrt(benchmark::State& state) {
   }
 }
 
+// 十进制数字作为key，大部分叶子的key剩余部分为空，用来对比InlineLeaf
+template <class Policy>
+static void RunInsertIntVrt(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto vrt = std::make_unique<vrt::Vrt<uint64_t, true, 8, Policy>>();
+    state.ResumeTiming();
+    for (uint64_t i = 0; i < kKeySize; i++) {
+      vrt->Insert(std::to_string(i), nullptr, i);
+    }
+    state.PauseTiming();
+    vrt.reset();
+    state.ResumeTiming();
+  }
+}
+
+template <class Policy>
+static void RunFindIntVrt(benchmark::State& state) {
+  vrt::Vrt<uint64_t, true, 8, Policy> vrt;
+  std::vector<std::string> int_keys(kKeySize);
+  for (uint64_t i = 0; i < kKeySize; i++) {
+    int_keys[i] = std::to_string(i);
+    vrt.Insert(int_keys[i], nullptr, i);
+  }
+  std::shuffle(int_keys.begin(), int_keys.end(), std::mt19937(std::random_device()()));
+  uint64_t value = 0;
+  for (auto _ : state) {
+    for (auto& key : int_keys) {
+      vrt.Find(key, &value);
+      benchmark::DoNotOptimize(value);
+    }
+  }
+}
+
+// 4KB的值，十进制数字作为key时大部分内部节点也带值，插入时的扩容、分裂和删除时的缩容、合并，默认策略都会复制值，
+// VrtBoxedValuePolicy只复制指针
+template <class Policy>
+static void RunInsertDeleteBigValueVrt(benchmark::State& state) {
+  constexpr uint32_t kBigValueKeySize = 100000;
+  const std::string value(4096, 'v');
+  std::vector<std::string> int_keys(kBigValueKeySize);
+  for (uint32_t i = 0; i < kBigValueKeySize; i++) {
+    int_keys[i] = std::to_string(i);
+  }
+  std::mt19937 gen(std::random_device{}());
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto vrt = std::make_unique<vrt::Vrt<std::string, true, 8, Policy>>();
+    std::shuffle(int_keys.begin(), int_keys.end(), gen);
+    state.ResumeTiming();
+    for (auto& key : int_keys) {
+      vrt->Insert(key, nullptr, value);
+    }
+    std::shuffle(int_keys.begin(), int_keys.end(), gen);
+    for (auto& key : int_keys) {
+      vrt->Delete(key);
+    }
+    state.PauseTiming();
+    vrt.reset();
+    state.ResumeTiming();
+  }
+}
+
+// 没有声明VrtIsTriviallyRelocatable的vector，节点被替换时只能复制值
+struct CopiedVector : public std::vector<uint64_t> {
+  using std::vector<uint64_t>::vector;
+};
+
+// 值为std::vector时节点被替换只需要按字节搬动vector本身，CopiedVector每次都要复制整个缓冲区再析构旧的
+template <class Value>
+static void RunInsertDeleteVectorVrt(benchmark::State& state) {
+  constexpr uint32_t kVectorKeySize = 100000;
+  std::vector<std::string> int_keys(kVectorKeySize);
+  for (uint32_t i = 0; i < kVectorKeySize; i++) {
+    int_keys[i] = std::to_string(i);
+  }
+  std::mt19937 gen(std::random_device{}());
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto vrt = std::make_unique<vrt::Vrt<Value, true, 8>>();
+    std::shuffle(int_keys.begin(), int_keys.end(), gen);
+    state.ResumeTiming();
+    for (auto& key : int_keys) {
+      vrt->Insert(key, nullptr, 256, 1);
+    }
+    std::shuffle(int_keys.begin(), int_keys.end(), gen);
+    for (auto& key : int_keys) {
+      vrt->Delete(key);
+    }
+    state.PauseTiming();
+    vrt.reset();
+    state.ResumeTiming();
+  }
+}
+
+// 统计节点占用的字节数，用来比较不同节点布局下每个key的内存开销
+struct CountingAllocator {
+  inline static std::atomic<int64_t> allocated_bytes{0};
+
+  static void* Allocate(size_t size) {
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    return malloc(size);
+  }
+  static void Deallocate(void* ptr, size_t size) {
+    allocated_bytes.fetch_sub(size, std::memory_order_relaxed);
+    free(ptr);
+  }
+};
+
+struct CountingPolicy : public vrt::VrtDefaultPolicy {
+  using Allocator = CountingAllocator;
+};
+
+// BulkLoad一次建好最终的树，不会产生等待EBR回收的中间节点
+template <bool kWriteLock>
+static void RunBytesPerKeyVrt(benchmark::State& state) {
+  std::vector<std::pair<std::string_view, uint64_t>> kvs(kKeySize);
+  for (int i = 0; i < kKeySize; i++) {
+    kvs[i] = {keys[i], i};
+  }
+  std::sort(kvs.begin(), kvs.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+  auto same_key = [](const auto& lhs, const auto& rhs) { return lhs.first == rhs.first; };
+  kvs.erase(std::unique(kvs.begin(), kvs.end(), same_key), kvs.end());
+  for (auto _ : state) {
+    vrt::Vrt<uint64_t, kWriteLock, 8, CountingPolicy> vrt;
+    auto start_bytes = CountingAllocator::allocated_bytes.load(std::memory_order_relaxed);
+    vrt.BulkLoad(kvs.begin(), kvs.end());
+    state.counters["bytes_per_key"] =
+        static_cast<double>(CountingAllocator::allocated_bytes.load(std::memory_order_relaxed) - start_bytes) /
+        kvs.size();
+  }
+}
+
+struct CountingFinePolicy : public vrt::VrtFineNodePolicy {
+  using Allocator = CountingAllocator;
+};
+
+// 十进制、十六进制、base64字符集的随机key，内部节点的子节点数分别在10、16、64附近。
+// 计时部分是插入和查找，bytes_per_key用BulkLoad建出的树统计，比较不同节点阶梯的内存和吞吐。
+template <class Policy>
+static void RunAlphabetVrt(benchmark::State& state) {
+  constexpr uint32_t kAlphabetKeySize = 1000000;
+  constexpr uint32_t kAlphabetKeyLength = 12;
+  const std::string_view alphabets[] = {
+      "0123456789", "0123456789abcdef", "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+  auto alphabet = alphabets[state.range(0)];
+  std::mt19937 gen(std::random_device{}());
+  std::uniform_int_distribution<size_t> distrib(0, alphabet.size() - 1);
+  std::vector<std::string> alphabet_keys(kAlphabetKeySize, std::string(kAlphabetKeyLength, 0));
+  for (auto& key : alphabet_keys) {
+    for (auto& ch : key) {
+      ch = alphabet[distrib(gen)];
+    }
+  }
+  std::vector<std::pair<std::string_view, uint64_t>> kvs(kAlphabetKeySize);
+  for (uint32_t i = 0; i < kAlphabetKeySize; i++) {
+    kvs[i] = {alphabet_keys[i], i};
+  }
+  std::sort(kvs.begin(), kvs.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+  auto same_key = [](const auto& lhs, const auto& rhs) { return lhs.first == rhs.first; };
+  kvs.erase(std::unique(kvs.begin(), kvs.end(), same_key), kvs.end());
+  uint64_t value = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto vrt = std::make_unique<vrt::Vrt<uint64_t, true, 8, Policy>>();
+    state.ResumeTiming();
+    for (uint32_t i = 0; i < kAlphabetKeySize; i++) {
+      vrt->Insert(alphabet_keys[i], nullptr, i);
+    }
+    for (auto& key : alphabet_keys) {
+      vrt->Find(key, &value);
+      benchmark::DoNotOptimize(value);
+    }
+    state.PauseTiming();
+    vrt = std::make_unique<vrt::Vrt<uint64_t, true, 8, Policy>>();
+    auto start_bytes = CountingAllocator::allocated_bytes.load(std::memory_order_relaxed);
+    vrt->BulkLoad(kvs.begin(), kvs.end());
+    state.counters["bytes_per_key"] =
+        static_cast<double>(CountingAllocator::allocated_bytes.load(std::memory_order_relaxed) - start_bytes) /
+        kvs.size();
+    vrt.reset();
+    state.ResumeTiming();
+  }
+}
+
+// key集合大小由参数指定，key现场由序号散列后格式化生成，5000万key时不额外保存key数组。
+// 每轮固定按乱序查找100万次，比较节点放在普通堆上和放在2MB大页arena上的查找吞吐
+template <class Policy>
+static void RunFindArenaVrt(benchmark::State& state) {
+  constexpr uint64_t kFindCnt = 1000000;
+  constexpr uint64_t kStride = 7919;
+  auto key_cnt = static_cast<uint64_t>(state.range(0));
+  auto gen_key = [](uint64_t i) { return std::to_string(i * 0x9E3779B97F4A7C15ULL); };
+  auto vrt = std::make_unique<vrt::Vrt<uint64_t, true, 8, Policy>>();
+  for (uint64_t i = 0; i < key_cnt; i++) {
+    vrt->Insert(gen_key(i), nullptr, i);
+  }
+  std::vector<std::string> find_keys(kFindCnt);
+  for (uint64_t i = 0; i < kFindCnt; i++) {
+    find_keys[i] = gen_key(i * kStride % key_cnt);
+  }
+  uint64_t value = 0;
+  for (auto _ : state) {
+    for (auto& key : find_keys) {
+      vrt->Find(key, &value);
+      benchmark::DoNotOptimize(value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kFindCnt);
+}
+
+// 单个写线程反复插入删除，同时有一个读线程不停查找。逐次记录写操作的耗时，比较写线程同步回收和后台线程分批回收时
+// 写延迟的长尾
+template <class Policy>
+static void RunWriteLatencyVrt(benchmark::State& state) {
+  constexpr uint32_t kLatencyKeySize = 200000;
+  std::vector<std::string> int_keys(kLatencyKeySize);
+  for (uint32_t i = 0; i < kLatencyKeySize; i++) {
+    int_keys[i] = std::to_string(i);
+  }
+  std::vector<double> latencies;
+  latencies.reserve(kLatencyKeySize * 2);
+  auto vrt = std::make_unique<vrt::Vrt<std::string, true, 8, Policy>>();
+  std::atomic<bool> stop = false;
+  std::thread reader([&vrt, &int_keys, &stop]() {
+    std::string value;
+    while (!stop.load(std::memory_order_relaxed)) {
+      for (uint32_t i = 0; i < kLatencyKeySize && !stop.load(std::memory_order_relaxed); i += 97) {
+        vrt->Find(int_keys[i], &value);
+      }
+    }
+  });
+  auto timed = [&latencies](auto&& op) {
+    auto begin = std::chrono::steady_clock::now();
+    op();
+    latencies.emplace_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+  };
+  for (auto _ : state) {
+    for (auto& key : int_keys) {
+      timed([&]() { vrt->Insert(key, nullptr, key); });
+    }
+    for (auto& key : int_keys) {
+      timed([&]() { vrt->Delete(key); });
+    }
+  }
+  stop.store(true);
+  reader.join();
+  std::sort(latencies.begin(), latencies.end());
+  state.counters["p99_us"] = latencies[latencies.size() * 99 / 100];
+  state.counters["p999_us"] = latencies[latencies.size() * 999 / 1000];
+  state.counters["max_us"] = latencies.back();
+  state.SetItemsProcessed(latencies.size());
+}
+
+static void RunUpsertLoadVrt(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto vrt = std::make_unique<vrt::Vrt<std::string, true, 8>>();
+    state.ResumeTiming();
+    for (int i = 0; i < kKeySize; i++) {
+      vrt->Upsert(keys[i], "123");
+    }
+    state.PauseTiming();
+    vrt.reset();
+    state.ResumeTiming();
+  }
+}
+
+static void RunBulkLoadVrt(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto vrt = std::make_unique<vrt::Vrt<std::string, true, 8>>();
+    std::vector<std::pair<std::string_view, std::string>> kvs(kKeySize);
+    for (int i = 0; i < kKeySize; i++) {
+      kvs[i] = {keys[i], "123"};
+    }
+    std::sort(kvs.begin(), kvs.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    state.ResumeTiming();
+    vrt->BulkLoad(kvs.begin(), kvs.end());
+    state.PauseTiming();
+    vrt.reset();
+    state.ResumeTiming();
+  }
+}
+
 BENCHMARK(RunInsertPhmapByMutex)->RangeMultiplier(2)->Range(1, 8);
-BENCHMARK(RunInsertVrt)->RangeMultiplier(2)->Range(1, 8);
+BENCHMARK_TEMPLATE(RunInsertVrt, vrt::VrtDefaultPolicy)->RangeMultiplier(2)->Range(1, 8);
+BENCHMARK_TEMPLATE(RunInsertVrt, vrt::VrtSlabPolicy)->RangeMultiplier(2)->Range(1, 8);
+BENCHMARK_TEMPLATE(RunMultiWriterVrt, vrt::VrtDefaultPolicy)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(RunMultiWriterVrt, vrt::VrtOptimisticWritePolicy)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(RunMultiWriterVrt, vrt::VrtPartitionedRootPolicy)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(RunMultiWriterVrt, PartitionedOptimisticPolicy)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
 BENCHMARK(RunFindPhmapByMutex)->RangeMultiplier(2)->Range(1, 8);
 BENCHMARK(RunFindVrt)->RangeMultiplier(2)->Range(1, 8);
+BENCHMARK(RunMultiFindVrt)->RangeMultiplier(2)->Range(1, 8);
+BENCHMARK_TEMPLATE(RunFindReclaimVrt, vrt::VrtDefaultPolicy)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(RunFindReclaimVrt, vrt::VrtQsbrPolicy)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(RunFindReclaimVrt, vrt::VrtHazardPointerPolicy)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
 BENCHMARK(RunDeletePhmapByMutex)->RangeMultiplier(2)->Range(1, 8);
-BENCHMARK(RunDeleteVrt)->RangeMultiplier(2)->Range(1, 8);
+BENCHMARK_TEMPLATE(RunDeleteVrt, vrt::VrtDefaultPolicy)->RangeMultiplier(2)->Range(1, 8);
+BENCHMARK_TEMPLATE(RunDeleteVrt, vrt::VrtSlabPolicy)->RangeMultiplier(2)->Range(1, 8);
+BENCHMARK_TEMPLATE(RunInsertIntVrt, vrt::VrtDefaultPolicy);
+BENCHMARK_TEMPLATE(RunInsertIntVrt, vrt::VrtInlineLeafPolicy);
+BENCHMARK_TEMPLATE(RunFindIntVrt, vrt::VrtDefaultPolicy);
+BENCHMARK_TEMPLATE(RunFindIntVrt, vrt::VrtInlineLeafPolicy);
+BENCHMARK_TEMPLATE(RunInsertDeleteBigValueVrt, vrt::VrtDefaultPolicy);
+BENCHMARK_TEMPLATE(RunInsertDeleteBigValueVrt, vrt::VrtBoxedValuePolicy);
+BENCHMARK_TEMPLATE(RunInsertDeleteVectorVrt, CopiedVector);
+BENCHMARK_TEMPLATE(RunInsertDeleteVectorVrt, std::vector<uint64_t>);
+BENCHMARK_TEMPLATE(RunBytesPerKeyVrt, true);
+BENCHMARK_TEMPLATE(RunBytesPerKeyVrt, false);
+BENCHMARK_TEMPLATE(RunAlphabetVrt, CountingPolicy)->DenseRange(0, 2);
+BENCHMARK_TEMPLATE(RunAlphabetVrt, CountingFinePolicy)->DenseRange(0, 2);
+BENCHMARK_TEMPLATE(RunFindArenaVrt, vrt::VrtDefaultPolicy)->Arg(1000000)->Arg(50000000);
+BENCHMARK_TEMPLATE(RunFindArenaVrt, vrt::VrtSlabPolicy)->Arg(1000000)->Arg(50000000);
+BENCHMARK_TEMPLATE(RunFindArenaVrt, vrt::VrtHugePagePolicy)->Arg(1000000)->Arg(50000000);
+BENCHMARK_TEMPLATE(RunWriteLatencyVrt, vrt::VrtDefaultPolicy)->UseRealTime();
+BENCHMARK_TEMPLATE(RunWriteLatencyVrt, vrt::VrtBackgroundReclaimPolicy)->UseRealTime();
+BENCHMARK(RunUpsertLoadVrt);
+BENCHMARK(RunBulkLoadVrt);
 
 int main(int argc, char** argv) {
   GenKeys();
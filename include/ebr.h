@@ -6,16 +6,34 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iterator>
 #include <mutex>
-#include <numeric>
+#include <set>
+#include <thread>
 #include <vector>
+#include "spin_lock.h"
 
 namespace vrt {
 
 constexpr uint8_t kEpochSize = 3;
-constexpr uint8_t kCacheLineSize = 64;
+// 读线程的TLS按块分配，第i块有kTLSFirstChunkSize << i个槽位，最多kTLSChunkCnt块
+constexpr uint32_t kTLSFirstChunkShift = 6;
+constexpr uint32_t kTLSFirstChunkSize = 1 << kTLSFirstChunkShift;
+constexpr uint32_t kTLSChunkCnt = 20;
+// 退休对象超过上限时写线程最多等待的次数，每次等待Sleeper::sleep()的时间
+constexpr uint32_t kBackpressureSleepCnt = 64;
+// 线程本地累计的退休对象数达到这个值时才加到全局的计数上
+constexpr uint32_t kRetireCntFlushBatch = 64;
+// 每个线程的hazard槽位数，点查下降时交替使用前两个，最后一个保存FindLongestPrefix匹配到的最深的节点
+constexpr uint32_t kHazardSlotCnt = 3;
+// 退休对象的指针低2位留给使用方做标记，和hazard槽位比较时去掉
+constexpr uintptr_t kRetireTagMask = 0x3;
 
 template <uint32_t kReadThreadNum>
 class ThreadIDManager;
@@ -27,10 +45,19 @@ struct ThreadID {
   uint32_t tid;
 };
 
+// 线程数不设上限，tid用完时分配新的。总是复用最小的空闲tid，让存活线程的tid集中在低位，
+// watermark是已分配出去的最大tid加1，GC只需要扫描[0, watermark)，开销跟随存活的读线程数。
+// kReadThreadNum不再限制线程数，只用来预分配TLS和区分tid空间。
 template <uint32_t kReadThreadNum>
 class ThreadIDManager {
  public:
-  ThreadIDManager() : tid_list_(kReadThreadNum) { std::iota(tid_list_.begin(), tid_list_.end(), 0); }
+  // 按tid保存了线程状态的对象，线程退出时在tid被复用之前调用reset(owner, tid)清理这个线程的状态
+  struct TLSOwner {
+    void *owner;
+    void (*reset)(void *owner, uint32_t tid);
+  };
+
+  ThreadIDManager() : free_tids_(), tid_cnt_(0), watermark_(0), tls_owners_() {}
   ThreadIDManager(const ThreadIDManager &) = delete;
   ThreadIDManager(ThreadIDManager &&) = delete;
   ThreadIDManager &operator=(const ThreadIDManager &) = delete;
@@ -42,126 +69,551 @@ class ThreadIDManager {
   }
 
   uint32_t AcquireThreadID() {
-    std::lock_guard<std::mutex> lock(tid_list_mutex_);
-    if (tid_list_.empty()) {
-      std::abort();
+    std::lock_guard<std::mutex> lock(tid_mutex_);
+    uint32_t tid;
+    if (free_tids_.empty()) {
+      tid = tid_cnt_++;
+    } else {
+      tid = *free_tids_.begin();
+      free_tids_.erase(free_tids_.begin());
     }
-    auto tid = tid_list_.back();
-    tid_list_.pop_back();
+    watermark_.store(tid_cnt_, std::memory_order_release);
     return tid;
   }
 
   void ReleaseThreadID(const uint32_t tid) {
-    std::lock_guard<std::mutex> lock(tid_list_mutex_);
-    tid_list_.emplace_back(tid);
+    std::lock_guard<std::mutex> lock(tid_mutex_);
+    for (auto &tls_owner : tls_owners_) {
+      tls_owner.reset(tls_owner.owner, tid);
+    }
+    free_tids_.emplace(tid);
+    // 最高位的tid都空闲时降低watermark
+    while (!free_tids_.empty() && *free_tids_.rbegin() == tid_cnt_ - 1) {
+      free_tids_.erase(std::prev(free_tids_.end()));
+      tid_cnt_--;
+    }
+    watermark_.store(tid_cnt_, std::memory_order_release);
+  }
+
+  uint32_t GetWatermark() const { return watermark_.load(std::memory_order_acquire); }
+
+  // 注销之后不会再调用它的reset，owner析构前必须注销
+  void RegisterTLSOwner(void *owner, void (*reset)(void *owner, uint32_t tid)) {
+    std::lock_guard<std::mutex> lock(tid_mutex_);
+    tls_owners_.push_back({owner, reset});
+  }
+
+  void UnregisterTLSOwner(void *owner) {
+    std::lock_guard<std::mutex> lock(tid_mutex_);
+    tls_owners_.erase(std::remove_if(tls_owners_.begin(), tls_owners_.end(),
+                                     [owner](const TLSOwner &tls_owner) { return tls_owner.owner == owner; }),
+                      tls_owners_.end());
+  }
+
+  // 同一个线程在所有kReadThreadNum相同的EbrManager中共用一个tid
+  static uint32_t GetThreadID() {
+    thread_local ThreadID<kReadThreadNum> thread_id;
+    return thread_id.tid;
   }
 
  private:
-  std::vector<uint32_t> tid_list_;
-  std::mutex tid_list_mutex_;
+  std::set<uint32_t> free_tids_;
+  uint32_t tid_cnt_;
+  std::atomic<uint32_t> watermark_;
+  std::vector<TLSOwner> tls_owners_;
+  std::mutex tid_mutex_;
 };
 
+template <class RCObject>
 struct TLS {
-  TLS() : active(false), epoch(0) {}
+  TLS()
+      : active(false), epoch(0), read_depth(0), thread_cnt(0), retire_lock(), retired(), retire_cnt(0), write_cnt(0) {
+    for (auto &hazard : hazards) {
+      hazard.store(nullptr, std::memory_order_relaxed);
+    }
+  }
   TLS(TLS &) = delete;
   TLS(TLS &&) = delete;
   void operator=(const TLS &) = delete;
   ~TLS() = default;
-  std::atomic_flag active;
+  std::atomic<bool> active;
   std::atomic<uint8_t> epoch;
+  // 读区间的嵌套层数，只有所属线程会访问
+  uint32_t read_depth;
+  // 所属线程正在进行、其他线程可能需要等待结束的操作数，见EbrManager::GetThreadCnt
+  std::atomic<uint32_t> thread_cnt;
+  // 所属线程退休的对象，按退休时的epoch分开存放，推进epoch时由回收线程整批并入待释放列表。
+  // 只有所属线程和回收线程会加锁访问，写线程退休对象时不会和其他写线程竞争
+  SpinLock retire_lock;
+  std::array<std::vector<RCObject *>, kEpochSize> retired;
+  // 还没有加到EbrManager::retire_cnt_上的退休对象数，持有retire_lock时访问
+  uint32_t retire_cnt;
+  // 所属线程上一次尝试回收之后退休的对象数，只有所属线程会访问
+  uint32_t write_cnt;
+  // 所属线程正在访问的对象，只在HazardPointerManager中使用
+  std::array<std::atomic<RCObject *>, kHazardSlotCnt> hazards;
 } __attribute__((aligned(kCacheLineSize)));
 
-template <class RCObject, class DestroyClass, uint32_t kReadThreadNum>
+// Config决定回收的方式：
+// kBackgroundReclaim为true时由后台线程每隔kReclaimIntervalUs微秒推进epoch并释放退休对象，写线程只把对象放进退休列表；
+// kReclaimBatch不为0时每次回收最多释放这么多对象，剩下的留到之后的回收，避免一次释放上万个节点；
+// kMaxRetireCnt不为0时，未释放的退休对象超过这个数的写线程会先参与回收，仍然超过时等待读线程离开旧的epoch。
+// 退休的对象先放在所属线程的TLS中，推进epoch和析构时再整批移到待释放列表，退出的线程由ResetTLS移到共享的退休列表。
+// kHazardPointer为true时释放前还要确认对象不在任何线程的hazard槽位中，见HazardPointerManager。
+template <class RCObject, class DestroyClass, uint32_t kReadThreadNum, class Config, bool kHazardPointer = false>
 class EbrManager {
  public:
-  EbrManager() : tls_list_(), global_epoch_(0), update_(false), write_cnt_(0) {
-    for (int i = 0; i < kEpochSize; i++) {
-      retire_list_[i].store(nullptr, std::memory_order_release);
+  // 预先分配能容纳kReadThreadNum个读线程的TLS，更多的读线程在第一次进入读区间时再分配
+  EbrManager()
+      : tls_chunks_(),
+        global_epoch_(0),
+        update_(false),
+        pin_cnt_(0),
+        retire_cnt_(0),
+        free_cnt_(0),
+        stop_(false) {
+    for (uint32_t chunk = 0, begin = 0; chunk < kTLSChunkCnt && begin < kReadThreadNum; chunk++) {
+      AllocateTLSChunk(chunk);
+      begin += kTLSFirstChunkSize << chunk;
+    }
+    ThreadIDManager<kReadThreadNum>::GetInstance().RegisterTLSOwner(this, &EbrManager::ResetTLS);
+    if constexpr (Config::kBackgroundReclaim) {
+      reclaimer_ = std::thread([this] { ReclaimLoop(); });
+    }
+  }
+  EbrManager(const EbrManager<RCObject, DestroyClass, kReadThreadNum, Config, kHazardPointer> &) = delete;
+  EbrManager(EbrManager<RCObject, DestroyClass, kReadThreadNum, Config, kHazardPointer> &&) = delete;
+  EbrManager &operator=(const EbrManager<RCObject, DestroyClass, kReadThreadNum, Config, kHazardPointer> &) = delete;
+  ~EbrManager() {
+    ThreadIDManager<kReadThreadNum>::GetInstance().UnregisterTLSOwner(this);
+    if constexpr (Config::kBackgroundReclaim) {
+      {
+        std::lock_guard<std::mutex> lock(reclaim_mutex_);
+        stop_.store(true, std::memory_order_release);
+      }
+      reclaim_cv_.notify_one();
+      reclaimer_.join();
+    }
+    ClearAllRetireList();
+    for (auto &tls_chunk : tls_chunks_) {
+      delete[] tls_chunk.load(std::memory_order_relaxed);
     }
   }
-  EbrManager(const EbrManager<RCObject, DestroyClass, kReadThreadNum> &) = delete;
-  EbrManager(EbrManager<RCObject, DestroyClass, kReadThreadNum> &&) = delete;
-  EbrManager &operator=(const EbrManager<RCObject, DestroyClass, kReadThreadNum> &) = delete;
-  ~EbrManager() { ClearAllRetireList(); }
 
+  // 析构时调用，这时不应该再有线程访问对象，不检查hazard槽位
   void ClearAllRetireList() {
+    while (update_.test_and_set(std::memory_order_acq_rel)) {
+    }
     for (int i = 0; i < kEpochSize; i++) {
-      ClearRetireList(i);
+      MoveToFreeList(i, UINT32_MAX);
     }
+    FreeRetired<false>(SIZE_MAX);
+    update_.clear(std::memory_order_release);
   }
 
+  // 读区间可以嵌套，只有最外层的StartRead和EndRead生效
   inline void StartRead() {
     auto &tls = GetTLS();
-    tls.active.test_and_set(std::memory_order_release);
+    if (tls.read_depth++ > 0) {
+      return;
+    }
+    tls.active.store(true, std::memory_order_release);
     tls.epoch.store(global_epoch_.load(std::memory_order_acquire), std::memory_order_seq_cst);
   }
 
-  inline void EndRead() { GetTLS().active.clear(std::memory_order_release); }
+  inline void EndRead() {
+    auto &tls = GetTLS();
+    if (--tls.read_depth > 0) {
+      return;
+    }
+    tls.active.store(false, std::memory_order_release);
+  }
+
+  // 读到的对象只在区间内使用、不交给使用方的读区间，例如写操作不加锁的下降。EBR下和StartRead、EndRead相同
+  inline void StartTransientRead() { StartRead(); }
+  inline void EndTransientRead() { EndRead(); }
+
+  // Pin之后epoch不再推进，在Unpin之前退休的对象都不会被释放，用于快照这种不在读区间内、需要长时间持有旧对象的场景。
+  // 持有update_保证不会和正在执行的TryGC交错。
+  inline void Pin() {
+    while (update_.test_and_set(std::memory_order_acq_rel)) {
+    }
+    pin_cnt_.fetch_add(1, std::memory_order_relaxed);
+    update_.clear(std::memory_order_release);
+  }
+
+  inline void Unpin() { pin_cnt_.fetch_sub(1, std::memory_order_release); }
+
+  // 当前线程的计数，每个线程独占一个cache line，数量随注册的线程增加。使用方在操作开始和结束时修改它，
+  // 需要等待进行中的操作时调用WaitThreadCntZero。Vrt用它统计进行中的乐观写。
+  inline std::atomic<uint32_t> &GetThreadCnt() { return GetTLS().thread_cnt; }
 
+  // 等待所有线程的计数归零。调用方先seq_cst写入一个标志，增加计数的线程seq_cst增加计数后再读这个标志，
+  // 这里的读取也都是seq_cst，两边至少有一方能看到另一方。新分配的块用seq_cst发布，增加过计数的槽位一定能被扫描到
+  void WaitThreadCntZero() {
+    Sleeper sleeper;
+    for (uint32_t chunk = 0; chunk < kTLSChunkCnt; chunk++) {
+      auto *tls_chunk = tls_chunks_[chunk].load(std::memory_order_seq_cst);
+      for (uint32_t i = 0; nullptr != tls_chunk && i < (kTLSFirstChunkSize << chunk); i++) {
+        while (tls_chunk[i].thread_cnt.load(std::memory_order_seq_cst) != 0) {
+          sleeper.wait();
+        }
+      }
+    }
+  }
+
+  // 对象放进当前线程的退休列表，只有推进epoch的回收线程会和它竞争这个线程的锁
   inline void FreeObject(RCObject *object) {
-    auto epoch = global_epoch_.load(std::memory_order_acquire);
-    auto *node = new RetireNode;
-    node->obj = object;
-    do {
-      node->next = retire_list_[epoch].load(std::memory_order_acquire);
-    } while (!retire_list_[epoch].compare_exchange_weak(node->next, node, std::memory_order_acq_rel));
-
-    auto write_cnt = write_cnt_.fetch_add(1, std::memory_order_relaxed);
-    if (write_cnt > kReadThreadNum) {
-      if (!update_.test_and_set(std::memory_order_acq_rel)) {
-        TryGC();
-        update_.clear(std::memory_order_release);
+    auto &tls = GetTLS();
+    {
+      std::lock_guard<SpinLock> lock(tls.retire_lock);
+      tls.retired[global_epoch_.load(std::memory_order_acquire)].emplace_back(object);
+      if constexpr (Config::kMaxRetireCnt > 0) {
+        if (++tls.retire_cnt >= kRetireCntBatch) {
+          retire_cnt_.fetch_add(tls.retire_cnt, std::memory_order_relaxed);
+          tls.retire_cnt = 0;
+        }
       }
     }
+
+    if constexpr (!Config::kBackgroundReclaim) {
+      // 上一次回收还有没释放完的对象时每次写入都继续释放一批
+      if (++tls.write_cnt > kReadThreadNum || free_cnt_.load(std::memory_order_relaxed) > 0) {
+        if (!update_.test_and_set(std::memory_order_acq_rel)) {
+          tls.write_cnt = 0;
+          TryGC(kReclaimLimit);
+          update_.clear(std::memory_order_release);
+        }
+      }
+    }
+    if constexpr (Config::kMaxRetireCnt > 0) {
+      if (unlikely(retire_cnt_.load(std::memory_order_relaxed) > Config::kMaxRetireCnt)) {
+        WaitForReclaim();
+      }
+    }
+  }
+
+ protected:
+  inline TLS<RCObject> &GetTLS() {
+    auto tid = ThreadIDManager<kReadThreadNum>::GetThreadID();
+    // tid + kTLSFirstChunkSize的最高位决定所在的块
+    auto index = tid + kTLSFirstChunkSize;
+    uint32_t chunk = 31 - __builtin_clz(index) - kTLSFirstChunkShift;
+    auto *tls_chunk = tls_chunks_[chunk].load(std::memory_order_acquire);
+    if (unlikely(nullptr == tls_chunk)) {
+      tls_chunk = AllocateTLSChunk(chunk);
+    }
+    return tls_chunk[index - (kTLSFirstChunkSize << chunk)];
+  }
+
+  // 线程退出时由ThreadIDManager在持有tid锁的情况下调用，退出的线程可能没有离开读区间（QSBR下一直在线），
+  // 清掉它的状态，既不阻塞回收，复用这个tid的线程也不会继承旧的状态。它退休的对象移到共享的退休列表，
+  // watermark降低之后回收线程不再扫描这个槽位。EbrManager析构前先注销，不会访问已释放的块
+  static void ResetTLS(void *owner, uint32_t tid) {
+    auto *mgr = static_cast<EbrManager *>(owner);
+    auto index = tid + kTLSFirstChunkSize;
+    uint32_t chunk = 31 - __builtin_clz(index) - kTLSFirstChunkShift;
+    auto *tls_chunk = mgr->tls_chunks_[chunk].load(std::memory_order_acquire);
+    if (nullptr == tls_chunk) {
+      return;
+    }
+    auto &tls = tls_chunk[index - (kTLSFirstChunkSize << chunk)];
+    tls.read_depth = 0;
+    tls.write_cnt = 0;
+    tls.active.store(false, std::memory_order_release);
+    for (auto &hazard : tls.hazards) {
+      hazard.store(nullptr, std::memory_order_release);
+    }
+    std::lock_guard<SpinLock> tls_lock(tls.retire_lock);
+    for (int i = 0; i < kEpochSize; i++) {
+      auto &retired = tls.retired[i];
+      if (!retired.empty()) {
+        std::lock_guard<SpinLock> lock(mgr->retire_list_[i].lock);
+        mgr->retire_list_[i].objects.insert(mgr->retire_list_[i].objects.end(), retired.begin(), retired.end());
+        retired.clear();
+      }
+    }
+    mgr->FlushRetireCnt(tls);
   }
 
  private:
-  inline TLS &GetTLS() {
-    thread_local ThreadID<kReadThreadNum> thread_id;
-    thread_local struct ScopedCleaner {
-      TLS &tls;
-      ~ScopedCleaner() { tls.active.clear(std::memory_order_release); }
-    } cleaner{tls_list_[thread_id.tid]};
+  // 多个线程同时分配同一块时只保留一个，块分配后直到EbrManager析构都不会移动
+  TLS<RCObject> *AllocateTLSChunk(uint32_t chunk) {
+    auto *new_chunk = new TLS<RCObject>[kTLSFirstChunkSize << chunk];
+    TLS<RCObject> *expected = nullptr;
+    if (!tls_chunks_[chunk].compare_exchange_strong(expected, new_chunk, std::memory_order_seq_cst)) {
+      delete[] new_chunk;
+      return expected;
+    }
+    return new_chunk;
+  }
 
-    return tls_list_[thread_id.tid];
+  static constexpr size_t kReclaimLimit = 0 == Config::kReclaimBatch ? SIZE_MAX : Config::kReclaimBatch;
+  // 上限较小时按比例减小每个线程累计的批次，所有线程没有加上的计数合起来大约不超过上限
+  static constexpr uint32_t kRetireCntBatch =
+      std::max<uint32_t>(1, std::min<uint32_t>(kRetireCntFlushBatch, Config::kMaxRetireCnt / kReadThreadNum));
+
+  // 调用方持有tls.retire_lock
+  inline void FlushRetireCnt(TLS<RCObject> &tls) {
+    if constexpr (Config::kMaxRetireCnt > 0) {
+      retire_cnt_.fetch_add(tls.retire_cnt, std::memory_order_relaxed);
+      tls.retire_cnt = 0;
+    }
+  }
+
+  // 调用方需要持有update_。先释放上一次回收剩下的对象，全部释放完之后才推进epoch，一次最多释放limit个对象
+  inline void TryGC(size_t limit) {
+    limit -= FreeRetired(limit);
+    if (!free_list_.empty() || !TryAdvanceEpoch()) {
+      return;
+    }
+    FreeRetired(limit);
   }
 
-  inline void TryGC() {
+  // 所有活跃的读线程都已经看到当前epoch时推进epoch，两个epoch之前退休的对象移到待释放列表
+  inline bool TryAdvanceEpoch() {
+    if (pin_cnt_.load(std::memory_order_acquire) > 0) {
+      return false;
+    }
     auto epoch = global_epoch_.load(std::memory_order_acquire);
-    // TODO 记录上一次搜索到的位置
-    for (int i = 0; i < tls_list_.size(); i++) {
-      if (tls_list_[i].active.test(std::memory_order::memory_order_acquire) &&
-          tls_list_[i].epoch.load(std::memory_order::memory_order_acquire) != epoch) {
-        return;
+    // 只扫描已经分配出去的tid，watermark之后注册的读线程看到的一定是当前或者更新的epoch
+    auto watermark = ThreadIDManager<kReadThreadNum>::GetInstance().GetWatermark();
+    for (uint32_t chunk = 0, begin = 0; chunk < kTLSChunkCnt && begin < watermark; chunk++) {
+      auto chunk_size = kTLSFirstChunkSize << chunk;
+      auto *tls_chunk = tls_chunks_[chunk].load(std::memory_order_acquire);
+      for (uint32_t i = 0; nullptr != tls_chunk && i < chunk_size && begin + i < watermark; i++) {
+        if (tls_chunk[i].active.load(std::memory_order_acquire) &&
+            tls_chunk[i].epoch.load(std::memory_order_acquire) != epoch) {
+          return false;
+        }
       }
+      begin += chunk_size;
     }
     global_epoch_.store((epoch + 1) % kEpochSize, std::memory_order_release);
-    ClearRetireList((epoch + 2) % kEpochSize);
-    write_cnt_.store(0, std::memory_order_relaxed);
+    MoveToFreeList((epoch + 2) % kEpochSize, watermark);
+    return true;
   }
 
-  inline void ClearRetireList(int index) {
-    auto *retire_node = retire_list_[index].exchange(nullptr, std::memory_order_acquire);
-    while (retire_node != nullptr) {
-      DestroyClass destroy(retire_node->obj);
-      auto *old_node = retire_node;
-      retire_node = retire_node->next;
-      delete old_node;
+  // 调用方需要持有update_。把共享退休列表和[0, watermark)的线程中index对应epoch的退休对象并入待释放列表，
+  // 上一次释放时还被hazard槽位指向的对象也放回去重新检查。
+  // 漏掉的只有watermark之后新注册的线程，它们的对象留到下一次移动这个epoch时处理，只会晚释放。
+  // 待释放列表为空时直接和共享退休列表交换；线程的列表只清空不释放，稳定后退休对象不再需要申请内存
+  inline void MoveToFreeList(int index, uint32_t watermark) {
+    {
+      std::lock_guard<SpinLock> lock(retire_list_[index].lock);
+      auto &objects = retire_list_[index].objects;
+      if (free_list_.empty()) {
+        free_list_.swap(objects);
+      } else {
+        free_list_.insert(free_list_.end(), objects.begin(), objects.end());
+        objects.clear();
+      }
+    }
+    for (uint32_t chunk = 0, begin = 0; chunk < kTLSChunkCnt && begin < watermark; chunk++) {
+      auto chunk_size = kTLSFirstChunkSize << chunk;
+      auto *tls_chunk = tls_chunks_[chunk].load(std::memory_order_acquire);
+      for (uint32_t i = 0; nullptr != tls_chunk && i < chunk_size && begin + i < watermark; i++) {
+        auto &tls = tls_chunk[i];
+        std::lock_guard<SpinLock> lock(tls.retire_lock);
+        auto &retired = tls.retired[index];
+        free_list_.insert(free_list_.end(), retired.begin(), retired.end());
+        retired.clear();
+        // 先加上计数再释放，retire_cnt_不会小于0
+        FlushRetireCnt(tls);
+      }
+      begin += chunk_size;
+    }
+    if constexpr (kHazardPointer) {
+      free_list_.insert(free_list_.end(), protected_list_.begin(), protected_list_.end());
+      protected_list_.clear();
     }
+    free_cnt_.store(free_list_.size(), std::memory_order_relaxed);
   }
 
-  struct RetireNode {
-    RCObject *obj;
-    RetireNode *next;
-  };
+  // 调用方需要持有update_。从待释放列表的尾部取出最多limit个对象释放，返回取出的个数。
+  // kCheckHazards为true时被hazard槽位指向的对象移到protected_list_，等下一次推进epoch之后再检查
+  template <bool kCheckHazards = kHazardPointer>
+  inline size_t FreeRetired(size_t limit) {
+    size_t cnt = std::min(limit, free_list_.size());
+    if constexpr (kCheckHazards) {
+      if (cnt > 0) {
+        CollectHazards();
+      }
+    }
+    size_t destroy_cnt = 0;
+    for (size_t i = 0; i < cnt; i++) {
+      auto *object = free_list_.back();
+      free_list_.pop_back();
+      if constexpr (kCheckHazards) {
+        auto *untagged = reinterpret_cast<RCObject *>(reinterpret_cast<uintptr_t>(object) & ~kRetireTagMask);
+        if (std::binary_search(hazard_set_.begin(), hazard_set_.end(), untagged)) {
+          protected_list_.push_back(object);
+          continue;
+        }
+      }
+      DestroyClass destroy(object);
+      destroy_cnt++;
+    }
+    free_cnt_.store(free_list_.size(), std::memory_order_relaxed);
+    if constexpr (Config::kMaxRetireCnt > 0) {
+      retire_cnt_.fetch_sub(destroy_cnt, std::memory_order_relaxed);
+    }
+    return cnt;
+  }
+
+  // 调用方需要持有update_。收集[0, watermark)的线程的hazard槽位，和读线程发布之后的fence配对，
+  // 读线程确认节点还挂在树上时，这里一定能看到它发布的槽位。每个线程的槽位按下标从小到大读取
+  void CollectHazards() {
+    hazard_set_.clear();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto watermark = ThreadIDManager<kReadThreadNum>::GetInstance().GetWatermark();
+    for (uint32_t chunk = 0, begin = 0; chunk < kTLSChunkCnt && begin < watermark; chunk++) {
+      auto chunk_size = kTLSFirstChunkSize << chunk;
+      auto *tls_chunk = tls_chunks_[chunk].load(std::memory_order_acquire);
+      for (uint32_t i = 0; nullptr != tls_chunk && i < chunk_size && begin + i < watermark; i++) {
+        for (auto &hazard : tls_chunk[i].hazards) {
+          if (auto *object = hazard.load(std::memory_order_acquire); nullptr != object) {
+            hazard_set_.push_back(object);
+          }
+        }
+      }
+      begin += chunk_size;
+    }
+    std::sort(hazard_set_.begin(), hazard_set_.end());
+  }
+
+  // 退休对象超过上限时的写线程先不限数量地参与回收，仍然超过时等待读线程离开旧的epoch。持有快照或者自己在读区间内时
+  // epoch无法推进，不等待；等待的次数也有上限，避免和在读区间内等锁的线程互相等待，所以上限不是严格的。
+  void WaitForReclaim() {
+    if (GetTLS().active.load(std::memory_order_relaxed)) {
+      return;
+    }
+    for (uint32_t i = 0; i < kBackpressureSleepCnt; i++) {
+      if (pin_cnt_.load(std::memory_order_acquire) > 0) {
+        return;
+      }
+      if (!update_.test_and_set(std::memory_order_acq_rel)) {
+        TryGC(SIZE_MAX);
+        update_.clear(std::memory_order_release);
+      }
+      if (retire_cnt_.load(std::memory_order_relaxed) <= Config::kMaxRetireCnt) {
+        return;
+      }
+      Sleeper::sleep();
+    }
+  }
+
+  // 后台回收线程，待释放列表为空时等待kReclaimIntervalUs微秒再尝试推进epoch
+  void ReclaimLoop() {
+    while (!stop_.load(std::memory_order_acquire)) {
+      if (!update_.test_and_set(std::memory_order_acq_rel)) {
+        TryGC(kReclaimLimit);
+        update_.clear(std::memory_order_release);
+      }
+      if (0 == free_cnt_.load(std::memory_order_relaxed)) {
+        std::unique_lock<std::mutex> lock(reclaim_mutex_);
+        reclaim_cv_.wait_for(lock, std::chrono::microseconds(Config::kReclaimIntervalUs),
+                             [this] { return stop_.load(std::memory_order_acquire); });
+      }
+    }
+  }
+
+  struct RetireList {
+    SpinLock lock;
+    std::vector<RCObject *> objects;
+  } __attribute__((aligned(kCacheLineSize)));
   std::array<char, kCacheLineSize> start_padding_;
-  std::array<TLS, kReadThreadNum> tls_list_;
+  std::array<std::atomic<TLS<RCObject> *>, kTLSChunkCnt> tls_chunks_;
+
+ protected:
   std::atomic<uint8_t> global_epoch_;
+
+ private:
   std::array<char, kCacheLineSize> mid_padding_;
   std::atomic_flag update_;
-  std::atomic<uint32_t> write_cnt_;
-  std::atomic<RetireNode *> retire_list_[kEpochSize];
+  std::atomic<uint32_t> pin_cnt_;
+  // 已退休还没有释放的对象数，只在kMaxRetireCnt不为0时维护，不包括线程中还没有加上的部分
+  std::atomic<size_t> retire_cnt_;
+  // free_list_的大小，不持有update_的线程通过它判断是否还有没释放完的对象
+  std::atomic<size_t> free_cnt_;
+  RetireList retire_list_[kEpochSize];
+  // 已经没有读线程能访问、等待释放的对象，只在持有update_时访问
+  std::vector<RCObject *> free_list_;
+  // kHazardPointer时还被hazard槽位指向的对象和收集到的槽位，只在持有update_时访问
+  std::vector<RCObject *> protected_list_;
+  std::vector<RCObject *> hazard_set_;
+  std::atomic<bool> stop_;
+  std::mutex reclaim_mutex_;
+  std::condition_variable reclaim_cv_;
+  std::thread reclaimer_;
   std::array<char, kCacheLineSize> end_padding_;
 };
 
-}  // namespace vrt
\ No newline at end of file
+// 基于静止状态的回收。线程第一次读时上线，此后一直被当作在读区间内，直到调用Quiescent()声明自己不再持有读到的
+// 对象，StartRead和EndRead在上线之后不再有任何写入。epoch推进、退休和释放的方式和EbrManager相同。
+// 在线的线程长时间不调用Quiescent()会阻止回收，阻塞之前需要调用Offline()，下一次读时重新上线。
+// 线程退出时ThreadIDManager会清掉它的槽位，忘记调用Offline()的线程退出后不会阻塞回收。
+template <class RCObject, class DestroyClass, uint32_t kReadThreadNum, class Config>
+class QsbrManager : public EbrManager<RCObject, DestroyClass, kReadThreadNum, Config> {
+ public:
+  inline void StartRead() {
+    auto &tls = this->GetTLS();
+    if (unlikely(!tls.active.load(std::memory_order_relaxed))) {
+      tls.active.store(true, std::memory_order_release);
+      tls.epoch.store(this->global_epoch_.load(std::memory_order_acquire), std::memory_order_seq_cst);
+    }
+  }
+
+  inline void EndRead() {}
+
+  // 已经在线时读区间一直有效，什么都不做；否则只在区间内上线，结束时下线，写线程不会因此一直在线而阻止回收。
+  // read_depth记录不在线时进入的嵌套层数
+  inline void StartTransientRead() {
+    auto &tls = this->GetTLS();
+    if (tls.read_depth > 0) {
+      tls.read_depth++;
+      return;
+    }
+    if (tls.active.load(std::memory_order_relaxed)) {
+      return;
+    }
+    tls.read_depth = 1;
+    tls.active.store(true, std::memory_order_release);
+    tls.epoch.store(this->global_epoch_.load(std::memory_order_acquire), std::memory_order_seq_cst);
+  }
+
+  inline void EndTransientRead() {
+    auto &tls = this->GetTLS();
+    if (0 == tls.read_depth || --tls.read_depth > 0) {
+      return;
+    }
+    tls.active.store(false, std::memory_order_release);
+  }
+
+  inline void Quiescent() {
+    auto &tls = this->GetTLS();
+    tls.epoch.store(this->global_epoch_.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  inline void Offline() { this->GetTLS().active.store(false, std::memory_order_release); }
+};
+
+// 基于hazard pointer的回收。点查不进入读区间，而是把要访问的节点发布到当前线程的hazard槽位，发布之后再确认节点
+// 仍然挂在树上，确认之后节点在槽位被覆盖或者清除之前不会被释放。epoch照常推进，乐观写的下降等仍然使用读区间，
+// 过了两个epoch的对象中被某个槽位指向的留到之后再释放。读操作不会因为停在读区间内而阻止回收，
+// 未释放的对象数只和槽位的总数有关。节点从一个槽位交给另一个时只能交给下标更大的槽位，
+// 回收时按下标从小到大读取，交接过程中至少能看到其中一个。
+template <class RCObject, class DestroyClass, uint32_t kReadThreadNum, class Config>
+class HazardPointerManager : public EbrManager<RCObject, DestroyClass, kReadThreadNum, Config, true> {
+ public:
+  // 当前线程的kHazardSlotCnt个槽位，发布之后需要seq_cst fence再确认
+  inline std::atomic<RCObject *> *GetHazards() { return this->GetTLS().hazards.data(); }
+
+  inline void ClearHazards() {
+    for (auto &hazard : this->GetTLS().hazards) {
+      hazard.store(nullptr, std::memory_order_release);
+    }
+  }
+};
+
+}  // namespace vrt
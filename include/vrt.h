@@ -6,6 +6,12 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "ebr.h"
 #include "vrt_comm.h"
 #include "vrt_node.h"
@@ -19,178 +25,1000 @@ namespace vrt {
  * @param ValueType
  * @param kWriteLock: whether a write lock is needed or not. It is not necessary to enable it for read-only or
  * single-write, multi-read scenarios.
- * @param kReadThreadNum: The number of read threads, which is very important, must be set to the maximum possible
- * number of read threads. Setting it too low will cause a core dump, while setting it too high will affect write
- * performance.
+ * @param kReadThreadNum: The expected number of read threads, only a sizing hint that does not bound the number of
+ * threads. Slots for that many readers are allocated up front and more readers are registered on demand, the per-thread
+ * state and the reclamation cost follow the number of live threads.
+ * @param Policy: VrtDefaultPolicy allocates nodes with malloc, VrtSlabPolicy uses a thread-caching slab allocator which
+ * is faster under multi-writer load, VrtInlineLeafPolicy stores small integral values in the parent's child slot
+ * instead of a leaf node, VrtBoxedValuePolicy keeps large values out of the nodes so node copies only copy a pointer
+ * and updates of an existing key swap that pointer in place, VrtFineNodePolicy adds Node8 and Node32 between the
+ * default node sizes, VrtOptimisticWritePolicy lets the writers descend without locks and lock only the nodes they
+ * modify, in which case the write threads also register as readers, VrtPartitionedRootPolicy splits the tree into 256
+ * independently locked subtrees by the first byte of the key, VrtQsbrPolicy replaces the per-read epoch updates with
+ * explicit Quiescent() calls. A custom policy can inherit VrtDefaultPolicy and override some of its members.
  */
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy = VrtDefaultPolicy>
 class Vrt {
+  using NodeHelper = VrtNodeHelper<kWriteLock, typename Policy::Allocator, Policy::kNodeLadder>;
+  // 节点中实际存放的值
+  using StoredType = std::conditional_t<Policy::kBoxedValue, VrtValueBox<ValueType, typename Policy::Allocator>,
+                                        ValueType>;
+  static constexpr bool kInlineLeaf =
+      Policy::kInlineLeaf && !Policy::kBoxedValue && VrtInlineValue<ValueType>::kSupported;
+  // 节点被替换时值是否按字节搬到新节点上，省掉一次复制构造和一次析构。可平凡复制的值复制和搬没有区别，不需要标记。
+  static constexpr bool kRelocateValue =
+      VrtIsTriviallyRelocatable<StoredType>::value && !std::is_trivially_copyable_v<StoredType>;
+  static constexpr bool kOptimisticWrite = kWriteLock && Policy::kOptimisticWrite;
+  static constexpr bool kHazardPointer = Policy::kReclaimScheme == VrtReclaimScheme::kHazardPointer;
+  // 被替换的节点保持加锁是点查确认节点仍在树上的依据；节点外的值单独退休，hazard槽位保护不到
+  static_assert(!kHazardPointer || (kWriteLock && !Policy::kBoxedValue),
+                "VrtHazardPointerPolicy requires kWriteLock and cannot box values");
+  // 根节点的分区数，分区时按key的首字节分成256棵互不相关的子树
+  static constexpr size_t kRootCnt = Policy::kPartitionedRoot ? kTwoFiveSix : 1;
+  using Roots = std::array<VrtChildPtr<kWriteLock>, kRootCnt>;
+
  public:
-  Vrt() : root_(nullptr), ebr_mgr_(), root_parent_(){};
+  Vrt() : roots_(), ebr_mgr_(), snapshot_cnt_(0){};
   Vrt(const Vrt &) = delete;
   Vrt(Vrt &&) = default;
   ~Vrt();
   Vrt &operator=(const Vrt &) = delete;
 
+  // RAII read section. The value pointers returned by Find(key, guard) stay valid until the guard is destroyed. Not
+  // available with VrtHazardPointerPolicy.
+  class ReadGuard {
+   public:
+    explicit ReadGuard(Vrt &vrt) : vrt_(vrt) {
+      static_assert(!kHazardPointer, "ReadGuard is not available with VrtHazardPointerPolicy");
+      vrt_.ebr_mgr_.StartRead();
+    }
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard(ReadGuard &&) = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+    ~ReadGuard() { vrt_.ebr_mgr_.EndRead(); }
+
+   private:
+    friend class Vrt;
+    Vrt &vrt_;
+  };
+
+  // Read-only point-in-time view of vrt. Writers keep running while it is alive, but they copy the path they modify
+  // instead of changing published nodes in place, and the replaced nodes are not reclaimed until all the snapshots are
+  // released. A snapshot must be released before vrt is destroyed.
+  class SnapshotView {
+   public:
+    SnapshotView(const SnapshotView &) = delete;
+    SnapshotView(SnapshotView &&other) : vrt_(other.vrt_), roots_(other.roots_) { other.vrt_ = nullptr; }
+    SnapshotView &operator=(const SnapshotView &) = delete;
+    SnapshotView &operator=(SnapshotView &&) = delete;
+    ~SnapshotView() {
+      if (nullptr != vrt_) {
+        vrt_->ReleaseSnapshot();
+      }
+    }
+
+    // same as Vrt::Find but on the snapshot
+    bool Find(std::string_view key, ValueType *value) const;
+    // same as Vrt::Scan but on the snapshot
+    template <class Visitor>
+    size_t Scan(std::string_view start, std::string_view end, Visitor &&visitor) const;
+
+   private:
+    friend class Vrt;
+    SnapshotView(Vrt *vrt, const Roots &roots) : vrt_(vrt), roots_(roots) {}
+
+    Vrt *vrt_;
+    Roots roots_;
+  };
+
+  // take a snapshot of the current tree, it waits for the in-flight writers to finish. When kWriteLock is false it must
+  // be called by the write thread. Not available with VrtHazardPointerPolicy.
+  SnapshotView Snapshot();
   // only read, find the key and return the value
   bool Find(std::string_view key, ValueType *value);
-  // If the key does not exist, insert it; otherwise, return the value from vrt
+  // only read, find the key and return the pointer to the value without copying it, nullptr if the key does not exist.
+  // The value is pinned by the guard and must not be modified. Not available with VrtInlineLeafPolicy or
+  // VrtHazardPointerPolicy.
+  const ValueType *Find(std::string_view key, const ReadGuard &guard);
+  // only read, find the key and call fn(const ValueType &value) inside the read section without copying the value
+  template <class Fn>
+  bool FindAndApply(std::string_view key, Fn &&fn);
+  // only read, find key_cnt keys in one read section, found_bitmap must have (key_cnt + 63) / 64 words, the bit of a
+  // key is set if it is found and its value is written to values at the same index. Return the number of found keys.
+  size_t MultiFind(const std::string_view *keys, size_t key_cnt, ValueType *values, uint64_t *found_bitmap);
+  // only read, find the longest key which is a prefix of the given key, return its value and length
+  bool FindLongestPrefix(std::string_view key, ValueType *value, size_t *matched_length);
+  // If the key does not exist, insert it; otherwise, return the value from vrt through old_value if it is not nullptr
   template <class... Args>
   bool Insert(std::string_view key, ValueType *old_value, Args &&...args);
   // if the key exist, update it
   template <class... Args>
   bool Update(std::string_view key, Args &&...args);
+  // The following interfaces modify the value in place without copying the node, they are only available when
+  // kIsAtomicValue<ValueType> is true, e.g. integral types, and the policy does not box values. Return false if the key
+  // does not exist.
+  // if the key exist, add delta to its value, old_value is optional. ValueType must be integral
+  bool FetchAdd(std::string_view key, ValueType delta, ValueType *old_value = nullptr);
+  // if the key exist, replace its value
+  bool Store(std::string_view key, ValueType value);
+  // if the key exist and its value equals *expected, replace it with desired, otherwise *expected is set to the
+  // current value. Return true only if the value is replaced.
+  bool CompareExchange(std::string_view key, ValueType *expected, ValueType desired);
   template <class... Args>
   // if the key does not exist, insert it; otherwise, update it
   bool Upsert(std::string_view key, Args &&...args);
+  // call fn(const ValueType *old_value) -> ValueType while holding the lock of the key's node, old_value is nullptr if
+  // the key does not exist. The returned value is constructed in place as the new value of the key. fn must not call
+  // the write interfaces of the same vrt.
+  template <class Fn>
+  bool Compute(std::string_view key, Fn &&fn);
+  // if the key does not exist, insert delta as its value; otherwise, replace the value with
+  // merge_fn(const ValueType &old_value, delta) atomically
+  template <class Delta, class MergeFn>
+  bool Merge(std::string_view key, Delta &&delta, MergeFn &&merge_fn);
+  // if the key does not exist, insert it; otherwise, update it. The pairs are sorted (skipped if sorted is true) and
+  // deduplicated in place, the last value of a duplicate key wins. Keys sharing a subtree are applied while holding
+  // the lock of that subtree once, and all the new children of a node are added with at most one copy of the node.
+  // The values are moved into vrt. Return the number of upserted keys.
+  size_t MultiUpsert(std::vector<std::pair<std::string_view, ValueType>> *kvs, bool sorted = false);
+  // build the tree bottom-up from [first, last) when vrt is empty. Iter is a random access iterator to pairs whose
+  // first is convertible to std::string_view and second is the value, the keys must be in ascending order and the
+  // last value of a duplicate key wins. The values are moved into vrt. Return false without modifying vrt if vrt is
+  // not empty, the keys are not sorted or some key is invalid.
+  template <class Iter>
+  bool BulkLoad(Iter first, Iter last);
   // if the key exist, delete it
   bool Delete(std::string_view key);
+  // only read, visit the keys in [start, end) in ascending order, an empty end means no upper bound. The visitor is
+  // called as visitor(std::string_view key, const ValueType &value) inside the read section and returns false to stop
+  // the scan. Return the number of visited keys. Not available with VrtHazardPointerPolicy.
+  template <class Visitor>
+  size_t Scan(std::string_view start, std::string_view end, Visitor &&visitor);
+  // only read, visit the keys starting with prefix in ascending order, the visitor is the same as Scan. At most limit
+  // keys are visited, 0 means no limit. Return the number of visited keys. Not available with VrtHazardPointerPolicy.
+  template <class Visitor>
+  size_t ForEachPrefix(std::string_view prefix, Visitor &&visitor, size_t limit = 0);
+  // Only available with VrtQsbrPolicy. The calling thread declares that it holds no value pointer returned by
+  // Find(key, guard), the nodes retired before are reclaimed once every online thread has called it. A thread goes
+  // online on its first read and must call it regularly, the write interfaces do not bring a thread online.
+  void Quiescent() {
+    static_assert(Policy::kReclaimScheme == VrtReclaimScheme::kQsbr, "Quiescent requires VrtQsbrPolicy");
+    ebr_mgr_.Quiescent();
+  }
+  // Only available with VrtQsbrPolicy. The calling thread stops blocking reclamation until its next read, it must be
+  // called before the thread blocks for a long time. A thread that exits is taken offline automatically.
+  void Offline() {
+    static_assert(Policy::kReclaimScheme == VrtReclaimScheme::kQsbr, "Offline requires VrtQsbrPolicy");
+    ebr_mgr_.Offline();
+  }
 
  private:
-  bool FindImpl(VrtNode<kWriteLock> *node, std::string_view key, ValueType *value);
+  static VrtChildPtr<kWriteLock> FindNode(VrtChildPtr<kWriteLock> node, std::string_view key);
+  template <bool kLongestPrefix>
+  VrtChildPtr<kWriteLock> HazardFindNode(std::string_view key, size_t *matched_length);
+  template <bool kLongestPrefix>
+  bool HazardDescend(std::string_view key, std::atomic<VrtNode<kWriteLock> *> *hazards,
+                     VrtChildPtr<kWriteLock> *matched_node, size_t *matched_length);
+  static bool IsInlineLeaf(VrtChildPtr<kWriteLock> node) { return kInlineLeaf && node.IsInline(); }
+  static ValueType *GetValuePtr(VrtNode<kWriteLock> *node);
+  static void LoadValue(VrtChildPtr<kWriteLock> node, ValueType *value);
   template <class... Args>
-  bool InsertImpl(VrtNode<kWriteLock> *&node, VrtNode<kWriteLock> *parent, std::string_view key, ValueType *old_value,
-                  Args &&...args);
+  static VrtChildPtr<kWriteLock> CreateLeaf(std::string_view key, Args &&...args);
+  static void ExpandInlineLeaf(VrtChildPtr<kWriteLock> &node);
+  void ReleaseSnapshot();
+  // 一棵子树的根和代替根节点父节点的锁，各分区独占cache line，不同首字节的写操作不会访问同一个cache line
+  struct RootSlot {
+    VrtChildPtr<kWriteLock> root = nullptr;
+    VrtNode<kWriteLock> root_parent;
+    // 已经进入原地修改流程但还没结束的写操作数，创建快照时需要等待它们结束
+    std::atomic<uint32_t> writer_cnt{0};
+  } __attribute__((aligned(kCacheLineSize)));
+
+  static size_t GetRootIndex(std::string_view key) { return 1 == kRootCnt ? 0 : static_cast<uint8_t>(key[0]); }
+  RootSlot &GetRootSlot(std::string_view key) { return roots_[GetRootIndex(key)]; }
+  // 按分区顺序加锁，快照、批量构造这类涉及所有分区的操作使用
+  void LockAllRoots();
+  void UnlockAllRoots();
+  template <class GetRoot, class Visitor>
+  static void ScanRoots(GetRoot &&get_root, std::string_view start, std::string_view end, Visitor &visitor,
+                        size_t *visit_cnt);
+  template <class Op>
+  bool RunWrite(RootSlot &slot, std::string_view key, Op &&op);
+  // 乐观下降停下的位置，node_ref是node在parent中的槽位，parent_ref是parent在grand中的槽位，版本号都在读槽位之前读出
+  struct OptimisticPath {
+    VrtNode<kWriteLock> *grand;
+    VrtNode<kWriteLock> *parent;
+    VrtChildPtr<kWriteLock> *parent_ref;
+    VrtChildPtr<kWriteLock> *node_ref;
+    uint32_t grand_version;
+    uint32_t parent_version;
+    char edge;
+    std::string_view key;
+  };
+  bool OptimisticDescend(std::string_view key, OptimisticPath *path);
+  template <bool kLockGrand, class Op>
+  bool TryOptimisticWrite(std::string_view key, Op &&op, bool *ret);
+  VrtNode<kWriteLock> *CopyPath(VrtNode<kWriteLock> *root, std::string_view key,
+                                std::vector<std::pair<VrtNode<kWriteLock> *, VrtNode<kWriteLock> *>> *path);
+  size_t MultiFindBatch(const std::string_view *keys, size_t key_cnt, ValueType *values, uint64_t *found_bitmap,
+                        size_t offset);
   template <class... Args>
-  bool UpdateImpl(VrtNode<kWriteLock> *&node, VrtNode<kWriteLock> *parent, std::string_view key, Args &&...args);
+  bool InsertImpl(VrtChildPtr<kWriteLock> &node, VrtNode<kWriteLock> *parent, std::string_view key,
+                  ValueType *old_value, Args &&...args);
+  template <class Fn>
+  bool ApplyInPlace(std::string_view key, Fn &&fn);
+  template <class Fn>
+  bool ApplyInPlaceImpl(VrtChildPtr<kWriteLock> &node, VrtNode<kWriteLock> *parent, std::string_view key, Fn &fn);
   template <class... Args>
-  bool UpsertImpl(VrtNode<kWriteLock> *&node, VrtNode<kWriteLock> *parent, std::string_view key, Args &&...args);
-  bool DeleteImpl(VrtNode<kWriteLock> *&node, VrtNode<kWriteLock> *parent, std::string_view key);
+  bool UpdateImpl(VrtChildPtr<kWriteLock> &node, VrtNode<kWriteLock> *parent, std::string_view key, Args &&...args);
+  template <class Fn>
+  bool ComputeImpl(VrtChildPtr<kWriteLock> &node, VrtNode<kWriteLock> *parent, std::string_view key, Fn &fn);
+  bool DeleteImpl(VrtChildPtr<kWriteLock> &node, char edge, VrtNode<kWriteLock> *parent,
+                  VrtChildPtr<kWriteLock> *parent_ref, VrtNode<kWriteLock> *grand, std::string_view key);
+  void DeleteValue(VrtChildPtr<kWriteLock> &node, char edge, VrtNode<kWriteLock> *parent,
+                   VrtChildPtr<kWriteLock> *parent_ref, VrtNode<kWriteLock> *grand);
+  template <class Iter>
+  VrtChildPtr<kWriteLock> BuildTree(Iter first, Iter last, size_t depth);
+  template <class Iter>
+  void MultiUpsertImpl(VrtChildPtr<kWriteLock> &node, Iter first, Iter last, size_t depth);
+  template <class Visitor>
+  static bool ScanImpl(VrtChildPtr<kWriteLock> node, std::string *key, std::string_view start, std::string_view end,
+                       bool check_start, Visitor &visitor, size_t *visit_cnt);
 
   void FreeNode(VrtNode<kWriteLock> *node);
+  void FreeChild(VrtChildPtr<kWriteLock> node);
+  void FreeRelocatedNode(VrtChildPtr<kWriteLock> node);
+  template <class... Args>
+  void *ReplaceBoxedValue(VrtNode<kWriteLock> *node, Args &&...args);
+  void FreeBoxedValue(void *rep);
 
-  VrtNode<kWriteLock> *root_;
-  EbrManager<VrtNode<kWriteLock>, VrtNodeDestroy<ValueType, kWriteLock>, kReadThreadNum> ebr_mgr_;
-  VrtNode<kWriteLock> root_parent_;
+  std::array<RootSlot, kRootCnt> roots_;
+  using NodeDestroy = VrtNodeDestroy<StoredType, kWriteLock, typename Policy::Allocator, Policy::kNodeLadder>;
+  std::conditional_t<
+      Policy::kReclaimScheme == VrtReclaimScheme::kQsbr,
+      QsbrManager<VrtNode<kWriteLock>, NodeDestroy, kReadThreadNum, Policy>,
+      std::conditional_t<kHazardPointer, HazardPointerManager<VrtNode<kWriteLock>, NodeDestroy, kReadThreadNum, Policy>,
+                         EbrManager<VrtNode<kWriteLock>, NodeDestroy, kReadThreadNum, Policy>>>
+      ebr_mgr_;
+  // 存活的快照数，不为0时写操作复制路径而不是原地修改
+  std::atomic<uint32_t> snapshot_cnt_;
 };
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
-Vrt<ValueType, kWriteLock, kReadThreadNum>::~Vrt() {
-  if (root_ == nullptr) {
-    return;
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::~Vrt() {
+  for (auto &slot : roots_) {
+    if (nullptr != slot.root) {
+      NodeHelper::template DestroyTree<StoredType>(slot.root);
+    }
   }
-  VrtNodeHelper<kWriteLock>::template DestroyTree<ValueType>(root_);
 #ifdef MEM_DEBUG
   ebr_mgr_.ClearAllRetireList();
-  std::cout << "create_node_cnt = " << VrtNodeHelper<kWriteLock>::GetCreateNodeCnt() << std::endl;
-  std::cout << "destroy_node_cnt = " << VrtNodeHelper<kWriteLock>::GetDestroyNodeCnt() << std::endl;
+  std::cout << "create_node_cnt = " << NodeHelper::GetCreateNodeCnt() << std::endl;
+  std::cout << "destroy_node_cnt = " << NodeHelper::GetDestroyNodeCnt() << std::endl;
 #endif
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
-void Vrt<ValueType, kWriteLock, kReadThreadNum>::FreeNode(VrtNode<kWriteLock> *node) {
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::FreeNode(VrtNode<kWriteLock> *node) {
   ebr_mgr_.FreeObject(node);
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::Find(std::string_view key, ValueType *value) {
+// InlineLeaf没有对应的节点，不需要回收
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::FreeChild(VrtChildPtr<kWriteLock> node) {
+  if (!IsInlineLeaf(node)) {
+    FreeNode(node);
+  }
+}
+
+// node的值已经通过kRelocateValue搬到替换节点上，回收时不再析构。搬走时没有修改node，还能看到node的读线程和快照
+// 读到的仍然是完整的值。调用方要保证替换节点在node从树上摘下之后才会退休，这样值的析构一定晚于这些读线程结束。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::FreeRelocatedNode(VrtChildPtr<kWriteLock> node) {
+  if constexpr (kRelocateValue) {
+    ebr_mgr_.FreeObject(NodeHelper::MarkValueRelocated(node));
+  } else {
+    FreeChild(node);
+  }
+}
+
+// 节点外的值只是节点中的一个指针，已有值的节点不需要复制，调用方持有node的锁时原地换上新的box，返回旧的值。
+// 存在快照时node是写操作复制出来的副本，快照中的节点不受影响
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class... Args>
+void *Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::ReplaceBoxedValue(VrtNode<kWriteLock> *node,
+                                                                            Args &&...args) {
+  StoredType box(std::forward<Args>(args)...);
+  return NodeHelper::template GetValuePtr<StoredType>(node)->Replace(std::move(box));
+}
+
+// 读线程可能还在访问换下来的值，快照中的节点也可能引用它，交给EBR，等读线程结束后再释放节点对它的引用
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::FreeBoxedValue(void *rep) {
+  ebr_mgr_.FreeObject(NodeHelper::MarkValueBox(rep));
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+typename Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::SnapshotView
+Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Snapshot() {
+  // 快照中的节点没有hazard槽位保护
+  static_assert(!kHazardPointer, "Snapshot is not available with VrtHazardPointerPolicy");
+  LockAllRoots();
+  snapshot_cnt_.fetch_add(1, std::memory_order_seq_cst);
+  // 新的写操作会因为root_parent的锁或者snapshot_cnt_走复制路径，只需要等待已经开始原地修改的写操作
+  Sleeper sleeper;
+  for (auto &slot : roots_) {
+    while (slot.writer_cnt.load(std::memory_order_acquire) != 0) {
+      sleeper.wait();
+    }
+  }
+  if constexpr (kOptimisticWrite) {
+    ebr_mgr_.WaitThreadCntZero();
+  }
+  ebr_mgr_.Pin();
+  Roots roots;
+  for (size_t i = 0; i < kRootCnt; i++) {
+    roots[i] = roots_[i].root;
+  }
+  UnlockAllRoots();
+  return SnapshotView(this, roots);
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::ReleaseSnapshot() {
+  LockAllRoots();
+  snapshot_cnt_.fetch_sub(1, std::memory_order_relaxed);
+  ebr_mgr_.Unpin();
+  UnlockAllRoots();
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::LockAllRoots() {
+  for (auto &slot : roots_) {
+    slot.root_parent.Lock();
+  }
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::UnlockAllRoots() {
+  for (auto &slot : roots_) {
+    slot.root_parent.Unlock();
+  }
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::SnapshotView::Find(std::string_view key,
+                                                                            ValueType *value) const {
   if (unlikely(key.empty())) {
     return false;
   }
-  ebr_mgr_.StartRead();
-  if (unlikely(nullptr == root_)) {
+  auto node = FindNode(roots_[GetRootIndex(key)], key);
+  if (nullptr != node) {
+    LoadValue(node, value);
+  }
+  return nullptr != node;
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Visitor>
+size_t Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::SnapshotView::Scan(std::string_view start,
+                                                                              std::string_view end,
+                                                                              Visitor &&visitor) const {
+  size_t visit_cnt = 0;
+  ScanRoots([this](size_t i) { return roots_[i]; }, start, end, visitor, &visit_cnt);
+  return visit_cnt;
+}
+
+// 写操作的公共入口，调用方已经持有key所在分区root_parent的锁，op(VrtNode *&root, VrtNode *parent)执行具体的写操作并负责
+// 解锁parent。存在快照时已发布的节点不能原地修改，先复制key经过的路径，在副本上执行写操作，成功后再整体发布新的根节点。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Op>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::RunWrite(RootSlot &slot, std::string_view key, Op &&op) {
+  if (likely(0 == snapshot_cnt_.load(std::memory_order_relaxed))) {
+    if constexpr (kWriteLock) {
+      slot.writer_cnt.fetch_add(1, std::memory_order_relaxed);
+    }
+    auto ret = op(slot.root, &slot.root_parent);
+    if constexpr (kWriteLock) {
+      slot.writer_cnt.fetch_sub(1, std::memory_order_release);
+    }
+    return ret;
+  }
+  std::vector<std::pair<VrtNode<kWriteLock> *, VrtNode<kWriteLock> *>> path;
+  VrtChildPtr<kWriteLock> new_root = CopyPath(slot.root, key, &path);
+  // 副本对其他线程不可见，用一个临时的父节点代替root_parent，整个写操作期间一直持有root_parent的锁
+  VrtNode<kWriteLock> dummy_parent;
+  dummy_parent.Lock();
+  auto ret = op(new_root, &dummy_parent);
+  if (ret) {
+    slot.root = new_root;
+    for (auto &[old_node, new_node] : path) {
+      FreeNode(old_node);
+    }
+  } else {
+    // 写操作失败时没有修改副本
+    for (auto &[old_node, new_node] : path) {
+      NodeHelper::template DestroyNode<StoredType>(new_node);
+    }
+  }
+  slot.root_parent.Unlock();
+  return ret;
+}
+
+// 不加锁沿key下降，停在写操作要开始处理的节点上：InlineLeaf、前缀不匹配、key在node上结束或者node没有下一个字符的子节点。
+// 和读线程一样需要在读区间内调用。经过的节点已经加锁时返回false，说明有写操作正在修改它或者它已经被替换。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::OptimisticDescend(std::string_view key,
+                                                                           OptimisticPath *path) {
+  VrtNode<kWriteLock> *grand = nullptr;
+  uint32_t grand_version = 0;
+  auto &slot = GetRootSlot(key);
+  VrtNode<kWriteLock> *parent = &slot.root_parent;
+  uint32_t parent_version = parent->ReadVersion();
+  VrtChildPtr<kWriteLock> *parent_ref = nullptr;
+  VrtChildPtr<kWriteLock> *node_ref = &slot.root;
+  char edge = '\0';
+  while (true) {
+    if (VrtNode<kWriteLock>::IsLocked(parent_version)) {
+      return false;
+    }
+    VrtChildPtr<kWriteLock> node = *node_ref;
+    if (nullptr == node || IsInlineLeaf(node)) {
+      break;
+    }
+    auto node_version = node->ReadVersion();
+    auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, key);
+    if (same_prefix_length < node->key_length || same_prefix_length == key.length()) {
+      break;
+    }
+    VrtChildPtr<kWriteLock> &next_node = NodeHelper::FindChild(node, key[same_prefix_length]);
+    if (nullptr == next_node) {
+      break;
+    }
+    grand = parent;
+    grand_version = parent_version;
+    parent = node;
+    parent_version = node_version;
+    parent_ref = node_ref;
+    node_ref = &next_node;
+    edge = key[same_prefix_length];
+    key.remove_prefix(same_prefix_length + 1);
+  }
+  *path = {grand, parent, parent_ref, node_ref, grand_version, parent_version, edge, key};
+  return true;
+}
+
+// 乐观写：先不加锁下降，再按下降时读到的版本号给parent加锁(kLockGrand时先给grand加锁)。加锁成功说明它们在读出槽位之后
+// 没有被修改或者替换，node仍然挂在parent上，op(OptimisticPath &path)从这里继续原来逐层加锁的流程，上层节点都不加锁。
+// 持有parent的锁之后parent不会被回收，可以提前结束读区间。存在快照、树为空或者多次重试失败时返回false，
+// 由调用方走逐层加锁的流程；否则op的返回值写入ret。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <bool kLockGrand, class Op>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::TryOptimisticWrite(std::string_view key, Op &&op,
+                                                                            bool *ret) {
+  // 进行中的乐观写按线程计数，计数放在线程在ebr_mgr_中的槽位上，随注册的线程增加，线程之间不共用
+  auto &writer_cnt = ebr_mgr_.GetThreadCnt();
+  // 和Snapshot中先加snapshot_cnt_再读计数的顺序相反，两边都是seq_cst，至少有一方能看到另一方
+  writer_cnt.fetch_add(1, std::memory_order_seq_cst);
+  if (unlikely(0 != snapshot_cnt_.load(std::memory_order_seq_cst))) {
+    writer_cnt.fetch_sub(1, std::memory_order_release);
+    return false;
+  }
+  bool done = false;
+  Sleeper sleeper;
+  for (uint32_t retry = 0; retry < kOptimisticWriteRetryCnt && !done; retry++) {
+    OptimisticPath path;
+    ebr_mgr_.StartTransientRead();
+    if (!OptimisticDescend(key, &path)) {
+      ebr_mgr_.EndTransientRead();
+      sleeper.wait();
+      continue;
+    }
+    bool lock_grand = kLockGrand && nullptr != path.grand;
+    if (lock_grand && !path.grand->TryLock(path.grand_version)) {
+      ebr_mgr_.EndTransientRead();
+      sleeper.wait();
+      continue;
+    }
+    if (!path.parent->TryLock(path.parent_version)) {
+      if (lock_grand) {
+        path.grand->Unlock();
+      }
+      ebr_mgr_.EndTransientRead();
+      sleeper.wait();
+      continue;
+    }
+    ebr_mgr_.EndTransientRead();
+    if (nullptr == *path.node_ref) {
+      // 分区为空，parent一定是root_parent
+      path.parent->Unlock();
+      break;
+    }
+    *ret = op(path);
+    done = true;
+  }
+  writer_cnt.fetch_sub(1, std::memory_order_release);
+  return done;
+}
+
+// 复制根节点到key所在位置的路径，副本的子节点指向原来的子树，path按从上到下的顺序记录(原节点, 副本)
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+VrtNode<kWriteLock> *Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::CopyPath(
+     VrtNode<kWriteLock> *root, std::string_view key,
+     std::vector<std::pair<VrtNode<kWriteLock> *, VrtNode<kWriteLock> *>> *path) {
+  auto copy_node = [](VrtNode<kWriteLock> *node) {
+    return NodeHelper::template CreateVrtNodeByResize<StoredType>(node, NodeHelper::GetChildCapacity(node));
+  };
+  VrtNode<kWriteLock> *old_node = root;
+  auto *new_root = copy_node(old_node);
+  auto *new_node = new_root;
+  path->emplace_back(old_node, new_node);
+  while (true) {
+    auto same_prefix_length = NodeHelper::CheckSamePrefixLength(old_node, key);
+    if (same_prefix_length < old_node->key_length || same_prefix_length == key.length()) {
+      break;
+    }
+    VrtChildPtr<kWriteLock> &child = NodeHelper::FindChild(new_node, key[same_prefix_length]);
+    if (nullptr == child || IsInlineLeaf(child)) {
+      // InlineLeaf随副本一起复制了，写操作直接修改副本中的槽位
+      break;
+    }
+    old_node = child;
+    new_node = copy_node(old_node);
+    child = new_node;
+    path->emplace_back(old_node, new_node);
+    key.remove_prefix(same_prefix_length + 1);
+  }
+  return new_root;
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Find(std::string_view key, ValueType *value) {
+  if (unlikely(key.empty())) {
     return false;
   }
-  auto ret = FindImpl(root_, key, value);
+  if constexpr (kHazardPointer) {
+    auto node = HazardFindNode<false>(key, nullptr);
+    if (nullptr != node) {
+      LoadValue(node, value);
+    }
+    ebr_mgr_.ClearHazards();
+    return nullptr != node;
+  }
+  ebr_mgr_.StartRead();
+  auto node = FindNode(GetRootSlot(key).root, key);
+  if (nullptr != node) {
+    LoadValue(node, value);
+  }
   ebr_mgr_.EndRead();
-  return ret;
+  return nullptr != node;
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::FindImpl(VrtNode<kWriteLock> *node, std::string_view key,
-                                                          ValueType *value) {
-  auto same_prefix_length = VrtNodeHelper<kWriteLock>::CheckSamePrefixLength(node, key);
-  if (same_prefix_length < node->key_length) {
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+const ValueType *Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Find(std::string_view key,
+                                                                          [[maybe_unused]] const ReadGuard &guard) {
+  static_assert(!kInlineLeaf, "the value of an inline leaf has no stable address");
+  static_assert(!kHazardPointer, "Find with a ReadGuard is not available with VrtHazardPointerPolicy");
+  // 返回的指针只受guard所在的读区间保护，guard必须属于这棵树
+  assert(&guard.vrt_ == this);
+  if (unlikely(key.empty())) {
+    return nullptr;
+  }
+  auto node = FindNode(GetRootSlot(key).root, key);
+  if (nullptr == node) {
+    return nullptr;
+  }
+  return GetValuePtr(node);
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Fn>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::FindAndApply(std::string_view key, Fn &&fn) {
+  if (unlikely(key.empty())) {
     return false;
   }
-  if (key.length() == same_prefix_length) {
-    if (node->has_value) {
-      *value = VrtNodeHelper<kWriteLock>::template GetValue<ValueType>(node);
-      return true;
+  VrtChildPtr<kWriteLock> node;
+  if constexpr (kHazardPointer) {
+    node = HazardFindNode<false>(key, nullptr);
+  } else {
+    ebr_mgr_.StartRead();
+    node = FindNode(GetRootSlot(key).root, key);
+  }
+  if (IsInlineLeaf(node)) {
+    auto value = VrtInlineValue<ValueType>::Decode(node.GetPayload());
+    fn(static_cast<const ValueType &>(value));
+  } else if (nullptr != node) {
+    fn(static_cast<const ValueType &>(*GetValuePtr(node)));
+  }
+  if constexpr (kHazardPointer) {
+    ebr_mgr_.ClearHazards();
+  } else {
+    ebr_mgr_.EndRead();
+  }
+  return nullptr != node;
+}
+
+// 需要在读区间内调用，返回以node为根的子树中key对应的带值节点或者InlineLeaf。
+// 节点类型取自父节点中的指针，节点头部和key所在的cache line可以同时加载。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+VrtChildPtr<kWriteLock> Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::FindNode(VrtChildPtr<kWriteLock> node,
+                                                                                     std::string_view key) {
+  while (nullptr != node) {
+    if (IsInlineLeaf(node)) {
+      return key.empty() ? node : nullptr;
+    }
+    auto type = node.GetType();
+    VRT_PREFETCH(NodeHelper::GetData(node, type));
+    auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, type, key);
+    if (same_prefix_length < node->key_length) {
+      return nullptr;
+    }
+    if (key.length() == same_prefix_length) {
+      return node->has_value ? node : nullptr;
+    }
+    node = NodeHelper::FindChild(node, type, key[same_prefix_length]);
+    key.remove_prefix(same_prefix_length + 1);
+  }
+  return nullptr;
+}
+
+// kHazardPointer下点查的下降，确认失败时等待一会儿从根重新下降。返回的节点受当前线程的hazard槽位保护，
+// 调用方用完之后清除槽位。kLongestPrefix的含义见HazardDescend
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <bool kLongestPrefix>
+VrtChildPtr<kWriteLock> Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::HazardFindNode(std::string_view key,
+                                                                                           size_t *matched_length) {
+  auto *hazards = ebr_mgr_.GetHazards();
+  VrtChildPtr<kWriteLock> matched_node = nullptr;
+  Sleeper sleeper;
+  while (!HazardDescend<kLongestPrefix>(key, hazards, &matched_node, matched_length)) {
+    sleeper.wait();
+  }
+  return matched_node;
+}
+
+// 每一层先把子节点发布到hazard槽位，fence之后再确认父节点的槽位仍然指向它并且父节点没有加锁。被替换的节点一直保持
+// 加锁直到回收，确认通过说明这时子节点还挂在树上，回收线程之后收集槽位时一定能看到它。父节点正在被修改或者已经被
+// 替换时返回false。根节点的父节点是root_parent，它不会被替换，只需要确认槽位。
+// 下降时交替使用前两个槽位，父节点在子节点确认之前一直受保护。kLongestPrefix为false时matched_node是key对应的带值
+// 节点或者InlineLeaf；为true时是路径上最深的带值节点，它被交给最后一个槽位，它的key长度写入matched_length。
+// InlineLeaf的值就在受保护的父节点的槽位中，不需要单独保护。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <bool kLongestPrefix>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::HazardDescend(std::string_view key,
+                                                                       std::atomic<VrtNode<kWriteLock> *> *hazards,
+                                                                       VrtChildPtr<kWriteLock> *matched_node,
+                                                                       size_t *matched_length) {
+  VrtChildPtr<kWriteLock> *node_ref = &GetRootSlot(key).root;
+  VrtNode<kWriteLock> *parent = nullptr;
+  uint32_t index = 0;
+  size_t length = 0;
+  *matched_node = nullptr;
+  while (true) {
+    VrtChildPtr<kWriteLock> node = *node_ref;
+    if (nullptr == node) {
+      break;
+    }
+    if (IsInlineLeaf(node)) {
+      if (kLongestPrefix || key.empty()) {
+        *matched_node = node;
+        if constexpr (kLongestPrefix) {
+          *matched_length = length;
+        }
+      }
+      break;
+    }
+    hazards[index].store(node.Get(), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!node_ref->IsSame(node) || (nullptr != parent && VrtNode<kWriteLock>::IsLocked(parent->ReadVersion()))) {
+      return false;
+    }
+    auto type = node.GetType();
+    VRT_PREFETCH(NodeHelper::GetData(node, type));
+    auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, type, key);
+    if (same_prefix_length < node->key_length) {
+      break;
+    }
+    if constexpr (kLongestPrefix) {
+      length += same_prefix_length;
+      if (node->has_value) {
+        // 下一层的fence之后才会覆盖node所在的槽位
+        hazards[kHazardSlotCnt - 1].store(node.Get(), std::memory_order_relaxed);
+        *matched_node = node;
+        *matched_length = length;
+      }
+    }
+    if (key.length() == same_prefix_length) {
+      if (!kLongestPrefix && node->has_value) {
+        *matched_node = node;
+      }
+      break;
+    }
+    parent = node;
+    node_ref = &NodeHelper::FindChild(node, type, key[same_prefix_length]);
+    key.remove_prefix(same_prefix_length + 1);
+    length++;
+    index ^= 1;
+  }
+  return true;
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+ValueType *Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::GetValuePtr(VrtNode<kWriteLock> *node) {
+  if constexpr (Policy::kBoxedValue) {
+    return NodeHelper::template GetValuePtr<StoredType>(node)->Get();
+  } else {
+    return NodeHelper::template GetValuePtr<ValueType>(node);
+  }
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::LoadValue(VrtChildPtr<kWriteLock> node, ValueType *value) {
+  if (IsInlineLeaf(node)) {
+    *value = VrtInlineValue<ValueType>::Decode(node.GetPayload());
+  } else if constexpr (Policy::kBoxedValue) {
+    *value = *GetValuePtr(node);
+  } else {
+    NodeHelper::LoadValue(node, value);
+  }
+}
+
+// key为空并且值可以编码时返回InlineLeaf，否则创建叶子节点
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class... Args>
+VrtChildPtr<kWriteLock> Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::CreateLeaf(std::string_view key,
+                                                                                       Args &&...args) {
+  if constexpr (kInlineLeaf) {
+    if (key.empty()) {
+      ValueType value(std::forward<Args>(args)...);
+      if (uintptr_t payload; VrtInlineValue<ValueType>::Encode(value, &payload)) {
+        return VrtChildPtr<kWriteLock>::CreateInline(payload);
+      }
+      return NodeHelper::template CreateVrtNode<LeafNode, StoredType>(key, std::move(value));
+    }
+  }
+  return NodeHelper::template CreateVrtNode<LeafNode, StoredType>(key, std::forward<Args>(args)...);
+}
+
+// 把InlineLeaf换成等价的key为空的叶子节点，之后就可以在它下面挂子节点。调用方持有父节点的锁。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::ExpandInlineLeaf(VrtChildPtr<kWriteLock> &node) {
+  node = NodeHelper::template CreateVrtNode<LeafNode, StoredType>(
+      "", VrtInlineValue<ValueType>::Decode(node.GetPayload()));
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+size_t Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::MultiFind(const std::string_view *keys, size_t key_cnt,
+                                                                     ValueType *values, uint64_t *found_bitmap) {
+  memset(found_bitmap, 0, (key_cnt + 63) / 64 * sizeof(uint64_t));
+  size_t found_cnt = 0;
+  if constexpr (kHazardPointer) {
+    // 每个key同时持有的节点都要占一个槽位，不再让一批key交错下降，逐个查找
+    for (size_t i = 0; i < key_cnt; i++) {
+      if (likely(!keys[i].empty())) {
+        if (auto node = HazardFindNode<false>(keys[i], nullptr); nullptr != node) {
+          LoadValue(node, &values[i]);
+          found_bitmap[i / 64] |= 1ULL << (i % 64);
+          found_cnt++;
+        }
+      }
+    }
+    ebr_mgr_.ClearHazards();
+    return found_cnt;
+  }
+  ebr_mgr_.StartRead();
+  for (size_t offset = 0; offset < key_cnt; offset += kMultiFindBatchSize) {
+    found_cnt += MultiFindBatch(keys, std::min(key_cnt - offset, kMultiFindBatchSize), values, found_bitmap, offset);
+  }
+  ebr_mgr_.EndRead();
+  return found_cnt;
+}
+
+// 一批key同时下降，每轮每个key只前进一层并预取下一层节点，让互不依赖的cache miss重叠
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+size_t Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::MultiFindBatch(const std::string_view *keys, size_t key_cnt,
+                                                                          ValueType *values, uint64_t *found_bitmap,
+                                                                          size_t offset) {
+  VrtChildPtr<kWriteLock> nodes[kMultiFindBatchSize];
+  std::string_view rest_keys[kMultiFindBatchSize];
+  uint8_t active_index[kMultiFindBatchSize];
+  size_t active_cnt = 0;
+  for (size_t i = 0; i < key_cnt; i++) {
+    if (likely(!keys[offset + i].empty())) {
+      nodes[i] = GetRootSlot(keys[offset + i]).root;
+      if (unlikely(nullptr == nodes[i])) {
+        continue;
+      }
+      rest_keys[i] = keys[offset + i];
+      active_index[active_cnt++] = i;
     }
+  }
+  size_t found_cnt = 0;
+  while (active_cnt > 0) {
+    size_t next_active_cnt = 0;
+    for (size_t j = 0; j < active_cnt; j++) {
+      auto i = active_index[j];
+      auto node = nodes[i];
+      auto &key = rest_keys[i];
+      if (IsInlineLeaf(node)) {
+        if (key.empty()) {
+          LoadValue(node, &values[offset + i]);
+          found_bitmap[(offset + i) / 64] |= 1ULL << ((offset + i) % 64);
+          found_cnt++;
+        }
+        continue;
+      }
+      auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, node.GetType(), key);
+      if (same_prefix_length < node->key_length) {
+        continue;
+      }
+      if (key.length() == same_prefix_length) {
+        if (node->has_value) {
+          LoadValue(node, &values[offset + i]);
+          found_bitmap[(offset + i) / 64] |= 1ULL << ((offset + i) % 64);
+          found_cnt++;
+        }
+        continue;
+      }
+      auto next_node = NodeHelper::FindChild(node, node.GetType(), key[same_prefix_length]);
+      if (nullptr == next_node) {
+        continue;
+      }
+      if (!IsInlineLeaf(next_node)) {
+        VRT_PREFETCH(next_node.Get());
+      }
+      nodes[i] = next_node;
+      key.remove_prefix(same_prefix_length + 1);
+      active_index[next_active_cnt++] = i;
+    }
+    active_cnt = next_active_cnt;
+  }
+  return found_cnt;
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::FindLongestPrefix(std::string_view key, ValueType *value,
+                                                                           size_t *matched_length) {
+  if (unlikely(key.empty())) {
     return false;
   }
-  if (VrtNode<kWriteLock> *&next_node = VrtNodeHelper<kWriteLock>::FindChild(node, key[same_prefix_length]);
-      next_node != nullptr) {
+  if constexpr (kHazardPointer) {
+    auto matched_node = HazardFindNode<true>(key, matched_length);
+    if (nullptr != matched_node) {
+      LoadValue(matched_node, value);
+    }
+    ebr_mgr_.ClearHazards();
+    return nullptr != matched_node;
+  }
+  ebr_mgr_.StartRead();
+  // 一次下降，记录路径上最深的带值节点
+  VrtChildPtr<kWriteLock> matched_node = nullptr;
+  size_t length = 0;
+  VrtChildPtr<kWriteLock> node = GetRootSlot(key).root;
+  while (nullptr != node) {
+    if (IsInlineLeaf(node)) {
+      // 相当于key为空的叶子，一定是key的前缀
+      matched_node = node;
+      *matched_length = length;
+      break;
+    }
+    auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, key);
+    if (same_prefix_length < node->key_length) {
+      break;
+    }
+    length += same_prefix_length;
+    if (node->has_value) {
+      matched_node = node;
+      *matched_length = length;
+    }
+    if (key.length() == same_prefix_length) {
+      break;
+    }
+    node = NodeHelper::FindChild(node, key[same_prefix_length]);
     key.remove_prefix(same_prefix_length + 1);
-    return FindImpl(next_node, key, value);
+    length++;
   }
-  return false;
+  if (nullptr != matched_node) {
+    LoadValue(matched_node, value);
+  }
+  ebr_mgr_.EndRead();
+  return nullptr != matched_node;
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
 template <class... Args>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::Insert(std::string_view key, ValueType *old_value, Args &&...args) {
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Insert(std::string_view key, ValueType *old_value,
+                                                                Args &&...args) {
   if (unlikely(key.empty() || key.size() >= kMaxKeySize)) {
     return false;
   }
-  root_parent_.Lock();
-  if (nullptr == root_) {
-    root_ = VrtNodeHelper<kWriteLock>::template CreateVrtNode<LeafNode, ValueType>(key, std::forward<Args>(args)...);
-    root_parent_.Unlock();
+  if constexpr (kOptimisticWrite) {
+    bool ret = false;
+    if (TryOptimisticWrite<false>(key, [&](OptimisticPath &path) {
+          return InsertImpl(*path.node_ref, path.parent, path.key, old_value, std::forward<Args>(args)...);
+        }, &ret)) {
+      return ret;
+    }
+  }
+  auto &slot = GetRootSlot(key);
+  slot.root_parent.Lock();
+  if (nullptr == slot.root) {
+    slot.root = NodeHelper::template CreateVrtNode<LeafNode, StoredType>(key, std::forward<Args>(args)...);
+    slot.root_parent.Unlock();
     return true;
   }
-  return InsertImpl(root_, &root_parent_, key, old_value, std::forward<Args>(args)...);
+  return RunWrite(slot, key, [&](VrtChildPtr<kWriteLock> &root, VrtNode<kWriteLock> *parent) {
+    return InsertImpl(root, parent, key, old_value, std::forward<Args>(args)...);
+  });
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
 template <class... Args>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::InsertImpl(VrtNode<kWriteLock> *&node, VrtNode<kWriteLock> *parent,
-                                                            std::string_view key, ValueType *old_value,
-                                                            Args &&...args) {
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::InsertImpl(VrtChildPtr<kWriteLock> &node,
+                                                                    VrtNode<kWriteLock> *parent, std::string_view key,
+                                                                    ValueType *old_value, Args &&...args) {
+  if (IsInlineLeaf(node)) {
+    if (key.empty()) {
+      if (nullptr != old_value) {
+        LoadValue(node, old_value);
+      }
+      parent->Unlock();
+      return false;
+    }
+    ExpandInlineLeaf(node);
+  }
   node->Lock();
-  auto same_prefix_length = VrtNodeHelper<kWriteLock>::CheckSamePrefixLength(node, key);
+  auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, key);
   if (same_prefix_length < key.length() && same_prefix_length < node->key_length) {
     // 同前缀部分作为父节点，旧节点去掉相同部分后作为child1，key剩余部分新建结点作为child2。
     std::string_view new_node_key = key.substr(0, same_prefix_length);
-    auto *new_node = VrtNodeHelper<kWriteLock>::template CreateVrtNodeWithoutValue<Node4>(new_node_key);
-    auto *child =
-        VrtNodeHelper<kWriteLock>::template CreateVrtNodeByRemovePrefix<ValueType>(node, same_prefix_length + 1);
-    VrtNodeHelper<kWriteLock>::template AddChild<ValueType>(
-        new_node, VrtNodeHelper<kWriteLock>::GetKeyIndexChar(node, same_prefix_length), child);
+    auto *new_node = NodeHelper::template CreateVrtNodeWithoutValue<Node4>(new_node_key);
+    auto *child = NodeHelper::template CreateVrtNodeByRemovePrefix<StoredType, kRelocateValue>(node,
+                                                                                             same_prefix_length + 1);
+    NodeHelper::template AddChild<StoredType>(new_node, NodeHelper::GetKeyIndexChar(node, same_prefix_length), child);
     char next_char = key[same_prefix_length];
     key.remove_prefix(same_prefix_length + 1);
-    child = VrtNodeHelper<kWriteLock>::template CreateVrtNode<LeafNode, ValueType>(key, std::forward<Args>(args)...);
-    VrtNodeHelper<kWriteLock>::template AddChild<ValueType>(new_node, next_char, child);
-    auto *old_node = node;
+    NodeHelper::template AddChild<StoredType>(new_node, next_char, CreateLeaf(key, std::forward<Args>(args)...));
+    VrtNode<kWriteLock> *old_node = node;
     node = new_node;
     parent->Unlock();
-    FreeNode(old_node);
+    FreeRelocatedNode(old_node);
     return true;
   }
   if (same_prefix_length == key.length() && same_prefix_length < node->key_length) {
     // 同前缀部分作为父节点并且插入值，旧节点去掉相同部分后作为child1
     std::string_view new_node_key = key.substr(0, same_prefix_length);
     auto *new_node =
-        VrtNodeHelper<kWriteLock>::template CreateVrtNode<Node4, ValueType>(new_node_key, std::forward<Args>(args)...);
-    auto *child =
-        VrtNodeHelper<kWriteLock>::template CreateVrtNodeByRemovePrefix<ValueType>(node, same_prefix_length + 1);
-    VrtNodeHelper<kWriteLock>::template AddChild<ValueType>(
-        new_node, VrtNodeHelper<kWriteLock>::GetKeyIndexChar(node, same_prefix_length), child);
-    auto *old_node = node;
+        NodeHelper::template CreateVrtNode<Node4, StoredType>(new_node_key, std::forward<Args>(args)...);
+    auto *child = NodeHelper::template CreateVrtNodeByRemovePrefix<StoredType, kRelocateValue>(node,
+                                                                                             same_prefix_length + 1);
+    NodeHelper::template AddChild<StoredType>(new_node, NodeHelper::GetKeyIndexChar(node, same_prefix_length), child);
+    VrtNode<kWriteLock> *old_node = node;
     node = new_node;
     parent->Unlock();
-    FreeNode(old_node);
+    FreeRelocatedNode(old_node);
     return true;
   }
   if (same_prefix_length == key.length() && same_prefix_length == node->key_length) {
     // 值挂在当前节点上
     if (node->has_value) {
-      *old_value = VrtNodeHelper<kWriteLock>::template GetValue<ValueType>(node);
+      if (nullptr != old_value) {
+        LoadValue(node, old_value);
+      }
       node->Unlock();
       parent->Unlock();
       return false;
     }
-    auto *old_node = node;
+    VrtNode<kWriteLock> *old_node = node;
     auto *new_node =
-        VrtNodeHelper<kWriteLock>::template CreateVrtNodeByAddValue<ValueType>(node, std::forward<Args>(args)...);
+        NodeHelper::template CreateVrtNodeByAddValue<StoredType>(node, std::forward<Args>(args)...);
     node = new_node;
     parent->Unlock();
     FreeNode(old_node);
     return true;
   }
   // 继续搜索，没有找到对应子节点，增新增叶子挂在当前节点上
-  if (VrtNode<kWriteLock> *&next_node = VrtNodeHelper<kWriteLock>::FindChild(node, key[same_prefix_length]);
+  if (VrtChildPtr<kWriteLock> &next_node = NodeHelper::FindChild(node, key[same_prefix_length]);
       next_node != nullptr) {
     parent->Unlock();
     key.remove_prefix(same_prefix_length + 1);
@@ -198,38 +1026,59 @@ bool Vrt<ValueType, kWriteLock, kReadThreadNum>::InsertImpl(VrtNode<kWriteLock>
   }
   char next_char = key[same_prefix_length];
   key.remove_prefix(same_prefix_length + 1);
-  auto *new_node =
-      VrtNodeHelper<kWriteLock>::template CreateVrtNode<LeafNode, ValueType>(key, std::forward<Args>(args)...);
-  auto *node_pre_add_child = node;
-  node = VrtNodeHelper<kWriteLock>::template AddChild<ValueType>(node, next_char, new_node);
+  auto new_node = CreateLeaf(key, std::forward<Args>(args)...);
+  VrtNode<kWriteLock> *node_pre_add_child = node;
+  node = NodeHelper::template AddChild<StoredType, kRelocateValue>(node, next_char, new_node);
   if (node != node_pre_add_child) {
-    FreeNode(node_pre_add_child);
+    // 扩容后的新节点没有加过锁，不能解锁，否则可能解开其他写线程刚加上的锁；旧节点保持加锁交给EBR回收
+    FreeRelocatedNode(node_pre_add_child);
+  } else {
+    node->Unlock();
   }
   parent->Unlock();
-  node->Unlock();
   return true;
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
 template <class... Args>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::Update(std::string_view key, Args &&...args) {
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Update(std::string_view key, Args &&...args) {
   if (unlikely(key.empty() || key.size() >= kMaxKeySize)) {
     return false;
   }
-  root_parent_.Lock();
-  if (nullptr == root_) {
-    root_parent_.Unlock();
+  if constexpr (kOptimisticWrite) {
+    bool ret = false;
+    if (TryOptimisticWrite<false>(key, [&](OptimisticPath &path) {
+          return UpdateImpl(*path.node_ref, path.parent, path.key, std::forward<Args>(args)...);
+        }, &ret)) {
+      return ret;
+    }
+  }
+  auto &slot = GetRootSlot(key);
+  slot.root_parent.Lock();
+  if (nullptr == slot.root) {
+    slot.root_parent.Unlock();
     return false;
   }
-  return UpdateImpl(root_, &root_parent_, key, std::forward<Args>(args)...);
+  return RunWrite(slot, key, [&](VrtChildPtr<kWriteLock> &root, VrtNode<kWriteLock> *parent) {
+    return UpdateImpl(root, parent, key, std::forward<Args>(args)...);
+  });
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
 template <class... Args>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::UpdateImpl(VrtNode<kWriteLock> *&node, VrtNode<kWriteLock> *parent,
-                                                            std::string_view key, Args &&...args) {
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::UpdateImpl(VrtChildPtr<kWriteLock> &node,
+                                                                    VrtNode<kWriteLock> *parent, std::string_view key,
+                                                                    Args &&...args) {
+  if (IsInlineLeaf(node)) {
+    bool ret = key.empty();
+    if (ret) {
+      node = CreateLeaf(key, std::forward<Args>(args)...);
+    }
+    parent->Unlock();
+    return ret;
+  }
   node->Lock();
-  auto same_prefix_length = VrtNodeHelper<kWriteLock>::CheckSamePrefixLength(node, key);
+  auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, key);
   if (same_prefix_length < node->key_length) {
     node->Unlock();
     parent->Unlock();
@@ -237,9 +1086,16 @@ bool Vrt<ValueType, kWriteLock, kReadThreadNum>::UpdateImpl(VrtNode<kWriteLock>
   }
   if (key.length() == same_prefix_length) {
     if (node->has_value) {
+      if constexpr (Policy::kBoxedValue) {
+        auto *old_rep = ReplaceBoxedValue(node, std::forward<Args>(args)...);
+        node->Unlock();
+        parent->Unlock();
+        FreeBoxedValue(old_rep);
+        return true;
+      }
       auto *new_node =
-          VrtNodeHelper<kWriteLock>::template CreateVrtNodeByAddValue<ValueType>(node, std::forward<Args>(args)...);
-      auto *old_node = node;
+          NodeHelper::template CreateVrtNodeByAddValue<StoredType>(node, std::forward<Args>(args)...);
+      VrtNode<kWriteLock> *old_node = node;
       node = new_node;
       parent->Unlock();
       FreeNode(old_node);
@@ -250,7 +1106,7 @@ bool Vrt<ValueType, kWriteLock, kReadThreadNum>::UpdateImpl(VrtNode<kWriteLock>
     return false;
   }
   parent->Unlock();
-  if (VrtNode<kWriteLock> *&next_node = VrtNodeHelper<kWriteLock>::FindChild(node, key[same_prefix_length]);
+  if (VrtChildPtr<kWriteLock> &next_node = NodeHelper::FindChild(node, key[same_prefix_length]);
       next_node != nullptr) {
     key.remove_prefix(same_prefix_length + 1);
     return UpdateImpl(next_node, node, key, std::forward<Args>(args)...);
@@ -259,139 +1115,789 @@ bool Vrt<ValueType, kWriteLock, kReadThreadNum>::UpdateImpl(VrtNode<kWriteLock>
   return false;
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::FetchAdd(std::string_view key, ValueType delta,
+                                                                  ValueType *old_value) {
+  static_assert(kIsAtomicValue<ValueType> && std::is_integral_v<ValueType>,
+                "FetchAdd requires a lock-free atomic integral value type");
+  return ApplyInPlace(key, [delta, old_value](ValueType *value) {
+    auto ret = __atomic_fetch_add(value, delta, __ATOMIC_ACQ_REL);
+    if (nullptr != old_value) {
+      *old_value = ret;
+    }
+    return true;
+  });
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Store(std::string_view key, ValueType value) {
+  static_assert(kIsAtomicValue<ValueType>, "Store requires a lock-free atomic value type");
+  return ApplyInPlace(key, [value](ValueType *slot) {
+    __atomic_store(slot, &value, __ATOMIC_RELEASE);
+    return true;
+  });
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::CompareExchange(std::string_view key, ValueType *expected,
+                                                                         ValueType desired) {
+  static_assert(kIsAtomicValue<ValueType>, "CompareExchange requires a lock-free atomic value type");
+  return ApplyInPlace(key, [expected, desired](ValueType *value) {
+    return __atomic_compare_exchange(value, expected, &desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  });
+}
+
+// 沿路径加锁找到key所在节点，在持有节点锁的情况下原地修改值。
+// 持锁是为了和复制节点的写操作互斥，否则修改可能落在一个正在被替换的旧节点上而丢失。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Fn>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::ApplyInPlace(std::string_view key, Fn &&fn) {
+  // 节点外的值可能同时被快照中的节点引用，不能原地修改
+  static_assert(!Policy::kBoxedValue, "the in-place interfaces are not available with boxed values");
+  if (unlikely(key.empty() || key.size() >= kMaxKeySize)) {
+    return false;
+  }
+  auto &slot = GetRootSlot(key);
+  slot.root_parent.Lock();
+  if (nullptr == slot.root) {
+    slot.root_parent.Unlock();
+    return false;
+  }
+  return RunWrite(slot, key, [&](VrtChildPtr<kWriteLock> &root, VrtNode<kWriteLock> *parent) {
+    return ApplyInPlaceImpl(root, parent, key, fn);
+  });
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Fn>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::ApplyInPlaceImpl(VrtChildPtr<kWriteLock> &node,
+                                                                          VrtNode<kWriteLock> *parent,
+                                                                          std::string_view key, Fn &fn) {
+  if (IsInlineLeaf(node)) {
+    // 在副本上修改后整体写回槽位，读线程看到的是修改前或者修改后的值
+    bool ret = false;
+    if (key.empty()) {
+      auto value = VrtInlineValue<ValueType>::Decode(node.GetPayload());
+      ret = fn(&value);
+      node = CreateLeaf(key, value);
+    }
+    parent->Unlock();
+    return ret;
+  }
+  node->Lock();
+  parent->Unlock();
+  auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, key);
+  if (same_prefix_length < node->key_length) {
+    node->Unlock();
+    return false;
+  }
+  if (key.length() == same_prefix_length) {
+    bool ret = false;
+    if (node->has_value) {
+      ret = fn(GetValuePtr(node));
+    }
+    node->Unlock();
+    return ret;
+  }
+  if (VrtChildPtr<kWriteLock> &next_node = NodeHelper::FindChild(node, key[same_prefix_length]);
+      next_node != nullptr) {
+    key.remove_prefix(same_prefix_length + 1);
+    return ApplyInPlaceImpl(next_node, node, key, fn);
+  }
+  node->Unlock();
+  return false;
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
 template <class... Args>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::Upsert(std::string_view key, Args &&...args) {
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Upsert(std::string_view key, Args &&...args) {
+  static_assert(std::is_constructible_v<ValueType, Args &&...>, "ValueType is not constructible from args");
+  // 有了上面的断言，单参数时的函数式转换也只会是直接初始化，不会退化成reinterpret_cast之类的强制转换
+  return Compute(key, [&args...](const ValueType *) { return ValueType(std::forward<Args>(args)...); });
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Fn>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Compute(std::string_view key, Fn &&fn) {
   if (unlikely(key.empty() || key.size() >= kMaxKeySize)) {
     return false;
   }
-  root_parent_.Lock();
-  if (nullptr == root_) {
-    root_ = VrtNodeHelper<kWriteLock>::template CreateVrtNode<LeafNode, ValueType>(key, std::forward<Args>(args)...);
-    root_parent_.Unlock();
+  if constexpr (kOptimisticWrite) {
+    bool ret = false;
+    if (TryOptimisticWrite<false>(
+            key, [&](OptimisticPath &path) { return ComputeImpl(*path.node_ref, path.parent, path.key, fn); }, &ret)) {
+      return ret;
+    }
+  }
+  auto &slot = GetRootSlot(key);
+  slot.root_parent.Lock();
+  if (nullptr == slot.root) {
+    slot.root =
+        NodeHelper::template CreateVrtNode<LeafNode, StoredType>(key, VrtValueEmplacer<ValueType, Fn>(fn, nullptr));
+    slot.root_parent.Unlock();
     return true;
   }
-  return UpsertImpl(root_, &root_parent_, key, std::forward<Args>(args)...);
+  return RunWrite(slot, key, [&](VrtChildPtr<kWriteLock> &root, VrtNode<kWriteLock> *parent) {
+    return ComputeImpl(root, parent, key, fn);
+  });
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
-template <class... Args>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::UpsertImpl(VrtNode<kWriteLock> *&node, VrtNode<kWriteLock> *parent,
-                                                            std::string_view key, Args &&...args) {
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Delta, class MergeFn>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Merge(std::string_view key, Delta &&delta,
+                                                               MergeFn &&merge_fn) {
+  static_assert(std::is_constructible_v<ValueType, Delta &&>, "ValueType is not constructible from delta");
+  static_assert(std::is_constructible_v<ValueType, std::invoke_result_t<MergeFn &, const ValueType &, Delta &&>>,
+                "ValueType is not constructible from the result of merge_fn");
+  return Compute(key, [&delta, &merge_fn](const ValueType *old_value) {
+    if (nullptr == old_value) {
+      return ValueType(std::forward<Delta>(delta));
+    }
+    return ValueType(merge_fn(*old_value, std::forward<Delta>(delta)));
+  });
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Fn>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::ComputeImpl(VrtChildPtr<kWriteLock> &node,
+                                                                     VrtNode<kWriteLock> *parent, std::string_view key,
+                                                                     Fn &fn) {
+  if (IsInlineLeaf(node)) {
+    if (key.empty()) {
+      auto old_value = VrtInlineValue<ValueType>::Decode(node.GetPayload());
+      node = CreateLeaf(key, VrtValueEmplacer<ValueType, Fn>(fn, &old_value));
+      parent->Unlock();
+      return true;
+    }
+    ExpandInlineLeaf(node);
+  }
   node->Lock();
-  auto same_prefix_length = VrtNodeHelper<kWriteLock>::CheckSamePrefixLength(node, key);
+  auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, key);
   if (same_prefix_length < key.length() && same_prefix_length < node->key_length) {
     // 同前缀部分作为父节点，旧节点去掉相同部分后作为child1，key剩余部分新建结点作为child2。
     std::string_view new_node_key = key.substr(0, same_prefix_length);
-    auto *new_node = VrtNodeHelper<kWriteLock>::template CreateVrtNodeWithoutValue<Node4>(new_node_key);
-    auto *child =
-        VrtNodeHelper<kWriteLock>::template CreateVrtNodeByRemovePrefix<ValueType>(node, same_prefix_length + 1);
-    VrtNodeHelper<kWriteLock>::template AddChild<ValueType>(
-        new_node, VrtNodeHelper<kWriteLock>::GetKeyIndexChar(node, same_prefix_length), child);
+    auto *new_node = NodeHelper::template CreateVrtNodeWithoutValue<Node4>(new_node_key);
+    auto *child = NodeHelper::template CreateVrtNodeByRemovePrefix<StoredType, kRelocateValue>(node,
+                                                                                             same_prefix_length + 1);
+    NodeHelper::template AddChild<StoredType>(new_node, NodeHelper::GetKeyIndexChar(node, same_prefix_length), child);
 
     char next_char = key[same_prefix_length];
     key.remove_prefix(same_prefix_length + 1);
-    child = VrtNodeHelper<kWriteLock>::template CreateVrtNode<LeafNode, ValueType>(key, std::forward<Args>(args)...);
-    VrtNodeHelper<kWriteLock>::template AddChild<ValueType>(new_node, next_char, child);
+    NodeHelper::template AddChild<StoredType>(new_node, next_char,
+                                             CreateLeaf(key, VrtValueEmplacer<ValueType, Fn>(fn, nullptr)));
 
-    auto *old_node = node;
+    VrtNode<kWriteLock> *old_node = node;
     node = new_node;
     parent->Unlock();
-    FreeNode(old_node);
+    FreeRelocatedNode(old_node);
     return true;
   }
   if (same_prefix_length == key.length() && same_prefix_length < node->key_length) {
     // 同前缀部分作为父节点并且插入值，旧节点去掉相同部分后作为child1
     std::string_view new_node_key = key.substr(0, same_prefix_length);
-    auto *new_node =
-        VrtNodeHelper<kWriteLock>::template CreateVrtNode<Node4, ValueType>(new_node_key, std::forward<Args>(args)...);
-    auto *child =
-        VrtNodeHelper<kWriteLock>::template CreateVrtNodeByRemovePrefix<ValueType>(node, same_prefix_length + 1);
-    VrtNodeHelper<kWriteLock>::template AddChild<ValueType>(
-        new_node, VrtNodeHelper<kWriteLock>::GetKeyIndexChar(node, same_prefix_length), child);
-    auto *old_node = node;
+    auto *new_node = NodeHelper::template CreateVrtNode<Node4, StoredType>(
+        new_node_key, VrtValueEmplacer<ValueType, Fn>(fn, nullptr));
+    auto *child = NodeHelper::template CreateVrtNodeByRemovePrefix<StoredType, kRelocateValue>(node,
+                                                                                             same_prefix_length + 1);
+    NodeHelper::template AddChild<StoredType>(new_node, NodeHelper::GetKeyIndexChar(node, same_prefix_length), child);
+    VrtNode<kWriteLock> *old_node = node;
     node = new_node;
     parent->Unlock();
-    FreeNode(old_node);
+    FreeRelocatedNode(old_node);
     return true;
   }
   if (same_prefix_length == key.length() && same_prefix_length == node->key_length) {
     // 值挂在当前节点上
-    auto *old_node = node;
-    auto *new_node =
-        VrtNodeHelper<kWriteLock>::template CreateVrtNodeByAddValue<ValueType>(node, std::forward<Args>(args)...);
+    VrtNode<kWriteLock> *old_node = node;
+    auto *old_value = node->has_value ? GetValuePtr(node) : nullptr;
+    if constexpr (Policy::kBoxedValue) {
+      if (nullptr != old_value) {
+        auto *old_rep = ReplaceBoxedValue(node, VrtValueEmplacer<ValueType, Fn>(fn, old_value));
+        node->Unlock();
+        parent->Unlock();
+        FreeBoxedValue(old_rep);
+        return true;
+      }
+    }
+    auto *new_node = NodeHelper::template CreateVrtNodeByAddValue<StoredType>(
+        node, VrtValueEmplacer<ValueType, Fn>(fn, old_value));
     node = new_node;
     parent->Unlock();
     FreeNode(old_node);
     return true;
   }
   // 继续搜索，没有找到对应子节点，增新增叶子挂在当前节点上
-  if (VrtNode<kWriteLock> *&next_node = VrtNodeHelper<kWriteLock>::FindChild(node, key[same_prefix_length]);
+  if (VrtChildPtr<kWriteLock> &next_node = NodeHelper::FindChild(node, key[same_prefix_length]);
       next_node != nullptr) {
     parent->Unlock();
     key.remove_prefix(same_prefix_length + 1);
-    return UpsertImpl(next_node, node, key, std::forward<Args>(args)...);
+    return ComputeImpl(next_node, node, key, fn);
   }
   char next_char = key[same_prefix_length];
   key.remove_prefix(same_prefix_length + 1);
-  auto *new_node =
-      VrtNodeHelper<kWriteLock>::template CreateVrtNode<LeafNode, ValueType>(key, std::forward<Args>(args)...);
-  auto *node_pre_add_child = node;
-  node = VrtNodeHelper<kWriteLock>::template AddChild<ValueType>(node, next_char, new_node);
+  auto new_node = CreateLeaf(key, VrtValueEmplacer<ValueType, Fn>(fn, nullptr));
+  VrtNode<kWriteLock> *node_pre_add_child = node;
+  node = NodeHelper::template AddChild<StoredType, kRelocateValue>(node, next_char, new_node);
   if (node != node_pre_add_child) {
-    FreeNode(node_pre_add_child);
+    // 扩容后的新节点没有加过锁，不能解锁，否则可能解开其他写线程刚加上的锁；旧节点保持加锁交给EBR回收
+    FreeRelocatedNode(node_pre_add_child);
+  } else {
+    node->Unlock();
   }
   parent->Unlock();
-  node->Unlock();
   return true;
 }
 
-// 删除
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::Delete(std::string_view key) {
-  if (unlikely(key.empty() || key.size() >= kMaxKeySize)) {
-    return false;
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+size_t Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::MultiUpsert(
+     std::vector<std::pair<std::string_view, ValueType>> *kvs, bool sorted) {
+  using KeyValue = std::pair<std::string_view, ValueType>;
+  kvs->erase(std::remove_if(kvs->begin(), kvs->end(),
+                            [](const KeyValue &kv) { return kv.first.empty() || kv.first.size() >= kMaxKeySize; }),
+             kvs->end());
+  if (!sorted) {
+    std::stable_sort(kvs->begin(), kvs->end(),
+                     [](const KeyValue &lhs, const KeyValue &rhs) { return lhs.first < rhs.first; });
   }
-  root_parent_.Lock();
-  if (nullptr == root_) {
-    root_parent_.Unlock();
-    return false;
+  assert(std::is_sorted(kvs->begin(), kvs->end(),
+                        [](const KeyValue &lhs, const KeyValue &rhs) { return lhs.first < rhs.first; }));
+  size_t kv_cnt = 0;
+  for (size_t i = 0; i < kvs->size(); i++) {
+    if (i + 1 < kvs->size() && (*kvs)[i].first == (*kvs)[i + 1].first) {
+      continue;
+    }
+    if (kv_cnt != i) {
+      (*kvs)[kv_cnt] = std::move((*kvs)[i]);
+    }
+    kv_cnt++;
   }
-  return DeleteImpl(root_, &root_parent_, key);
+  kvs->erase(kvs->begin() + kv_cnt, kvs->end());
+  if (kvs->empty()) {
+    return 0;
+  }
+  // key有序，同一个分区的key是连续的一段，每段只持有所在分区的锁
+  for (auto first = kvs->begin(); first != kvs->end();) {
+    auto root_index = GetRootIndex(first->first);
+    auto last = first;
+    while (last != kvs->end() && GetRootIndex(last->first) == root_index) {
+      ++last;
+    }
+    auto &slot = roots_[root_index];
+    slot.root_parent.Lock();
+    if (unlikely(snapshot_cnt_.load(std::memory_order_relaxed) > 0)) {
+      // 存在快照时不能原地修改，逐个key复制路径
+      slot.root_parent.Unlock();
+      for (auto iter = first; iter != last; ++iter) {
+        Upsert(iter->first, std::move(iter->second));
+      }
+    } else {
+      if (nullptr == slot.root) {
+        slot.root = BuildTree(first, last, 0);
+      } else {
+        MultiUpsertImpl(slot.root, first, last, 0);
+      }
+      slot.root_parent.Unlock();
+    }
+    first = last;
+  }
+  return kv_cnt;
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Iter>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::BulkLoad(Iter first, Iter last) {
+  if (first == last) {
+    return true;
+  }
+  std::string_view pre_key;
+  for (auto iter = first; iter != last; ++iter) {
+    std::string_view key(iter->first);
+    if (unlikely(key.empty() || key.size() >= kMaxKeySize || key < pre_key)) {
+      return false;
+    }
+    pre_key = key;
+  }
+  LockAllRoots();
+  for (auto &slot : roots_) {
+    if (nullptr != slot.root) {
+      UnlockAllRoots();
+      return false;
+    }
+  }
+  // 新树在发布前对其他线程不可见，不需要逐个节点加锁，也不会产生需要EBR回收的中间节点
+  while (first != last) {
+    auto root_index = GetRootIndex(first->first);
+    auto group_last = first;
+    while (group_last != last && GetRootIndex(group_last->first) == root_index) {
+      ++group_last;
+    }
+    roots_[root_index].root = BuildTree(first, group_last, 0);
+    first = group_last;
+  }
+  UnlockAllRoots();
+  return true;
 }
 
-template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum>
-bool Vrt<ValueType, kWriteLock, kReadThreadNum>::DeleteImpl(VrtNode<kWriteLock> *&node, VrtNode<kWriteLock> *parent,
-                                                            std::string_view key) {
+// 用有序的[first, last)自底向上构造一棵新子树，key从depth开始，重复的key以最后一个为准。每个节点在创建时就确定最终的类型。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Iter>
+VrtChildPtr<kWriteLock> Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::BuildTree(Iter first, Iter last,
+                                                                                      size_t depth) {
+  if constexpr (kInlineLeaf) {
+    // 最大的key也已经结束，区间内的key都相同
+    if (std::string_view((last - 1)->first).length() == depth) {
+      return CreateLeaf(std::string_view((last - 1)->first).substr(depth), std::move((last - 1)->second));
+    }
+  }
+  std::string_view first_key = std::string_view(first->first).substr(depth);
+  std::string_view last_key = std::string_view((last - 1)->first).substr(depth);
+  size_t same_prefix_length = 0;
+  size_t cmp_size = std::min(first_key.length(), last_key.length());
+  while (same_prefix_length < cmp_size && first_key[same_prefix_length] == last_key[same_prefix_length]) {
+    same_prefix_length++;
+  }
+  auto value_iter = last;
+  auto edge_index = depth + same_prefix_length;
+  while (first != last && std::string_view(first->first).length() == edge_index) {
+    value_iter = first++;
+  }
+  size_t child_cnt = 0;
+  for (auto iter = first; iter != last; child_cnt++) {
+    auto edge = iter->first[edge_index];
+    while (iter != last && iter->first[edge_index] == edge) {
+      ++iter;
+    }
+  }
+  auto node_type = NodeHelper::GetNodeTypeByChildCnt(child_cnt);
+  auto node_key = first_key.substr(0, same_prefix_length);
+  VrtNode<kWriteLock> *node;
+  if (value_iter != last) {
+    node = NodeHelper::template CreateVrtNodeByType<StoredType>(node_type, node_key, std::move(value_iter->second));
+  } else {
+    node = NodeHelper::CreateVrtNodeWithoutValueByType(node_type, node_key);
+  }
+  while (first != last) {
+    auto edge = first->first[edge_index];
+    auto group_last = first;
+    while (group_last != last && group_last->first[edge_index] == edge) {
+      ++group_last;
+    }
+    NodeHelper::template AddChild<StoredType>(node, edge, BuildTree(first, group_last, edge_index + 1));
+    first = group_last;
+  }
+  return node;
+}
+
+// 调用方持有node所在位置(父节点)的锁，[first, last)中的key有序且不重复，前depth个字符已经匹配。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Iter>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::MultiUpsertImpl(VrtChildPtr<kWriteLock> &node, Iter first,
+                                                                         Iter last, size_t depth) {
+  if (IsInlineLeaf(node)) {
+    ExpandInlineLeaf(node);
+  }
   node->Lock();
-  auto same_prefix_length = VrtNodeHelper<kWriteLock>::CheckSamePrefixLength(node, key);
+  // key有序，和node前缀的最短公共长度只会出现在首尾两个key上
+  auto same_prefix_length =
+      std::min(NodeHelper::CheckSamePrefixLength(node, first->first.substr(depth)),
+               NodeHelper::CheckSamePrefixLength(node, (last - 1)->first.substr(depth)));
   if (same_prefix_length < node->key_length) {
+    // 同前缀部分作为父节点，旧节点去掉相同部分后作为其中一个child，其余key按下一个字符分组挂在父节点上
+    auto node_key = NodeHelper::GetKeyView(node);
+    char old_edge = node_key[same_prefix_length];
+    // old_child在node被替换之前就可能被下面的MultiUpsertImpl替换并回收，所以这里复制值，不能把值搬过去
+    VrtChildPtr<kWriteLock> old_child =
+        NodeHelper::template CreateVrtNodeByRemovePrefix<StoredType>(node, same_prefix_length + 1);
+    auto value_iter = last;
+    if (first->first.length() == depth + same_prefix_length) {
+      value_iter = first++;
+    }
+    auto edge_index = depth + same_prefix_length;
+    size_t child_cnt = 1;
+    for (auto iter = first; iter != last;) {
+      auto edge = iter->first[edge_index];
+      child_cnt += (edge != old_edge);
+      while (iter != last && iter->first[edge_index] == edge) {
+        ++iter;
+      }
+    }
+    auto node_type = NodeHelper::GetNodeTypeByChildCnt(child_cnt);
+    auto new_node_key = node_key.substr(0, same_prefix_length);
+    VrtNode<kWriteLock> *new_node;
+    if (value_iter != last) {
+      new_node =
+          NodeHelper::template CreateVrtNodeByType<StoredType>(node_type, new_node_key, std::move(value_iter->second));
+    } else {
+      new_node = NodeHelper::CreateVrtNodeWithoutValueByType(node_type, new_node_key);
+    }
+    while (first != last) {
+      auto edge = first->first[edge_index];
+      auto group_last = first;
+      while (group_last != last && group_last->first[edge_index] == edge) {
+        ++group_last;
+      }
+      if (edge == old_edge) {
+        // old_child还没有发布，这里加锁只是为了复用逻辑
+        MultiUpsertImpl(old_child, first, group_last, edge_index + 1);
+      } else {
+        NodeHelper::template AddChild<StoredType>(new_node, edge, BuildTree(first, group_last, edge_index + 1));
+      }
+      first = group_last;
+    }
+    NodeHelper::template AddChild<StoredType>(new_node, old_edge, old_child);
+    VrtNode<kWriteLock> *old_node = node;
+    node = new_node;
+    FreeNode(old_node);
+    return;
+  }
+  depth += node->key_length;
+  auto value_iter = last;
+  if (first->first.length() == depth) {
+    value_iter = first++;
+  }
+  // 先在已有的子树中处理，这些修改只涉及node的子节点槽位，node被复制时会一起带过去
+  size_t new_child_cnt = 0;
+  for (auto iter = first; iter != last;) {
+    auto edge = iter->first[depth];
+    auto group_last = iter;
+    while (group_last != last && group_last->first[depth] == edge) {
+      ++group_last;
+    }
+    if (VrtChildPtr<kWriteLock> &next_node = NodeHelper::FindChild(node, edge); next_node != nullptr) {
+      MultiUpsertImpl(next_node, iter, group_last, depth + 1);
+    } else {
+      new_child_cnt++;
+    }
+    iter = group_last;
+  }
+  if (value_iter == last && new_child_cnt == 0) {
     node->Unlock();
-    parent->Unlock();
+    return;
+  }
+  VrtNode<kWriteLock> *new_node = node;
+  auto child_cnt = node->child_cnt + new_child_cnt;
+  bool value_relocated = false;
+  if (value_iter != last) {
+    new_node = NodeHelper::template CreateVrtNodeByResize<StoredType>(
+        node, std::max(child_cnt, NodeHelper::GetChildCapacity(node)), std::move(value_iter->second));
+  } else if (child_cnt > NodeHelper::GetChildCapacity(node)) {
+    new_node = NodeHelper::template CreateVrtNodeByResize<StoredType, kRelocateValue>(node, child_cnt);
+    value_relocated = true;
+  }
+  // 新增的子树挂在新节点上，如果没有换节点则原地追加，每次追加对读线程都是可见且一致的
+  while (first != last) {
+    auto edge = first->first[depth];
+    auto group_last = first;
+    while (group_last != last && group_last->first[depth] == edge) {
+      ++group_last;
+    }
+    if (NodeHelper::FindChild(new_node, edge) == nullptr) {
+      NodeHelper::template AddChild<StoredType>(new_node, edge, BuildTree(first, group_last, depth + 1));
+    }
+    first = group_last;
+  }
+  if (new_node == node) {
+    node->Unlock();
+    return;
+  }
+  VrtNode<kWriteLock> *old_node = node;
+  node = new_node;
+  if (value_relocated) {
+    FreeRelocatedNode(old_node);
+  } else {
+    FreeNode(old_node);
+  }
+}
+
+// 删除
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Delete(std::string_view key) {
+  if (unlikely(key.empty() || key.size() >= kMaxKeySize)) {
     return false;
   }
-  if (key.length() == same_prefix_length) {
-    if (node->has_value) {
-      // TODO，考虑路径压缩
-      auto *new_node = VrtNodeHelper<kWriteLock>::template CreateVrtNodeByDeleteValue<ValueType>(node);
-      auto *old_node = node;
-      node = new_node;
-      parent->Unlock();
-      FreeNode(old_node);
+  if constexpr (kOptimisticWrite) {
+    // 删除可能缩容或合并parent，需要同时锁住grand
+    bool ret = false;
+    if (TryOptimisticWrite<true>(key, [&](OptimisticPath &path) {
+          return DeleteImpl(*path.node_ref, path.edge, path.parent, path.parent_ref, path.grand, path.key);
+        }, &ret)) {
+      return ret;
+    }
+  }
+  auto &slot = GetRootSlot(key);
+  slot.root_parent.Lock();
+  if (nullptr == slot.root) {
+    slot.root_parent.Unlock();
+    return false;
+  }
+  return RunWrite(slot, key, [&](VrtChildPtr<kWriteLock> &root, VrtNode<kWriteLock> *parent) {
+    return DeleteImpl(root, '\0', parent, nullptr, nullptr, key);
+  });
+}
+
+// 删除过程中持有grand、parent、node三层锁，node是parent中边为edge的子节点，parent_ref是parent在grand中的位置。
+// grand为nullptr时parent是分区的root_parent，node是分区的根节点。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::DeleteImpl(VrtChildPtr<kWriteLock> &node, char edge,
+                                                                    VrtNode<kWriteLock> *parent,
+                                                                    VrtChildPtr<kWriteLock> *parent_ref,
+                                                                    VrtNode<kWriteLock> *grand, std::string_view key) {
+  if (IsInlineLeaf(node)) {
+    if (key.empty()) {
+      DeleteValue(node, edge, parent, parent_ref, grand);
       return true;
     }
+    parent->Unlock();
+    if (nullptr != grand) {
+      grand->Unlock();
+    }
+    return false;
+  }
+  node->Lock();
+  auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, key);
+  if (same_prefix_length < node->key_length || (key.length() == same_prefix_length && !node->has_value)) {
     node->Unlock();
     parent->Unlock();
+    if (nullptr != grand) {
+      grand->Unlock();
+    }
     return false;
   }
-  parent->Unlock();
-  if (VrtNode<kWriteLock> *&next_node = VrtNodeHelper<kWriteLock>::FindChild(node, key[same_prefix_length]);
-      next_node != nullptr) {
+  if (key.length() == same_prefix_length) {
+    DeleteValue(node, edge, parent, parent_ref, grand);
+    return true;
+  }
+  if (nullptr != grand) {
+    grand->Unlock();
+  }
+  char next_char = key[same_prefix_length];
+  if (VrtChildPtr<kWriteLock> &next_node = NodeHelper::FindChild(node, next_char); next_node != nullptr) {
     key.remove_prefix(same_prefix_length + 1);
-    return DeleteImpl(next_node, node, key);
+    return DeleteImpl(next_node, next_char, node, &node, parent, key);
   }
   node->Unlock();
+  parent->Unlock();
   return false;
 }
 
+// 删除node上的值，并且维护路径压缩：
+// 1. node还有多个子节点，只去掉值。
+// 2. node只剩一个子节点，把node合并进子节点。
+// 3. node没有子节点，从parent中删除node，parent按阈值缩容，parent没有值并且只剩一个子节点时和这个子节点合并。
+// 被替换的节点和原来一样保持加锁并交给EBR回收，返回时释放所有锁。node是InlineLeaf时只会是第3种情况。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::DeleteValue(VrtChildPtr<kWriteLock> &node, char edge,
+                                                                     VrtNode<kWriteLock> *parent,
+                                                                     VrtChildPtr<kWriteLock> *parent_ref,
+                                                                     VrtNode<kWriteLock> *grand) {
+  VrtChildPtr<kWriteLock> old_node = node;
+  auto child_cnt = IsInlineLeaf(node) ? 0 : NodeHelper::GetChildCnt(node);
+  if (child_cnt > 1) {
+    node = NodeHelper::template CreateVrtNodeByDeleteValue<StoredType>(node);
+    parent->Unlock();
+    if (nullptr != grand) {
+      grand->Unlock();
+    }
+    FreeNode(old_node);
+    return;
+  }
+  if (child_cnt == 1) {
+    char child_edge = 0;
+    VrtChildPtr<kWriteLock> child = nullptr;
+    NodeHelper::ForEachChild(node, [&child_edge, &child](char cur_edge, VrtChildPtr<kWriteLock> cur_child) {
+      child_edge = cur_edge;
+      child = cur_child;
+      return false;
+    });
+    if (!IsInlineLeaf(child)) {
+      child->Lock();
+    }
+    node = NodeHelper::template CreateVrtNodeByMerge<StoredType, kRelocateValue>(old_node, child_edge, child);
+    parent->Unlock();
+    if (nullptr != grand) {
+      grand->Unlock();
+    }
+    FreeNode(old_node);
+    FreeRelocatedNode(child);
+    return;
+  }
+  if (nullptr == grand) {
+    // 删除最后一个key
+    node = nullptr;
+    parent->Unlock();
+    FreeNode(old_node);
+    return;
+  }
+  auto parent_child_cnt = NodeHelper::GetChildCnt(parent) - 1;
+  if (!parent->has_value && parent_child_cnt == 1) {
+    char sibling_edge = 0;
+    VrtChildPtr<kWriteLock> sibling = nullptr;
+    NodeHelper::ForEachChild(parent, [&](char cur_edge, VrtChildPtr<kWriteLock> cur_child) {
+      if (cur_edge == edge) {
+        return true;
+      }
+      sibling_edge = cur_edge;
+      sibling = cur_child;
+      return false;
+    });
+    if (!IsInlineLeaf(sibling)) {
+      sibling->Lock();
+    }
+    *parent_ref = NodeHelper::template CreateVrtNodeByMerge<StoredType, kRelocateValue>(parent, sibling_edge, sibling);
+    grand->Unlock();
+    FreeNode(parent);
+    FreeRelocatedNode(sibling);
+    FreeChild(old_node);
+    return;
+  }
+  auto node_type = NodeHelper::GetNodeTypeByShrink(parent, parent_child_cnt);
+  if (Node256 == node_type) {
+    NodeHelper::RemoveChildInPlace(parent, edge);
+    parent->Unlock();
+    grand->Unlock();
+    FreeChild(old_node);
+    return;
+  }
+  *parent_ref = NodeHelper::template CreateVrtNodeByRemoveChild<StoredType, kRelocateValue>(parent, edge, node_type);
+  grand->Unlock();
+  FreeRelocatedNode(parent);
+  FreeChild(old_node);
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Visitor>
+size_t Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::Scan(std::string_view start, std::string_view end,
+                                                                Visitor &&visitor) {
+  // 遍历时同时持有的节点数没有上限，hazard槽位保护不过来
+  static_assert(!kHazardPointer, "Scan is not available with VrtHazardPointerPolicy");
+  size_t visit_cnt = 0;
+  ebr_mgr_.StartRead();
+  ScanRoots([this](size_t i) { return roots_[i].root; }, start, end, visitor, &visit_cnt);
+  ebr_mgr_.EndRead();
+  return visit_cnt;
+}
+
+// 分区按首字节从小到大排列，从start所在的分区开始依次遍历，直到越过end或者visitor要求终止。get_root(i)返回第i个分区的根
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class GetRoot, class Visitor>
+void Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::ScanRoots(GetRoot &&get_root, std::string_view start,
+                                                                   std::string_view end, Visitor &visitor,
+                                                                   size_t *visit_cnt) {
+  std::string key;
+  for (size_t i = start.empty() ? 0 : GetRootIndex(start); i < kRootCnt; i++) {
+    VrtChildPtr<kWriteLock> root = get_root(i);
+    if (nullptr == root) {
+      continue;
+    }
+    key.clear();
+    if (!ScanImpl(root, &key, start, end, !start.empty(), visitor, visit_cnt)) {
+      break;
+    }
+  }
+}
+
+// key为根节点到node之间的完整路径，check_start表示子树中可能存在小于start的key，需要继续比较下界。
+// 返回false表示已经越过上界或者visitor要求终止，整个遍历结束。
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Visitor>
+bool Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::ScanImpl(VrtChildPtr<kWriteLock> node, std::string *key,
+                                                                  std::string_view start, std::string_view end,
+                                                                  bool check_start, Visitor &visitor,
+                                                                  size_t *visit_cnt) {
+  if (IsInlineLeaf(node)) {
+    // 子树只有key本身
+    if (check_start && std::string_view(*key) < start) {
+      return true;
+    }
+    if (!end.empty() && std::string_view(*key) >= end) {
+      return false;
+    }
+    (*visit_cnt)++;
+    auto value = VrtInlineValue<ValueType>::Decode(node.GetPayload());
+    return visitor(std::string_view(*key), static_cast<const ValueType &>(value));
+  }
+  auto parent_key_length = key->length();
+  key->append(NodeHelper::GetKeyView(node));
+  if (check_start) {
+    auto cmp_size = std::min(key->length(), start.length());
+    auto cmp = key->compare(0, cmp_size, start.substr(0, cmp_size));
+    if (cmp < 0) {
+      // 整棵子树都小于start
+      key->resize(parent_key_length);
+      return true;
+    }
+    check_start = (cmp == 0 && key->length() < start.length());
+  }
+  if (!end.empty()) {
+    auto cmp_size = std::min(key->length(), end.length());
+    auto cmp = key->compare(0, cmp_size, end.substr(0, cmp_size));
+    if (cmp > 0 || (cmp == 0 && key->length() >= end.length())) {
+      // 整棵子树都不小于end，后续的key更大，直接结束
+      return false;
+    }
+  }
+  if (!check_start && node->has_value) {
+    (*visit_cnt)++;
+    if (!visitor(std::string_view(*key), *GetValuePtr(node))) {
+      return false;
+    }
+  }
+  auto node_key_length = key->length();
+  uint8_t from = check_start ? static_cast<uint8_t>(start[node_key_length]) : 0;
+  auto ret = NodeHelper::ForEachChild(
+      node,
+      [&](char edge, VrtChildPtr<kWriteLock> child) {
+        key->push_back(edge);
+        auto child_ret =
+            ScanImpl(child, key, start, end, check_start && static_cast<uint8_t>(edge) == from, visitor, visit_cnt);
+        key->resize(node_key_length);
+        return child_ret;
+      },
+      from);
+  key->resize(parent_key_length);
+  return ret;
+}
+
+template <class ValueType, bool kWriteLock, uint32_t kReadThreadNum, class Policy>
+template <class Visitor>
+size_t Vrt<ValueType, kWriteLock, kReadThreadNum, Policy>::ForEachPrefix(std::string_view prefix, Visitor &&visitor,
+                                                                         size_t limit) {
+  static_assert(!kHazardPointer, "ForEachPrefix is not available with VrtHazardPointerPolicy");
+  size_t visit_cnt = 0;
+  auto limit_visitor = [&visitor, &visit_cnt, limit](std::string_view key, const ValueType &value) {
+    return visitor(key, value) && (0 == limit || visit_cnt < limit);
+  };
+  ebr_mgr_.StartRead();
+  if (prefix.empty()) {
+    ScanRoots([this](size_t i) { return roots_[i].root; }, std::string_view(), std::string_view(), limit_visitor,
+              &visit_cnt);
+    ebr_mgr_.EndRead();
+    return visit_cnt;
+  }
+  std::string key;
+  VrtChildPtr<kWriteLock> node = GetRootSlot(prefix).root;
+  // 先沿着prefix找到子树的根，再把整棵子树按序输出
+  while (nullptr != node) {
+    if (IsInlineLeaf(node)) {
+      if (prefix.empty()) {
+        ScanImpl(node, &key, std::string_view(), std::string_view(), false, limit_visitor, &visit_cnt);
+      }
+      break;
+    }
+    auto same_prefix_length = NodeHelper::CheckSamePrefixLength(node, prefix);
+    if (same_prefix_length == prefix.length()) {
+      ScanImpl(node, &key, std::string_view(), std::string_view(), false, limit_visitor, &visit_cnt);
+      break;
+    }
+    if (same_prefix_length < node->key_length) {
+      break;
+    }
+    key.append(prefix.substr(0, same_prefix_length + 1));
+    node = NodeHelper::FindChild(node, prefix[same_prefix_length]);
+    prefix.remove_prefix(same_prefix_length + 1);
+  }
+  ebr_mgr_.EndRead();
+  return visit_cnt;
+}
+
 }  // namespace vrt
@@ -0,0 +1,402 @@
+/*
+ * @Author: viktorika
+ * @Date: 2024-05-06 20:12:31
+ * @Last Modified by: viktorika
+ * @Last Modified time: 2024-05-06 20:12:31
+ */
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include "spin_lock.h"
+#include "vrt_comm.h"
+
+namespace vrt {
+
+// 直接使用malloc/free的分配器
+struct MallocAllocator {
+  inline static void *Allocate(size_t size) { return malloc(size); }
+  inline static void Deallocate(void *ptr, size_t /*size*/) { free(ptr); }
+};
+
+// 从malloc申请slab，slab串成一条全局链表，保证进程退出时仍然可达
+struct MallocSlabSource {
+  inline static void *AllocateSlab(size_t size) {
+    auto *slab = static_cast<Slab *>(malloc(size));
+    static SpinLock slab_lock;
+    static Slab *slab_list = nullptr;
+    std::lock_guard<SpinLock> lock(slab_lock);
+    slab->next = slab_list;
+    slab_list = slab;
+    return slab;
+  }
+
+ private:
+  struct Slab {
+    Slab *next;
+  };
+};
+
+// 从2MB对齐的匿名映射中切分slab，并用madvise(MADV_HUGEPAGE)让内核以透明大页映射。节点集中在少量大页上，
+// 树很大时可以明显减少查找路径上的TLB miss。kNumaNode不小于0时用mbind把映射绑定到这个NUMA节点上。
+// 内核不支持透明大页时退回到普通页；mbind失败时这段映射不绑定NUMA节点，按线程默认的内存策略分配，
+// 失败次数可以通过GetNumaBindFailCnt()查询。映射不会归还给系统。
+template <int kNumaNode = -1>
+struct HugePageSlabSource {
+  static constexpr size_t kHugePageSize = 2 << 20;
+  // 每次映射的大小，按需缺页，没有用到的部分不占物理内存
+  static constexpr size_t kArenaSize = 16 * kHugePageSize;
+
+  inline static void *AllocateSlab(size_t size) {
+    static SpinLock arena_lock;
+    static char *arena_cur = nullptr;
+    static char *arena_end = nullptr;
+    std::lock_guard<SpinLock> lock(arena_lock);
+    if (unlikely(arena_cur == nullptr || static_cast<size_t>(arena_end - arena_cur) < size)) {
+      arena_cur = MapArena();
+      if (unlikely(arena_cur == nullptr)) {
+        return malloc(size);
+      }
+      arena_end = arena_cur + kArenaSize;
+    }
+    auto *slab = arena_cur;
+    arena_cur += size;
+    return slab;
+  }
+
+  // mbind失败、没有绑定到kNumaNode的映射数
+  inline static uint32_t GetNumaBindFailCnt() { return numa_bind_fail_cnt.load(std::memory_order_relaxed); }
+
+ private:
+  inline static std::atomic<uint32_t> numa_bind_fail_cnt{0};
+
+  // 多映射一个大页再裁掉首尾，得到按大页对齐的区间
+  inline static char *MapArena() {
+    auto *addr = mmap(nullptr, kArenaSize + kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+      return nullptr;
+    }
+    auto *start = static_cast<char *>(addr);
+    auto *arena = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(start) + kHugePageSize - 1) &
+                                           ~(kHugePageSize - 1));
+    if (arena != start) {
+      munmap(start, arena - start);
+    }
+    auto *end = start + kArenaSize + kHugePageSize;
+    if (arena + kArenaSize != end) {
+      munmap(arena + kArenaSize, end - arena - kArenaSize);
+    }
+    madvise(arena, kArenaSize, MADV_HUGEPAGE);
+    if constexpr (kNumaNode >= 0) {
+      // 直接使用系统调用，不依赖libnuma。内核读掩码前会先把maxnode减一，所以maxnode要比掩码的位数多一。
+      // 映射还没有被访问过，绑定对所有页生效
+      constexpr unsigned long kBitsPerWord = sizeof(unsigned long) * 8;
+      unsigned long node_mask[kNumaNode / kBitsPerWord + 1] = {};
+      node_mask[kNumaNode / kBitsPerWord] = 1UL << (kNumaNode % kBitsPerWord);
+      if (0 != syscall(SYS_mbind, arena, kArenaSize, MPOL_BIND, node_mask, sizeof(node_mask) * 8 + 1, 0)) {
+        numa_bind_fail_cnt.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    return arena;
+  }
+};
+
+// 按大小分级的slab分配器。
+// 每个线程为每个大小等级缓存一条空闲链表，链表过长时整批归还到全局仓库，链表为空时从全局仓库整批取回，
+// 仓库也为空时再从SlabSource申请一整块slab切分。这样EBR在ClearRetireList中集中释放的节点会按批转移给其他线程复用，
+// 热路径上不需要加锁。slab申请后不会归还给系统。
+template <class SlabSource>
+class BasicSlabAllocator {
+ public:
+  // 16字节一级直到1024字节，之后128字节一级直到4096字节，更大的直接使用malloc
+  static constexpr size_t kSmallGranularity = 16;
+  static constexpr size_t kSmallMaxSize = 1024;
+  static constexpr size_t kLargeGranularity = 128;
+  static constexpr size_t kMaxSize = 4096;
+  static constexpr size_t kClassCnt =
+      kSmallMaxSize / kSmallGranularity + (kMaxSize - kSmallMaxSize) / kLargeGranularity;
+  static constexpr size_t kSlabSize = 64 * 1024;
+  static constexpr uint32_t kBatchSize = 32;
+
+  inline static void *Allocate(size_t size) {
+    if (unlikely(size > kMaxSize)) {
+      return malloc(size);
+    }
+    auto &free_list = thread_cache.free_lists[GetClassIndex(size)];
+    if (unlikely(free_list.head == nullptr)) {
+      Refill(free_list, GetClassIndex(size));
+    }
+    auto *object = free_list.head;
+    free_list.head = object->next;
+    free_list.cnt--;
+    return object;
+  }
+
+  inline static void Deallocate(void *ptr, size_t size) {
+    if (unlikely(size > kMaxSize)) {
+      free(ptr);
+      return;
+    }
+    auto &free_list = thread_cache.free_lists[GetClassIndex(size)];
+    if (unlikely(free_list.cnt == 0)) {
+      RegisterCleaner();
+    }
+    auto *object = static_cast<FreeObject *>(ptr);
+    object->next = free_list.head;
+    free_list.head = object;
+    if (unlikely(++free_list.cnt >= 2 * kBatchSize)) {
+      Flush(free_list, GetClassIndex(size), kBatchSize);
+    }
+  }
+
+  inline static constexpr size_t GetClassIndex(size_t size) {
+    if (size <= kSmallMaxSize) {
+      return size == 0 ? 0 : (size - 1) / kSmallGranularity;
+    }
+    return kSmallMaxSize / kSmallGranularity + (size - kSmallMaxSize - 1) / kLargeGranularity;
+  }
+
+  inline static constexpr size_t GetClassSize(size_t class_index) {
+    constexpr size_t kSmallClassCnt = kSmallMaxSize / kSmallGranularity;
+    if (class_index < kSmallClassCnt) {
+      return (class_index + 1) * kSmallGranularity;
+    }
+    return kSmallMaxSize + (class_index - kSmallClassCnt + 1) * kLargeGranularity;
+  }
+
+ private:
+  struct FreeObject {
+    FreeObject *next;
+  };
+
+  struct FreeList {
+    FreeObject *head = nullptr;
+    uint32_t cnt = 0;
+  };
+
+  // 仓库中的一批对象，批内用next串起来，批与批之间用批首对象的第二个指针串起来
+  struct Batch {
+    FreeObject *next;
+    Batch *batch_next;
+  };
+
+  struct Depot {
+    SpinLock lock;
+    Batch *batches = nullptr;
+  };
+
+  // 线程缓存没有析构函数，访问时不需要thread_local的初始化检查，线程退出时由ThreadCacheCleaner归还
+  struct ThreadCache {
+    FreeList free_lists[kClassCnt];
+    // 线程退出后可能仍有静态对象析构时释放节点，此后不再注册清理
+    bool cleaned = false;
+  };
+
+  struct ThreadCacheCleaner {
+    ~ThreadCacheCleaner() {
+      for (size_t i = 0; i < kClassCnt; i++) {
+        if (thread_cache.free_lists[i].cnt > 0) {
+          Flush(thread_cache.free_lists[i], i, 0);
+        }
+      }
+      thread_cache.cleaned = true;
+    }
+  };
+
+  inline static void RegisterCleaner() {
+    if (!thread_cache.cleaned) {
+      thread_local ThreadCacheCleaner cleaner;
+    }
+  }
+
+  static thread_local ThreadCache thread_cache;
+
+  inline static Depot &GetDepot(size_t class_index) {
+    static Depot depots[kClassCnt];
+    return depots[class_index];
+  }
+
+  // free_list只保留头部最近释放的keep_cnt个对象，其余的作为一批放入仓库
+  inline static void Flush(FreeList &free_list, size_t class_index, uint32_t keep_cnt) {
+    FreeObject *head;
+    if (keep_cnt == 0) {
+      head = free_list.head;
+      free_list.head = nullptr;
+    } else {
+      auto *tail = free_list.head;
+      for (uint32_t i = 1; i < keep_cnt; i++) {
+        tail = tail->next;
+      }
+      head = tail->next;
+      tail->next = nullptr;
+    }
+    free_list.cnt = keep_cnt;
+    PushBatches(class_index, reinterpret_cast<Batch *>(head), reinterpret_cast<Batch *>(head));
+  }
+
+  // first到last是用batch_next串起来的若干批
+  inline static void PushBatches(size_t class_index, Batch *first, Batch *last) {
+    auto &depot = GetDepot(class_index);
+    std::lock_guard<SpinLock> lock(depot.lock);
+    last->batch_next = depot.batches;
+    depot.batches = first;
+  }
+
+  inline static void Refill(FreeList &free_list, size_t class_index) {
+    RegisterCleaner();
+    auto &depot = GetDepot(class_index);
+    Batch *batch;
+    {
+      std::lock_guard<SpinLock> lock(depot.lock);
+      batch = depot.batches;
+      if (batch != nullptr) {
+        depot.batches = batch->batch_next;
+      }
+    }
+    if (batch != nullptr) {
+      // 线程退出时归还的批可能不满，重新数一遍
+      free_list.head = reinterpret_cast<FreeObject *>(batch);
+      free_list.cnt = 0;
+      for (auto *object = free_list.head; object != nullptr; object = object->next) {
+        free_list.cnt++;
+      }
+      return;
+    }
+    // 仓库为空，切分一块新的slab，第一批留在本线程，其余分批放入仓库。
+    // slab头部留给SlabSource存放链表指针，对象按kSmallGranularity对齐。
+    auto class_size = GetClassSize(class_index);
+    auto *slab = static_cast<char *>(SlabSource::AllocateSlab(kSlabSize));
+    Batch *first_batch = nullptr;
+    Batch *last_batch = nullptr;
+    auto add_batch = [&free_list, &first_batch, &last_batch](FreeObject *head, uint32_t cnt) {
+      if (free_list.head == nullptr) {
+        free_list.head = head;
+        free_list.cnt = cnt;
+        return;
+      }
+      auto *new_batch = reinterpret_cast<Batch *>(head);
+      new_batch->batch_next = first_batch;
+      first_batch = new_batch;
+      if (last_batch == nullptr) {
+        last_batch = new_batch;
+      }
+    };
+    FreeObject *head = nullptr;
+    uint32_t cnt = 0;
+    for (size_t offset = kSmallGranularity; offset + class_size <= kSlabSize; offset += class_size) {
+      auto *object = reinterpret_cast<FreeObject *>(slab + offset);
+      object->next = head;
+      head = object;
+      if (++cnt == kBatchSize) {
+        add_batch(head, cnt);
+        head = nullptr;
+        cnt = 0;
+      }
+    }
+    if (cnt > 0) {
+      add_batch(head, cnt);
+    }
+    if (first_batch != nullptr) {
+      PushBatches(class_index, first_batch, last_batch);
+    }
+  }
+};
+
+template <class SlabSource>
+inline thread_local typename BasicSlabAllocator<SlabSource>::ThreadCache BasicSlabAllocator<SlabSource>::thread_cache{};
+
+using SlabAllocator = BasicSlabAllocator<MallocSlabSource>;
+
+// slab从透明大页上切分的分配器，kNumaNode不小于0时节点内存绑定到这个NUMA节点
+template <int kNumaNode = -1>
+using HugePageSlabAllocator = BasicSlabAllocator<HugePageSlabSource<kNumaNode>>;
+
+// Vrt的默认策略，自定义策略可以继承它再覆盖其中的一部分
+struct VrtDefaultPolicy {
+  using Allocator = MallocAllocator;
+  // key剩余部分为空的叶子是否直接存放在父节点的子节点指针中，只对可以用VrtInlineValue编码的ValueType生效
+  static constexpr bool kInlineLeaf = false;
+  // 值是否通过VrtValueBox存放在节点外
+  static constexpr bool kBoxedValue = false;
+  static constexpr VrtNodeLadder kNodeLadder = VrtNodeLadder::kDefault;
+  // 写操作是否不加锁下降，只锁最后要修改的节点，只在kWriteLock为true时生效
+  static constexpr bool kOptimisticWrite = false;
+  // 是否按key的首字节把树分成256棵独立加锁的子树
+  static constexpr bool kPartitionedRoot = false;
+  // 是否由后台线程推进epoch并释放退休节点，以及后台线程没有节点可释放时的等待间隔
+  static constexpr bool kBackgroundReclaim = false;
+  static constexpr uint32_t kReclaimIntervalUs = 1000;
+  // 每次回收最多释放的节点数，0表示不限制
+  static constexpr uint32_t kReclaimBatch = 0;
+  // 已退休未释放的节点数上限，超过时写线程参与回收并等待，0表示不限制
+  static constexpr uint32_t kMaxRetireCnt = 0;
+  static constexpr VrtReclaimScheme kReclaimScheme = VrtReclaimScheme::kEbr;
+};
+
+// 使用slab分配器的策略，适合多线程频繁写入的场景
+struct VrtSlabPolicy : public VrtDefaultPolicy {
+  using Allocator = SlabAllocator;
+};
+
+// 节点分配在透明大页上，适合上亿节点、查找受TLB miss影响的场景。需要绑定NUMA节点时可以继承它，
+// 把Allocator换成HugePageSlabAllocator<node>
+struct VrtHugePagePolicy : public VrtDefaultPolicy {
+  using Allocator = HugePageSlabAllocator<>;
+};
+
+// 整数值的叶子不单独申请节点，适合Vrt<uint64_t>这类索引。Find(key, guard)在这个策略下不可用。
+struct VrtInlineLeafPolicy : public VrtDefaultPolicy {
+  static constexpr bool kInlineLeaf = true;
+};
+
+// 值存放在节点外，节点扩容、分裂、合并时只复制指针，适合KB级别的大值。FetchAdd等原地修改的接口在这个策略下不可用。
+struct VrtBoxedValuePolicy : public VrtDefaultPolicy {
+  static constexpr bool kBoxedValue = true;
+};
+
+// 在Node4/Node16/Node48之间增加Node8和Node32，子节点数为5~8、17~32的节点更省内存，适合十进制、十六进制这类小字符集的key
+struct VrtFineNodePolicy : public VrtDefaultPolicy {
+  static constexpr VrtNodeLadder kNodeLadder = VrtNodeLadder::kFine;
+};
+
+// 写操作不再逐层加锁下降，而是像读线程一样在读区间内下降，只锁最后要修改的父节点和节点，版本号变化时重新下降。
+// key在深层分叉的多个写线程不会在上层节点上排队，适合多线程写入。写线程也会进入读区间，占用读线程的槽位。
+struct VrtOptimisticWritePolicy : public VrtDefaultPolicy {
+  static constexpr bool kOptimisticWrite = true;
+};
+
+// 按key的首字节分成256棵子树，每棵子树的根和根的锁独占一个cache line，首字节不同的写操作不会访问同一个cache line。
+// 适合首字节分布均匀的多线程写入，Scan和空前缀的ForEachPrefix需要依次访问各个分区。
+struct VrtPartitionedRootPolicy : public VrtDefaultPolicy {
+  static constexpr bool kPartitionedRoot = true;
+};
+
+// 读操作不再进出读区间，读线程在不持有任何读到的值时调用Vrt::Quiescent()，阻塞之前调用Vrt::Offline()。
+// 适合有天然静止点的事件循环线程，省掉每次读操作进出读区间时的seq_cst写入。
+struct VrtQsbrPolicy : public VrtDefaultPolicy {
+  static constexpr VrtReclaimScheme kReclaimScheme = VrtReclaimScheme::kQsbr;
+};
+
+// 点查把正在访问的节点发布到线程的hazard槽位，不进入读区间，读线程被抢占或者阻塞时其他节点照常回收。
+// 适合读线程可能长时间停住、又不能像QSBR那样声明静止点的场景，需要kWriteLock，不能和kBoxedValue一起使用，
+// Scan、ForEachPrefix、快照和Find(key, guard)不可用。
+struct VrtHazardPointerPolicy : public VrtDefaultPolicy {
+  static constexpr VrtReclaimScheme kReclaimScheme = VrtReclaimScheme::kHazardPointer;
+};
+
+// 退休节点由后台线程分批释放，写线程不再在写路径上同步释放上万个节点，退休节点过多时写线程参与回收。
+// 适合对写延迟的长尾敏感的场景，每个Vrt会多一个线程。
+struct VrtBackgroundReclaimPolicy : public VrtDefaultPolicy {
+  static constexpr bool kBackgroundReclaim = true;
+  static constexpr uint32_t kReclaimBatch = 1024;
+  static constexpr uint32_t kMaxRetireCnt = 1 << 20;
+};
+
+}  // namespace vrt
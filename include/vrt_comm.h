@@ -14,22 +14,58 @@ namespace vrt {
 #ifdef __GNUC__
 #  define likely(x) __builtin_expect(!!(x), 1)
 #  define unlikely(x) __builtin_expect(!!(x), 0)
+#  define VRT_PREFETCH(x) __builtin_prefetch(x)
 #else
 #  define likely(x) (x)
 #  define unlikely(x) (x)
+#  define VRT_PREFETCH(x)
 #endif
 
 constexpr size_t kFour = 4;
 constexpr size_t kFive = 5;
+constexpr size_t kEight = 8;
 constexpr size_t kTen = 10;
 constexpr size_t kSixteen = 16;
 constexpr size_t kSeventeen = 17;
+constexpr size_t kThirtyTwo = 32;
 constexpr size_t kFortyEight = 48;
 constexpr size_t kFortyNight = 49;
 constexpr size_t kTwoFiveSix = 256;
 
 constexpr size_t kNodeChildMaxCnt = 256;
+// 删除子节点后缩容的阈值，比扩容的阈值低，避免在临界点反复扩缩容
+constexpr size_t kNode256ShrinkCnt = 37;
+constexpr size_t kNode48ShrinkCnt = 12;
+constexpr size_t kNode16ShrinkCnt = 3;
+// VrtNodeLadder::kFine下各级节点缩容的阈值
+constexpr size_t kNode48FineShrinkCnt = 24;
+constexpr size_t kNode32ShrinkCnt = 12;
+constexpr size_t kNode16FineShrinkCnt = 6;
+constexpr size_t kNode8ShrinkCnt = 3;
+constexpr size_t kMultiFindBatchSize = 32;
+// 乐观写连续失败这么多次后退回逐层加锁，保证写操作一定能完成
+constexpr uint32_t kOptimisticWriteRetryCnt = 16;
 constexpr size_t kMaxKeySize = 1 << 20;
+constexpr uint8_t kCacheLineSize = 64;
+
+// 节点按子节点数选择类型的阶梯
+enum class VrtNodeLadder {
+  // Node4 -> Node16 -> Node48 -> Node256
+  kDefault,
+  // Node4 -> Node8 -> Node16 -> Node32 -> Node48 -> Node256，子节点数落在两级之间时空闲的槽位更少，
+  // 适合十进制、十六进制这类字符集较小的key
+  kFine,
+};
+
+// 退休节点的回收方式
+enum class VrtReclaimScheme {
+  // 基于epoch的回收，每次读操作进出读区间
+  kEbr,
+  // 基于静止状态的回收，读操作不再进出读区间，读线程通过Vrt::Quiescent()声明自己不再持有任何节点
+  kQsbr,
+  // 点查通过hazard pointer保护正在访问的节点，停住的读线程只会阻止回收几个节点。不支持Scan、ForEachPrefix和快照
+  kHazardPointer,
+};
 
 constexpr uint8_t kFree = 0;
 constexpr uint8_t kLocked = 1;
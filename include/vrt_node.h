@@ -10,38 +10,167 @@
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <vector>
 #include "spin_lock.h"
+#include "vrt_allocator.h"
 #include "vrt_comm.h"
 
 namespace vrt {
 
 enum VrtNodeType {
+  // 类型只有3位，Node8和Node32用掉了最后两个空闲的编码，只在VrtNodeLadder::kFine下出现
+  Node8 = 0,
   Node4 = 1,
   Node16 = 2,
   Node48 = 3,
   Node256 = 4,
   LeafNode = 5,
+  Node32 = 6,
+  // 只作为VrtChildPtr的标记使用，表示子节点指针中直接存放了值，不对应真实的节点
+  InlineLeaf = 7,
+};
+
+// 节点的写锁，同时是节点的版本号。最低位是锁位，每次解锁版本号加2，节点在加锁期间的修改都会体现在版本号上。
+// 被替换的节点一直保持加锁直到回收，乐观下降的写操作读到加锁的版本号或者加锁时版本号已经变化，就重新下降。
+// kWriteLock为false时是空基类，节点中不占空间
+template <bool kWriteLock>
+struct VrtNodeLock {
+  std::atomic<uint32_t> version;
+
+  VrtNodeLock() : version(0) {}
+  inline void Lock() {
+    Sleeper sleeper;
+    while (true) {
+      auto cur_version = version.load(std::memory_order_relaxed);
+      if (!IsLocked(cur_version) && TryLock(cur_version)) {
+        return;
+      }
+      sleeper.wait();
+    }
+  }
+  inline void Unlock() {
+    auto cur_version = version.load(std::memory_order_relaxed);
+    assert(IsLocked(cur_version));
+    version.store(cur_version + 1, std::memory_order_release);
+  }
+  inline void InitLock() { new (&version) std::atomic<uint32_t>(0); }
+  inline void DestroyLock() {}
+  inline uint32_t ReadVersion() const { return version.load(std::memory_order_acquire); }
+  // 只有版本号仍然是expected_version时才加锁成功，expected_version必须是未加锁的版本号
+  inline bool TryLock(uint32_t expected_version) {
+    return version.compare_exchange_strong(expected_version, expected_version + 1, std::memory_order_acquire,
+                                           std::memory_order_relaxed);
+  }
+  inline static bool IsLocked(uint32_t cur_version) { return cur_version & 1; }
+};
+
+template <>
+struct VrtNodeLock<false> {
+  inline void Lock() {}
+  inline void Unlock() {}
+  inline void InitLock() {}
+  inline void DestroyLock() {}
 };
 
 template <bool kWriteLock = true>
-struct VrtNode {
-  SpinLock spin_lock;
+struct VrtNode : public VrtNodeLock<kWriteLock> {
   uint32_t type : 3;
   uint32_t has_value : 1;
   uint32_t key_length : 20;
   uint32_t child_cnt : 8;
+};
 
-  inline void Lock() {
-    if constexpr (kWriteLock) {
-      spin_lock.lock();
+// 子节点指针，低3位存放子节点的类型。节点的类型创建后不会改变，下降时不用等子节点头部所在的cache line
+// 就能算出数据的位置并预取。节点由malloc或slab分配器申请，至少按16字节对齐，低位一定是0。
+// 类型为InlineLeaf时高61位直接存放子节点的值，相当于一个key为空的叶子，见VrtInlineValue。
+template <bool kWriteLock = true>
+class VrtChildPtr {
+ public:
+  static constexpr uintptr_t kTypeMask = 0x7;
+  static constexpr uint32_t kPayloadShift = 3;
+
+  VrtChildPtr() = default;
+  VrtChildPtr(VrtNode<kWriteLock> *node) : raw_(Tag(node)) {}
+  VrtChildPtr &operator=(VrtNode<kWriteLock> *node) {
+    raw_ = Tag(node);
+    return *this;
+  }
+
+  inline static VrtChildPtr CreateInline(uintptr_t payload) {
+    VrtChildPtr ptr;
+    ptr.raw_ = (payload << kPayloadShift) | InlineLeaf;
+    return ptr;
+  }
+
+  inline operator VrtNode<kWriteLock> *() const { return Get(); }
+  inline VrtNode<kWriteLock> *operator->() const { return Get(); }
+  inline VrtNode<kWriteLock> *Get() const {
+    assert(!IsInline());
+    return reinterpret_cast<VrtNode<kWriteLock> *>(raw_ & ~kTypeMask);
+  }
+  inline uint32_t GetType() const { return raw_ & kTypeMask; }
+  inline bool IsInline() const { return GetType() == InlineLeaf; }
+  inline uintptr_t GetPayload() const { return raw_ >> kPayloadShift; }
+  inline bool IsSame(const VrtChildPtr &other) const { return raw_ == other.raw_; }
+
+  // 值为0的InlineLeaf不是空指针，不能转换成VrtNode *后再比较
+  friend inline bool operator==(const VrtChildPtr &ptr, std::nullptr_t) { return ptr.raw_ == 0; }
+  friend inline bool operator==(std::nullptr_t, const VrtChildPtr &ptr) { return ptr.raw_ == 0; }
+  friend inline bool operator!=(const VrtChildPtr &ptr, std::nullptr_t) { return ptr.raw_ != 0; }
+  friend inline bool operator!=(std::nullptr_t, const VrtChildPtr &ptr) { return ptr.raw_ != 0; }
+
+ private:
+  inline static uintptr_t Tag(VrtNode<kWriteLock> *node) {
+    if (node == nullptr) {
+      return 0;
     }
+    assert((reinterpret_cast<uintptr_t>(node) & kTypeMask) == 0);
+    return reinterpret_cast<uintptr_t>(node) | node->type;
   }
-  inline void Unlock() {
-    if constexpr (kWriteLock) {
-      spin_lock.unlock();
+
+  uintptr_t raw_;
+};
+
+// 把值编码到VrtChildPtr的61位payload中。只支持不超过8字节的整数和枚举，编码后解码不相等(值超出61位)时
+// Encode返回false，调用方退回到创建真实的叶子节点。
+template <class ValueType, class = void>
+struct VrtInlineValue {
+  static constexpr bool kSupported = false;
+  inline static bool Encode(const ValueType & /*value*/, uintptr_t * /*payload*/) { return false; }
+  inline static ValueType Decode(uintptr_t /*payload*/) { abort(); }
+};
+
+template <class ValueType>
+struct VrtInlineValue<ValueType, std::enable_if_t<(std::is_integral_v<ValueType> || std::is_enum_v<ValueType>) &&
+                                                  sizeof(ValueType) <= sizeof(uintptr_t)>> {
+  static constexpr bool kSupported = true;
+  static constexpr uint32_t kShift = VrtChildPtr<>::kPayloadShift;
+  static constexpr bool kSigned =
+      std::is_signed_v<typename std::conditional_t<std::is_enum_v<ValueType>, std::underlying_type<ValueType>,
+                                                   std::common_type<ValueType>>::type>;
+  static constexpr uintptr_t kPayloadMask = ~uintptr_t(0) >> kShift;
+
+  inline static bool Encode(const ValueType &value, uintptr_t *payload) {
+    if constexpr (kSigned) {
+      *payload = static_cast<uintptr_t>(static_cast<intptr_t>(value)) & kPayloadMask;
+    } else {
+      *payload = static_cast<uintptr_t>(value) & kPayloadMask;
+    }
+    return Decode(*payload) == value;
+  }
+
+  inline static ValueType Decode(uintptr_t payload) {
+    if constexpr (kSigned) {
+      // 算术右移还原符号位
+      return static_cast<ValueType>(static_cast<intptr_t>(payload << kShift) >> kShift);
+    } else {
+      return static_cast<ValueType>(payload);
     }
   }
 };
@@ -49,27 +178,41 @@ struct VrtNode {
 template <bool kWriteLock = true>
 struct VrtNode4 : public VrtNode<kWriteLock> {
   char edge[kFour];
-  VrtNode<kWriteLock> *childs[kFour];
+  VrtChildPtr<kWriteLock> childs[kFour];
+  char data[0];
+};
+
+template <bool kWriteLock = true>
+struct VrtNode8 : public VrtNode<kWriteLock> {
+  char edge[kEight];
+  VrtChildPtr<kWriteLock> childs[kEight];
   char data[0];
 };
 
 template <bool kWriteLock = true>
 struct VrtNode16 : public VrtNode<kWriteLock> {
   char edge[kSixteen];
-  VrtNode<kWriteLock> *childs[kSixteen];
+  VrtChildPtr<kWriteLock> childs[kSixteen];
+  char data[0];
+};
+
+template <bool kWriteLock = true>
+struct VrtNode32 : public VrtNode<kWriteLock> {
+  char edge[kThirtyTwo];
+  VrtChildPtr<kWriteLock> childs[kThirtyTwo];
   char data[0];
 };
 
 template <bool kWriteLock = true>
 struct VrtNode48 : public VrtNode<kWriteLock> {
   char childs_index[kTwoFiveSix];
-  VrtNode<kWriteLock> *childs[kFortyEight];
+  VrtChildPtr<kWriteLock> childs[kFortyEight];
   char data[0];
 };
 
 template <bool kWriteLock = true>
 struct VrtNode256 : public VrtNode<kWriteLock> {
-  VrtNode<kWriteLock> *childs[kTwoFiveSix];
+  VrtChildPtr<kWriteLock> childs[kTwoFiveSix];
   char data[0];
 };
 
@@ -78,30 +221,160 @@ struct VrtLeafNode : public VrtNode<kWriteLock> {
   char data[0];
 };
 
-template <bool kWriteLock = true>
+// kWriteLock为false时头部只有4字节。Node4的头部、边和全部子节点，Node16的头部、边和前4个子节点都在节点的前64字节内，
+// 节点从cache line边界开始时下降只需要加载一个cache line。
+static_assert(sizeof(VrtNode<true>) == 8 && sizeof(VrtNode<false>) == 4, "unexpected node header size");
+static_assert(sizeof(VrtLeafNode<true>) == 8 && sizeof(VrtLeafNode<false>) == 4, "unexpected leaf node size");
+static_assert(sizeof(VrtNode4<true>) == 48 && sizeof(VrtNode4<false>) == 40, "unexpected node4 size");
+static_assert(sizeof(VrtNode4<true>) <= kCacheLineSize, "node4 must fit in one cache line");
+static_assert(sizeof(VrtNode16<true>) - sizeof(VrtChildPtr<true>) * (kSixteen - kFour) <= kCacheLineSize &&
+                  sizeof(VrtNode16<false>) - sizeof(VrtChildPtr<false>) * (kSixteen - kFour) <= kCacheLineSize,
+              "the edges and the first children of node16 must fit in one cache line");
+
+// 能通过__atomic系列内建函数在节点上原地无锁读写的值类型，要求自然对齐
+template <class ValueType, class = void>
+struct IsAtomicValue : std::false_type {};
+
+template <class ValueType>
+struct IsAtomicValue<ValueType, std::enable_if_t<std::is_trivially_copyable_v<ValueType>>>
+    : std::bool_constant<alignof(ValueType) >= sizeof(ValueType) &&
+                         __atomic_always_lock_free(sizeof(ValueType), nullptr)> {};
+
+template <class ValueType>
+constexpr bool kIsAtomicValue = IsAtomicValue<ValueType>::value;
+
+// 作为构造值的参数时，在目标地址上直接用fn(old_value)返回的纯右值初始化值(C++17保证省略复制)，fn返回ValueType时
+// 不产生额外的临时对象。转换成ValueType的运算符留给需要先在栈上得到值的地方，例如判断值能否编码成InlineLeaf。
+template <class ValueType, class Fn>
+class VrtValueEmplacer {
+ public:
+  VrtValueEmplacer(Fn &fn, const ValueType *old_value) : fn_(fn), old_value_(old_value) {}
+  inline ValueType operator()() const { return fn_(old_value_); }
+  operator ValueType() const { return fn_(old_value_); }
+
+ private:
+  Fn &fn_;
+  const ValueType *old_value_;
+};
+
+// 存放在节点外的值，节点中只保存一个指针。复制节点时只增加引用计数，不复制值本身，扩容、去前缀、合并等结构修改的开销
+// 和ValueType的大小无关。同一个值可能同时被新旧节点(或者快照中的节点)引用，最后一个引用它的节点回收时才析构。
+template <class ValueType, class Allocator = MallocAllocator>
+class VrtValueBox {
+ public:
+  template <class... Args, class = std::enable_if_t<!(sizeof...(Args) == 1 &&
+                                                      (std::is_same_v<std::decay_t<Args>, VrtValueBox> && ...))>>
+  VrtValueBox(Args &&...args) : rep_(static_cast<Rep *>(Allocator::Allocate(sizeof(Rep)))) {
+    new (rep_) Rep(std::forward<Args>(args)...);
+  }
+  VrtValueBox(const VrtValueBox &other) : rep_(other.rep_) { rep_->ref_cnt.fetch_add(1, std::memory_order_relaxed); }
+  VrtValueBox(VrtValueBox &&other) : rep_(other.rep_) { other.rep_ = nullptr; }
+  VrtValueBox &operator=(const VrtValueBox &) = delete;
+  ~VrtValueBox() {
+    if (nullptr != rep_) {
+      Release(rep_);
+    }
+  }
+
+  // 读线程可能和Replace并发，按acquire读取指针
+  inline ValueType *Get() const { return &__atomic_load_n(&rep_, __ATOMIC_ACQUIRE)->value; }
+  inline uint32_t GetRefCnt() const { return rep_->ref_cnt.load(std::memory_order_relaxed); }
+
+  // 换上other的值，返回原来的值，other变为空。调用方持有节点的锁，读线程可能还在访问原来的值，
+  // 等它们结束之后再用Release释放这个节点对它的引用
+  inline void *Replace(VrtValueBox &&other) {
+    auto *old_rep = rep_;
+    __atomic_store_n(&rep_, other.rep_, __ATOMIC_RELEASE);
+    other.rep_ = nullptr;
+    return old_rep;
+  }
+
+  static void Release(void *rep) {
+    auto *old_rep = static_cast<Rep *>(rep);
+    if (old_rep->ref_cnt.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      old_rep->~Rep();
+      Allocator::Deallocate(old_rep, sizeof(Rep));
+    }
+  }
+
+ private:
+  struct Rep {
+    template <class... Args>
+    explicit Rep(Args &&...args) : ref_cnt(1), value(std::forward<Args>(args)...) {}
+    template <class Fn>
+    explicit Rep(VrtValueEmplacer<ValueType, Fn> from) : ref_cnt(1), value(from()) {}
+
+    std::atomic<uint32_t> ref_cnt;
+    ValueType value;
+  };
+
+  Rep *rep_;
+};
+
+// 对象能否按字节搬到另一个地址，并且搬走后原地址上的对象不再析构。可平凡复制的类型总是可以，其他类型需要特化声明，
+// 例如libstdc++的std::string指向自身内部的缓冲区，就不能这样搬。
+template <class ValueType>
+struct VrtIsTriviallyRelocatable : std::is_trivially_copyable<ValueType> {};
+
+template <class T, class Alloc>
+struct VrtIsTriviallyRelocatable<std::vector<T, Alloc>> : std::true_type {};
+
+template <class T>
+struct VrtIsTriviallyRelocatable<std::shared_ptr<T>> : std::true_type {};
+
+#ifdef _LIBCPP_VERSION
+template <class CharT, class Traits, class Alloc>
+struct VrtIsTriviallyRelocatable<std::basic_string<CharT, Traits, Alloc>> : std::true_type {};
+#endif
+
+template <class ValueType, class Allocator>
+struct VrtIsTriviallyRelocatable<VrtValueBox<ValueType, Allocator>> : std::true_type {};
+
+template <class ValueType>
+struct VrtIsValueBox : std::false_type {};
+
+template <class ValueType, class Allocator>
+struct VrtIsValueBox<VrtValueBox<ValueType, Allocator>> : std::true_type {};
+
+// 作为构造值的参数时，表示把value指向的对象按字节搬过来，而不是调用构造函数
+template <class ValueType>
+struct VrtRelocatedValue {
+  ValueType *value;
+};
+
+template <bool kWriteLock = true, class Allocator = MallocAllocator, VrtNodeLadder kLadder = VrtNodeLadder::kDefault>
 class VrtNodeHelper {
  public:
-  inline static uint32_t CheckSamePrefixLength(VrtNode<kWriteLock> *node, std::string_view key) {
-    char *data;
-    switch (node->type) {
-      case Node4: {
-        data = static_cast<VrtNode4<kWriteLock> *>(node)->data;
-      } break;
-      case Node16: {
-        data = static_cast<VrtNode16<kWriteLock> *>(node)->data;
-      } break;
-      case Node48: {
-        data = static_cast<VrtNode48<kWriteLock> *>(node)->data;
-      } break;
-      case Node256: {
-        data = static_cast<VrtNode256<kWriteLock> *>(node)->data;
-      } break;
-      case LeafNode: {
-        data = static_cast<VrtLeafNode<kWriteLock> *>(node)->data;
-      } break;
+  // 只根据类型算出key的起始地址，不读节点头部
+  inline static char *GetData(VrtNode<kWriteLock> *node, uint32_t type) {
+    switch (type) {
+      case Node4:
+        return static_cast<VrtNode4<kWriteLock> *>(node)->data;
+      case Node8:
+        return static_cast<VrtNode8<kWriteLock> *>(node)->data;
+      case Node16:
+        return static_cast<VrtNode16<kWriteLock> *>(node)->data;
+      case Node32:
+        return static_cast<VrtNode32<kWriteLock> *>(node)->data;
+      case Node48:
+        return static_cast<VrtNode48<kWriteLock> *>(node)->data;
+      case Node256:
+        return static_cast<VrtNode256<kWriteLock> *>(node)->data;
+      case LeafNode:
+        return static_cast<VrtLeafNode<kWriteLock> *>(node)->data;
       default:
         assert(false);
     }
+    return nullptr;
+  }
+
+  inline static uint32_t CheckSamePrefixLength(VrtNode<kWriteLock> *node, std::string_view key) {
+    return CheckSamePrefixLength(node, node->type, key);
+  }
+
+  // type来自VrtChildPtr时，key的地址和头部可以同时加载
+  inline static uint32_t CheckSamePrefixLength(VrtNode<kWriteLock> *node, uint32_t type, std::string_view key) {
+    char *data = GetData(node, type);
     size_t same_prefix_length = 0;
     size_t cmp_size = std::min(static_cast<size_t>(node->key_length), key.length());
     while ((cmp_size--) != 0U) {
@@ -118,9 +391,15 @@ class VrtNodeHelper {
       case Node4: {
         return std::string(static_cast<VrtNode4<kWriteLock> *>(node)->data, node->key_length);
       } break;
+      case Node8: {
+        return std::string(static_cast<VrtNode8<kWriteLock> *>(node)->data, node->key_length);
+      } break;
       case Node16: {
         return std::string(static_cast<VrtNode16<kWriteLock> *>(node)->data, node->key_length);
       } break;
+      case Node32: {
+        return std::string(static_cast<VrtNode32<kWriteLock> *>(node)->data, node->key_length);
+      } break;
       case Node48: {
         return std::string(static_cast<VrtNode48<kWriteLock> *>(node)->data, node->key_length);
       } break;
@@ -141,9 +420,15 @@ class VrtNodeHelper {
       case Node4: {
         return static_cast<VrtNode4<kWriteLock> *>(node)->data[index];
       } break;
+      case Node8: {
+        return static_cast<VrtNode8<kWriteLock> *>(node)->data[index];
+      } break;
       case Node16: {
         return static_cast<VrtNode16<kWriteLock> *>(node)->data[index];
       } break;
+      case Node32: {
+        return static_cast<VrtNode32<kWriteLock> *>(node)->data[index];
+      } break;
       case Node48: {
         return static_cast<VrtNode48<kWriteLock> *>(node)->data[index];
       } break;
@@ -159,32 +444,189 @@ class VrtNodeHelper {
     return ' ';
   }
 
-  template <class ValueType>
-  inline static ValueType GetValue(VrtNode<kWriteLock> *node) {
+  inline static std::string_view GetKeyView(VrtNode<kWriteLock> *node) {
     switch (node->type) {
       case Node4: {
-        return *(reinterpret_cast<ValueType *>(static_cast<VrtNode4<kWriteLock> *>(node)->data + node->key_length));
+        return std::string_view(static_cast<VrtNode4<kWriteLock> *>(node)->data, node->key_length);
+      } break;
+      case Node8: {
+        return std::string_view(static_cast<VrtNode8<kWriteLock> *>(node)->data, node->key_length);
       } break;
       case Node16: {
-        return *(reinterpret_cast<ValueType *>(static_cast<VrtNode16<kWriteLock> *>(node)->data + node->key_length));
+        return std::string_view(static_cast<VrtNode16<kWriteLock> *>(node)->data, node->key_length);
+      } break;
+      case Node32: {
+        return std::string_view(static_cast<VrtNode32<kWriteLock> *>(node)->data, node->key_length);
       } break;
       case Node48: {
-        return *(reinterpret_cast<ValueType *>(static_cast<VrtNode48<kWriteLock> *>(node)->data + node->key_length));
+        return std::string_view(static_cast<VrtNode48<kWriteLock> *>(node)->data, node->key_length);
       } break;
       case Node256: {
-        return *(reinterpret_cast<ValueType *>(static_cast<VrtNode256<kWriteLock> *>(node)->data + node->key_length));
+        return std::string_view(static_cast<VrtNode256<kWriteLock> *>(node)->data, node->key_length);
       } break;
       case LeafNode: {
-        return *(reinterpret_cast<ValueType *>(static_cast<VrtLeafNode<kWriteLock> *>(node)->data + node->key_length));
+        return std::string_view(static_cast<VrtLeafNode<kWriteLock> *>(node)->data, node->key_length);
       } break;
       default:
         assert(false);
     }
-    return ValueType();
+    return std::string_view();
+  }
+
+  // 值存放在key之后，起始地址按alignof(ValueType)向上对齐，这样可以直接对值做原子操作
+  template <class ValueType>
+  inline static ValueType *GetValueSlot(char *data, uint32_t key_length) {
+    static_assert(alignof(ValueType) <= alignof(std::max_align_t), "over-aligned value type is not supported");
+    auto addr = reinterpret_cast<uintptr_t>(data + key_length);
+    return reinterpret_cast<ValueType *>((addr + alignof(ValueType) - 1) & ~(alignof(ValueType) - 1));
+  }
+
+  // 在slot上构造值，参数是VrtRelocatedValue时按字节搬过来，是VrtValueEmplacer时用fn的返回值直接初始化
+  template <class ValueType, class... Args>
+  inline static void ConstructValue(ValueType *slot, Args &&...args) {
+    new (slot) ValueType(std::forward<Args>(args)...);
+  }
+
+  template <class ValueType, class Fn>
+  inline static void ConstructValue(ValueType *slot, VrtValueEmplacer<ValueType, Fn> from) {
+    new (slot) ValueType(from());
+  }
+
+  template <class ValueType>
+  inline static void ConstructValue(ValueType *slot, VrtRelocatedValue<ValueType> from) {
+    memcpy(static_cast<void *>(slot), static_cast<const void *>(from.value), sizeof(ValueType));
+  }
+
+  // 新节点沿用旧节点的值时传给ConstructValue的参数，kRelocate时按字节搬走，否则复制
+  template <class ValueType, bool kRelocate>
+  inline static decltype(auto) TakeValue(ValueType *value) {
+    if constexpr (kRelocate) {
+      static_assert(VrtIsTriviallyRelocatable<ValueType>::value, "value type is not trivially relocatable");
+      return VrtRelocatedValue<ValueType>{value};
+    } else {
+      return (*value);
+    }
+  }
+
+  // 值已经被搬到替换节点上的退休节点，交给EBR时用指针最低位标记，回收时只释放节点，不再析构值。
+  // 旧节点上的字节保持不变，还在读它的线程看到的仍然是完整的值，值本身由替换节点负责析构，替换节点退休得更晚。
+  inline static VrtNode<kWriteLock> *MarkValueRelocated(VrtNode<kWriteLock> *node) {
+    return reinterpret_cast<VrtNode<kWriteLock> *>(reinterpret_cast<uintptr_t>(node) | 1);
+  }
+
+  inline static bool IsValueRelocated(VrtNode<kWriteLock> *node) { return reinterpret_cast<uintptr_t>(node) & 1; }
+
+  inline static VrtNode<kWriteLock> *ClearValueRelocated(VrtNode<kWriteLock> *node) {
+    return reinterpret_cast<VrtNode<kWriteLock> *>(reinterpret_cast<uintptr_t>(node) & ~static_cast<uintptr_t>(1));
+  }
+
+  // 原地换下来的VrtValueBox的值，和节点一起交给EBR时用指针的第二位标记，回收时只释放一次对它的引用
+  inline static VrtNode<kWriteLock> *MarkValueBox(void *rep) {
+    return reinterpret_cast<VrtNode<kWriteLock> *>(reinterpret_cast<uintptr_t>(rep) | 2);
+  }
+
+  inline static bool IsValueBox(VrtNode<kWriteLock> *node) { return reinterpret_cast<uintptr_t>(node) & 2; }
+
+  inline static void *ClearValueBox(VrtNode<kWriteLock> *node) {
+    return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(node) & ~static_cast<uintptr_t>(2));
+  }
+
+  // 带值节点需要申请的大小，malloc返回的地址满足max_align_t对齐，所以按偏移量对齐即可
+  template <class NodeType, class ValueType>
+  inline static constexpr size_t GetNodeSizeWithValue(size_t key_length) {
+    return ((sizeof(NodeType) + key_length + alignof(ValueType) - 1) & ~(alignof(ValueType) - 1)) + sizeof(ValueType);
+  }
+
+  // 按节点类型、key长度和是否带值算出节点申请时的大小，释放时交给分配器
+  template <class ValueType>
+  inline static size_t GetNodeSize(VrtNode<kWriteLock> *node) {
+    switch (node->type) {
+      case Node4:
+        return node->has_value ? GetNodeSizeWithValue<VrtNode4<kWriteLock>, ValueType>(node->key_length)
+                               : sizeof(VrtNode4<kWriteLock>) + node->key_length;
+      case Node8:
+        return node->has_value ? GetNodeSizeWithValue<VrtNode8<kWriteLock>, ValueType>(node->key_length)
+                               : sizeof(VrtNode8<kWriteLock>) + node->key_length;
+      case Node16:
+        return node->has_value ? GetNodeSizeWithValue<VrtNode16<kWriteLock>, ValueType>(node->key_length)
+                               : sizeof(VrtNode16<kWriteLock>) + node->key_length;
+      case Node32:
+        return node->has_value ? GetNodeSizeWithValue<VrtNode32<kWriteLock>, ValueType>(node->key_length)
+                               : sizeof(VrtNode32<kWriteLock>) + node->key_length;
+      case Node48:
+        return node->has_value ? GetNodeSizeWithValue<VrtNode48<kWriteLock>, ValueType>(node->key_length)
+                               : sizeof(VrtNode48<kWriteLock>) + node->key_length;
+      case Node256:
+        return node->has_value ? GetNodeSizeWithValue<VrtNode256<kWriteLock>, ValueType>(node->key_length)
+                               : sizeof(VrtNode256<kWriteLock>) + node->key_length;
+      case LeafNode:
+        return node->has_value ? GetNodeSizeWithValue<VrtLeafNode<kWriteLock>, ValueType>(node->key_length)
+                               : sizeof(VrtLeafNode<kWriteLock>) + node->key_length;
+      default:
+        assert(false);
+    }
+    return 0;
   }
 
-  inline static VrtNode<kWriteLock> *&FindChild(VrtNode<kWriteLock> *node, char find_char) {
+  template <class ValueType>
+  inline static ValueType *GetValuePtr(VrtNode<kWriteLock> *node) {
     switch (node->type) {
+      case Node4: {
+        return GetValueSlot<ValueType>(static_cast<VrtNode4<kWriteLock> *>(node)->data, node->key_length);
+      } break;
+      case Node8: {
+        return GetValueSlot<ValueType>(static_cast<VrtNode8<kWriteLock> *>(node)->data, node->key_length);
+      } break;
+      case Node16: {
+        return GetValueSlot<ValueType>(static_cast<VrtNode16<kWriteLock> *>(node)->data, node->key_length);
+      } break;
+      case Node32: {
+        return GetValueSlot<ValueType>(static_cast<VrtNode32<kWriteLock> *>(node)->data, node->key_length);
+      } break;
+      case Node48: {
+        return GetValueSlot<ValueType>(static_cast<VrtNode48<kWriteLock> *>(node)->data, node->key_length);
+      } break;
+      case Node256: {
+        return GetValueSlot<ValueType>(static_cast<VrtNode256<kWriteLock> *>(node)->data, node->key_length);
+      } break;
+      case LeafNode: {
+        return GetValueSlot<ValueType>(static_cast<VrtLeafNode<kWriteLock> *>(node)->data, node->key_length);
+      } break;
+      default:
+        assert(false);
+    }
+    return nullptr;
+  }
+
+  template <class ValueType>
+  inline static ValueType GetValue(VrtNode<kWriteLock> *node) {
+    auto *value = GetValuePtr<ValueType>(node);
+    if constexpr (kIsAtomicValue<ValueType>) {
+      ValueType ret;
+      __atomic_load(value, &ret, __ATOMIC_ACQUIRE);
+      return ret;
+    } else {
+      return *value;
+    }
+  }
+
+  // 把节点上的值复制到out，可原地原子修改的值类型需要用原子读，避免和FetchAdd等并发时读到撕裂的值
+  template <class ValueType>
+  inline static void LoadValue(VrtNode<kWriteLock> *node, ValueType *out) {
+    auto *value = GetValuePtr<ValueType>(node);
+    if constexpr (kIsAtomicValue<ValueType>) {
+      __atomic_load(value, out, __ATOMIC_ACQUIRE);
+    } else {
+      *out = *value;
+    }
+  }
+
+  inline static VrtChildPtr<kWriteLock> &FindChild(VrtNode<kWriteLock> *node, char find_char) {
+    return FindChild(node, node->type, find_char);
+  }
+
+  inline static VrtChildPtr<kWriteLock> &FindChild(VrtNode<kWriteLock> *node, uint32_t type, char find_char) {
+    switch (type) {
       case Node4: {
         auto *node4 = static_cast<VrtNode4<kWriteLock> *>(node);
         auto child_cnt = node4->child_cnt;
@@ -195,6 +637,16 @@ class VrtNodeHelper {
           }
         }
       } break;
+      case Node8: {
+        auto *node8 = static_cast<VrtNode8<kWriteLock> *>(node);
+        auto child_cnt = node8->child_cnt;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        for (int i = 0; i < child_cnt; i++) {
+          if (node8->edge[i] == find_char) {
+            return node8->childs[i];
+          }
+        }
+      } break;
       case Node16: {
         auto *node16 = static_cast<VrtNode16<kWriteLock> *>(node);
         auto child_cnt = node16->child_cnt;
@@ -205,6 +657,16 @@ class VrtNodeHelper {
           }
         }
       } break;
+      case Node32: {
+        auto *node32 = static_cast<VrtNode32<kWriteLock> *>(node);
+        auto child_cnt = node32->child_cnt;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        for (int i = 0; i < child_cnt; i++) {
+          if (node32->edge[i] == find_char) {
+            return node32->childs[i];
+          }
+        }
+      } break;
       case Node48: {
         auto *node48 = static_cast<VrtNode48<kWriteLock> *>(node);
         if (auto index = node48->childs_index[static_cast<uint8_t>(find_char)]; index != -1) {
@@ -217,14 +679,67 @@ class VrtNodeHelper {
         auto index = static_cast<uint8_t>(find_char);
         return node256->childs[index];
       } break;
+      case LeafNode:
+        break;
       default:
         assert(false);
     }
     return kVrtNodeNullObject;
   }
 
-  template <class ValueType>
-  inline static VrtNode<kWriteLock> *AddChild(VrtNode<kWriteLock> *node, char edge, VrtNode<kWriteLock> *child) {
+  // 按边的字节序(unsigned char)从小到大遍历边不小于from的子节点，visitor(char edge, VrtChildPtr child)返回false时终止遍历。
+  // 线性节点(Node4/Node8/Node16/Node32)的边按插入顺序存放，这里在栈上临时排序，不改动节点本身，因此可以和写线程并发执行。
+  template <class Visitor>
+  inline static bool ForEachChild(VrtNode<kWriteLock> *node, Visitor &&visitor, uint8_t from = 0) {
+    switch (node->type) {
+      case Node4: {
+        auto *node4 = static_cast<VrtNode4<kWriteLock> *>(node);
+        return ForEachSortedChild<kFour>(node4->edge, node4->childs, node4->child_cnt, visitor, from);
+      } break;
+      case Node8: {
+        auto *node8 = static_cast<VrtNode8<kWriteLock> *>(node);
+        return ForEachSortedChild<kEight>(node8->edge, node8->childs, node8->child_cnt, visitor, from);
+      } break;
+      case Node16: {
+        auto *node16 = static_cast<VrtNode16<kWriteLock> *>(node);
+        return ForEachSortedChild<kSixteen>(node16->edge, node16->childs, node16->child_cnt, visitor, from);
+      } break;
+      case Node32: {
+        auto *node32 = static_cast<VrtNode32<kWriteLock> *>(node);
+        return ForEachSortedChild<kThirtyTwo>(node32->edge, node32->childs, node32->child_cnt, visitor, from);
+      } break;
+      case Node48: {
+        auto *node48 = static_cast<VrtNode48<kWriteLock> *>(node);
+        for (size_t i = from; i < kTwoFiveSix; i++) {
+          if (auto index = node48->childs_index[i]; index != -1) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (!visitor(static_cast<char>(i), node48->childs[static_cast<uint8_t>(index)])) {
+              return false;
+            }
+          }
+        }
+      } break;
+      case Node256: {
+        auto *node256 = static_cast<VrtNode256<kWriteLock> *>(node);
+        for (size_t i = from; i < kTwoFiveSix; i++) {
+          if (VrtChildPtr<kWriteLock> child = node256->childs[i]; child != nullptr) {
+            if (!visitor(static_cast<char>(i), child)) {
+              return false;
+            }
+          }
+        }
+      } break;
+      case LeafNode:
+        break;
+      default:
+        assert(false);
+    }
+    return true;
+  }
+
+  // 扩容时kRelocate为true表示把node的值搬到新节点上，调用方需要用MarkValueRelocated回收node
+  template <class ValueType, bool kRelocate = false>
+  inline static VrtNode<kWriteLock> *AddChild(VrtNode<kWriteLock> *node, char edge, VrtChildPtr<kWriteLock> child) {
     switch (node->type) {
       case Node4: {
         auto *node4 = reinterpret_cast<VrtNode4<kWriteLock> *>(node);
@@ -235,20 +750,22 @@ class VrtNodeHelper {
           node4->child_cnt++;
           return node;
         }
-        VrtNode16<kWriteLock> *node16;
-        std::string_view key(node4->data, node4->key_length);
-        if (node4->has_value) {
-          auto *value_ptr = reinterpret_cast<ValueType *>(node4->data + node4->key_length);
-          node16 = reinterpret_cast<VrtNode16<kWriteLock> *>(CreateVrtNode<Node16, ValueType>(key, *value_ptr));
+        if constexpr (VrtNodeLadder::kFine == kLadder) {
+          return GrowLinearNode<ValueType, kRelocate, Node8, VrtNode8<kWriteLock>>(node4, edge, child);
         } else {
-          node16 = reinterpret_cast<VrtNode16<kWriteLock> *>(CreateVrtNodeWithoutValue<Node16>(key));
+          return GrowLinearNode<ValueType, kRelocate, Node16, VrtNode16<kWriteLock>>(node4, edge, child);
+        }
+      } break;
+      case Node8: {
+        auto *node8 = reinterpret_cast<VrtNode8<kWriteLock> *>(node);
+        if (node8->child_cnt < kEight) {
+          node8->edge[node8->child_cnt] = edge;
+          node8->childs[node8->child_cnt] = child;
+          std::atomic_thread_fence(std::memory_order_release);
+          node8->child_cnt++;
+          return node;
         }
-        memcpy(node16->edge, node4->edge, sizeof(node4->edge));
-        memcpy(node16->childs, node4->childs, sizeof(node4->childs));
-        node16->edge[kFour] = edge;
-        node16->childs[kFour] = child;
-        node16->child_cnt = kFour + 1;
-        return node16;
+        return GrowLinearNode<ValueType, kRelocate, Node16, VrtNode16<kWriteLock>>(node8, edge, child);
       } break;
       case Node16: {
         auto *node16 = reinterpret_cast<VrtNode16<kWriteLock> *>(node);
@@ -259,22 +776,22 @@ class VrtNodeHelper {
           node16->child_cnt++;
           return node;
         }
-        VrtNode48<kWriteLock> *node48;
-        std::string_view key(node16->data, node16->key_length);
-        if (node16->has_value) {
-          auto *value_ptr = reinterpret_cast<ValueType *>(node16->data + node16->key_length);
-          node48 = reinterpret_cast<VrtNode48<kWriteLock> *>(CreateVrtNode<Node48, ValueType>(key, *value_ptr));
+        if constexpr (VrtNodeLadder::kFine == kLadder) {
+          return GrowLinearNode<ValueType, kRelocate, Node32, VrtNode32<kWriteLock>>(node16, edge, child);
         } else {
-          node48 = reinterpret_cast<VrtNode48<kWriteLock> *>(CreateVrtNodeWithoutValue<Node48>(key));
+          return GrowToNode48<ValueType, kRelocate>(node16, edge, child);
         }
-        for (int i = 0; i < kSixteen; i++) {
-          node48->childs_index[static_cast<uint8_t>(node16->edge[i])] = i;
+      } break;
+      case Node32: {
+        auto *node32 = reinterpret_cast<VrtNode32<kWriteLock> *>(node);
+        if (node32->child_cnt < kThirtyTwo) {
+          node32->edge[node32->child_cnt] = edge;
+          node32->childs[node32->child_cnt] = child;
+          std::atomic_thread_fence(std::memory_order_release);
+          node32->child_cnt++;
+          return node;
         }
-        memcpy(node48->childs, node16->childs, sizeof(node16->childs));
-        node48->childs_index[static_cast<uint8_t>(edge)] = kSixteen;
-        node48->childs[kSixteen] = child;
-        node48->child_cnt = kSixteen + 1;
-        return node48;
+        return GrowToNode48<ValueType, kRelocate>(node32, edge, child);
       } break;
       case Node48: {
         auto *node48 = reinterpret_cast<VrtNode48<kWriteLock> *>(node);
@@ -289,8 +806,9 @@ class VrtNodeHelper {
         VrtNode256<kWriteLock> *node256;
         std::string_view key(node48->data, node48->key_length);
         if (node48->has_value) {
-          auto *value_ptr = reinterpret_cast<ValueType *>(node48->data + node48->key_length);
-          node256 = reinterpret_cast<VrtNode256<kWriteLock> *>(CreateVrtNode<Node256, ValueType>(key, *value_ptr));
+          auto *value_ptr = GetValueSlot<ValueType>(node48->data, node48->key_length);
+          node256 = reinterpret_cast<VrtNode256<kWriteLock> *>(
+              CreateVrtNode<Node256, ValueType>(key, TakeValue<ValueType, kRelocate>(value_ptr)));
         } else {
           node256 = reinterpret_cast<VrtNode256<kWriteLock> *>(CreateVrtNodeWithoutValue<Node256>(key));
         }
@@ -316,8 +834,9 @@ class VrtNodeHelper {
         std::string_view key(leaf_node->data, leaf_node->key_length);
         VrtNode4<kWriteLock> *node4;
         if (leaf_node->has_value) {
-          auto *value_ptr = reinterpret_cast<ValueType *>(leaf_node->data + leaf_node->key_length);
-          node4 = reinterpret_cast<VrtNode4<kWriteLock> *>(CreateVrtNode<Node4, ValueType>(key, *value_ptr));
+          auto *value_ptr = GetValueSlot<ValueType>(leaf_node->data, leaf_node->key_length);
+          node4 = reinterpret_cast<VrtNode4<kWriteLock> *>(
+              CreateVrtNode<Node4, ValueType>(key, TakeValue<ValueType, kRelocate>(value_ptr)));
         } else {
           node4 = reinterpret_cast<VrtNode4<kWriteLock> *>(CreateVrtNodeWithoutValue<Node4>(key));
         }
@@ -339,60 +858,82 @@ class VrtNodeHelper {
 #endif
     if constexpr (Node4 == node_type) {
       auto *new_node = reinterpret_cast<VrtNode4<kWriteLock> *>(
-          malloc(sizeof(VrtNode4<kWriteLock>) + key.length() + sizeof(ValueType)));
+          Allocator::Allocate(GetNodeSizeWithValue<VrtNode4<kWriteLock>, ValueType>(key.length())));
       new_node->type = Node4;
       new_node->has_value = 1;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-      new (&new_node->spin_lock) SpinLock();
+      ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+      new_node->InitLock();
+      return new_node;
+    } else if constexpr (Node8 == node_type) {
+      auto *new_node = reinterpret_cast<VrtNode8<kWriteLock> *>(
+          Allocator::Allocate(GetNodeSizeWithValue<VrtNode8<kWriteLock>, ValueType>(key.length())));
+      new_node->type = Node8;
+      new_node->has_value = 1;
+      new_node->key_length = key.length();
+      new_node->child_cnt = 0;
+      memcpy(new_node->data, key.data(), new_node->key_length);
+      ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+      new_node->InitLock();
       return new_node;
     } else if constexpr (Node16 == node_type) {
       auto *new_node = reinterpret_cast<VrtNode16<kWriteLock> *>(
-          malloc(sizeof(VrtNode16<kWriteLock>) + key.length() + sizeof(ValueType)));
+          Allocator::Allocate(GetNodeSizeWithValue<VrtNode16<kWriteLock>, ValueType>(key.length())));
       new_node->type = Node16;
       new_node->has_value = 1;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-      new (&new_node->spin_lock) SpinLock();
+      ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+      new_node->InitLock();
+      return new_node;
+    } else if constexpr (Node32 == node_type) {
+      auto *new_node = reinterpret_cast<VrtNode32<kWriteLock> *>(
+          Allocator::Allocate(GetNodeSizeWithValue<VrtNode32<kWriteLock>, ValueType>(key.length())));
+      new_node->type = Node32;
+      new_node->has_value = 1;
+      new_node->key_length = key.length();
+      new_node->child_cnt = 0;
+      memcpy(new_node->data, key.data(), new_node->key_length);
+      ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+      new_node->InitLock();
       return new_node;
     } else if constexpr (Node48 == node_type) {
       auto *new_node = reinterpret_cast<VrtNode48<kWriteLock> *>(
-          malloc(sizeof(VrtNode48<kWriteLock>) + key.length() + sizeof(ValueType)));
+          Allocator::Allocate(GetNodeSizeWithValue<VrtNode48<kWriteLock>, ValueType>(key.length())));
       memset(new_node->childs_index, -1, sizeof(new_node->childs_index));
       new_node->type = Node48;
       new_node->has_value = 1;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-      new (&new_node->spin_lock) SpinLock();
+      ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+      new_node->InitLock();
       return new_node;
     } else if constexpr (Node256 == node_type) {
       auto *new_node = reinterpret_cast<VrtNode256<kWriteLock> *>(
-          malloc(sizeof(VrtNode256<kWriteLock>) + key.length() + sizeof(ValueType)));
+          Allocator::Allocate(GetNodeSizeWithValue<VrtNode256<kWriteLock>, ValueType>(key.length())));
       memset(new_node->childs, 0, sizeof(new_node->childs));
       new_node->type = Node256;
       new_node->has_value = 1;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-      new (&new_node->spin_lock) SpinLock();
+      ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+      new_node->InitLock();
       return new_node;
     } else if constexpr (LeafNode == node_type) {
       auto *new_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(
-          malloc(sizeof(VrtLeafNode<kWriteLock>) + key.length() + sizeof(ValueType)));
+          Allocator::Allocate(GetNodeSizeWithValue<VrtLeafNode<kWriteLock>, ValueType>(key.length())));
       new_node->type = LeafNode;
       new_node->has_value = 1;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-      new (&new_node->spin_lock) SpinLock();
+      ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+      new_node->InitLock();
       return new_node;
     }
   }
@@ -403,67 +944,300 @@ class VrtNodeHelper {
     create_node_cnt++;
 #endif
     if constexpr (Node4 == node_type) {
-      auto *new_node = reinterpret_cast<VrtNode4<kWriteLock> *>(malloc(sizeof(VrtNode4<kWriteLock>) + key.length()));
+      auto *new_node = reinterpret_cast<VrtNode4<kWriteLock> *>(
+          Allocator::Allocate(sizeof(VrtNode4<kWriteLock>) + key.length()));
       new_node->type = Node4;
       new_node->has_value = 0;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (&new_node->spin_lock) SpinLock();
+      new_node->InitLock();
+      return new_node;
+    } else if constexpr (Node8 == node_type) {
+      auto *new_node = reinterpret_cast<VrtNode8<kWriteLock> *>(
+          Allocator::Allocate(sizeof(VrtNode8<kWriteLock>) + key.length()));
+      new_node->type = Node8;
+      new_node->has_value = 0;
+      new_node->key_length = key.length();
+      new_node->child_cnt = 0;
+      memcpy(new_node->data, key.data(), new_node->key_length);
+      new_node->InitLock();
       return new_node;
     } else if constexpr (Node16 == node_type) {
-      auto *new_node = reinterpret_cast<VrtNode16<kWriteLock> *>(malloc(sizeof(VrtNode16<kWriteLock>) + key.length()));
+      auto *new_node = reinterpret_cast<VrtNode16<kWriteLock> *>(
+          Allocator::Allocate(sizeof(VrtNode16<kWriteLock>) + key.length()));
       new_node->type = Node16;
       new_node->has_value = 0;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (&new_node->spin_lock) SpinLock();
+      new_node->InitLock();
+      return new_node;
+    } else if constexpr (Node32 == node_type) {
+      auto *new_node = reinterpret_cast<VrtNode32<kWriteLock> *>(
+          Allocator::Allocate(sizeof(VrtNode32<kWriteLock>) + key.length()));
+      new_node->type = Node32;
+      new_node->has_value = 0;
+      new_node->key_length = key.length();
+      new_node->child_cnt = 0;
+      memcpy(new_node->data, key.data(), new_node->key_length);
+      new_node->InitLock();
       return new_node;
     } else if constexpr (Node48 == node_type) {
-      auto *new_node = reinterpret_cast<VrtNode48<kWriteLock> *>(malloc(sizeof(VrtNode48<kWriteLock>) + key.length()));
+      auto *new_node = reinterpret_cast<VrtNode48<kWriteLock> *>(
+          Allocator::Allocate(sizeof(VrtNode48<kWriteLock>) + key.length()));
       new_node->type = Node48;
       memset(new_node->childs_index, -1, sizeof(new_node->childs_index));
       new_node->has_value = 0;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (&new_node->spin_lock) SpinLock();
+      new_node->InitLock();
       return new_node;
     } else if constexpr (Node256 == node_type) {
-      auto *new_node =
-          reinterpret_cast<VrtNode256<kWriteLock> *>(malloc(sizeof(VrtNode256<kWriteLock>) + key.length()));
+      auto *new_node = reinterpret_cast<VrtNode256<kWriteLock> *>(
+          Allocator::Allocate(sizeof(VrtNode256<kWriteLock>) + key.length()));
       new_node->type = Node256;
       memset(new_node->childs, 0, sizeof(new_node->childs));
       new_node->has_value = 0;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (&new_node->spin_lock) SpinLock();
+      new_node->InitLock();
       return new_node;
     } else if constexpr (LeafNode == node_type) {
-      auto *new_node =
-          reinterpret_cast<VrtLeafNode<kWriteLock> *>(malloc(sizeof(VrtLeafNode<kWriteLock>) + key.length()));
+      auto *new_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(
+          Allocator::Allocate(sizeof(VrtLeafNode<kWriteLock>) + key.length()));
       new_node->type = LeafNode;
       new_node->has_value = 0;
       new_node->key_length = key.length();
       new_node->child_cnt = 0;
       memcpy(new_node->data, key.data(), new_node->key_length);
-      new (&new_node->spin_lock) SpinLock();
+      new_node->InitLock();
       return new_node;
     }
   }
 
-  template <class ValueType>
+  // 能容纳child_cnt个子节点的最小节点类型
+  inline static VrtNodeType GetNodeTypeByChildCnt(size_t child_cnt) {
+    if (child_cnt == 0) {
+      return LeafNode;
+    }
+    if (child_cnt <= kFour) {
+      return Node4;
+    }
+    if (VrtNodeLadder::kFine == kLadder && child_cnt <= kEight) {
+      return Node8;
+    }
+    if (child_cnt <= kSixteen) {
+      return Node16;
+    }
+    if (VrtNodeLadder::kFine == kLadder && child_cnt <= kThirtyTwo) {
+      return Node32;
+    }
+    if (child_cnt <= kFortyEight) {
+      return Node48;
+    }
+    return Node256;
+  }
+
+  inline static size_t GetChildCapacity(VrtNode<kWriteLock> *node) {
+    switch (node->type) {
+      case Node4:
+        return kFour;
+      case Node8:
+        return kEight;
+      case Node16:
+        return kSixteen;
+      case Node32:
+        return kThirtyTwo;
+      case Node48:
+        return kFortyEight;
+      case Node256:
+        return kTwoFiveSix;
+      case LeafNode:
+        return 0;
+      default:
+        assert(false);
+    }
+    return 0;
+  }
+
+  template <class ValueType, class... Args>
+  inline static VrtNode<kWriteLock> *CreateVrtNodeByType(VrtNodeType node_type, std::string_view key, Args &&...args) {
+    switch (node_type) {
+      case Node4:
+        return CreateVrtNode<Node4, ValueType>(key, std::forward<Args>(args)...);
+      case Node8:
+        return CreateVrtNode<Node8, ValueType>(key, std::forward<Args>(args)...);
+      case Node16:
+        return CreateVrtNode<Node16, ValueType>(key, std::forward<Args>(args)...);
+      case Node32:
+        return CreateVrtNode<Node32, ValueType>(key, std::forward<Args>(args)...);
+      case Node48:
+        return CreateVrtNode<Node48, ValueType>(key, std::forward<Args>(args)...);
+      case Node256:
+        return CreateVrtNode<Node256, ValueType>(key, std::forward<Args>(args)...);
+      case LeafNode:
+        return CreateVrtNode<LeafNode, ValueType>(key, std::forward<Args>(args)...);
+      default:
+        assert(false);
+    }
+    return nullptr;
+  }
+
+  inline static VrtNode<kWriteLock> *CreateVrtNodeWithoutValueByType(VrtNodeType node_type, std::string_view key) {
+    switch (node_type) {
+      case Node4:
+        return CreateVrtNodeWithoutValue<Node4>(key);
+      case Node8:
+        return CreateVrtNodeWithoutValue<Node8>(key);
+      case Node16:
+        return CreateVrtNodeWithoutValue<Node16>(key);
+      case Node32:
+        return CreateVrtNodeWithoutValue<Node32>(key);
+      case Node48:
+        return CreateVrtNodeWithoutValue<Node48>(key);
+      case Node256:
+        return CreateVrtNodeWithoutValue<Node256>(key);
+      case LeafNode:
+        return CreateVrtNodeWithoutValue<LeafNode>(key);
+      default:
+        assert(false);
+    }
+    return nullptr;
+  }
+
+  // 把node复制到一个至少能容纳child_capacity个子节点的新节点上，一次复制完成多次AddChild才会触发的扩容。
+  // args非空时用args构造新的值，否则沿用node原来的值，kRelocate为true时把值搬过去。
+  template <class ValueType, bool kRelocate = false, class... Args>
+  inline static VrtNode<kWriteLock> *CreateVrtNodeByResize(VrtNode<kWriteLock> *node, size_t child_capacity,
+                                                           Args &&...args) {
+    auto node_type = GetNodeTypeByChildCnt(child_capacity);
+    auto key = GetKeyView(node);
+    VrtNode<kWriteLock> *new_node;
+    if constexpr (sizeof...(Args) > 0) {
+      new_node = CreateVrtNodeByType<ValueType>(node_type, key, std::forward<Args>(args)...);
+    } else {
+      if (node->has_value) {
+        new_node = CreateVrtNodeByType<ValueType>(node_type, key,
+                                                  TakeValue<ValueType, kRelocate>(GetValuePtr<ValueType>(node)));
+      } else {
+        new_node = CreateVrtNodeWithoutValueByType(node_type, key);
+      }
+    }
+    ForEachChild(node, [new_node](char edge, VrtChildPtr<kWriteLock> child) {
+      AddChild<ValueType>(new_node, edge, child);
+      return true;
+    });
+    return new_node;
+  }
+
+  // child_cnt只有8位，Node256有256个子节点时为0
+  inline static size_t GetChildCnt(VrtNode<kWriteLock> *node) {
+    if (Node256 == node->type && 0 == node->child_cnt) {
+      return kTwoFiveSix;
+    }
+    return node->child_cnt;
+  }
+
+  // 删除子节点后剩下child_cnt个子节点时node应该使用的类型
+  inline static VrtNodeType GetNodeTypeByShrink(VrtNode<kWriteLock> *node, size_t child_cnt) {
+    switch (node->type) {
+      case Node4:
+        return child_cnt == 0 ? LeafNode : Node4;
+      case Node8:
+        return child_cnt <= kNode8ShrinkCnt ? GetNodeTypeByChildCnt(child_cnt) : Node8;
+      case Node16: {
+        constexpr auto kShrinkCnt = VrtNodeLadder::kFine == kLadder ? kNode16FineShrinkCnt : kNode16ShrinkCnt;
+        return child_cnt <= kShrinkCnt ? GetNodeTypeByChildCnt(child_cnt) : Node16;
+      }
+      case Node32:
+        return child_cnt <= kNode32ShrinkCnt ? GetNodeTypeByChildCnt(child_cnt) : Node32;
+      case Node48: {
+        constexpr auto kShrinkCnt = VrtNodeLadder::kFine == kLadder ? kNode48FineShrinkCnt : kNode48ShrinkCnt;
+        return child_cnt <= kShrinkCnt ? GetNodeTypeByChildCnt(child_cnt) : Node48;
+      }
+      case Node256:
+        return child_cnt <= kNode256ShrinkCnt ? GetNodeTypeByChildCnt(child_cnt) : Node256;
+      case LeafNode:
+        return LeafNode;
+      default:
+        assert(false);
+    }
+    return LeafNode;
+  }
+
+  // 复制node到node_type类型的新节点上，去掉边为edge的子节点
+  template <class ValueType, bool kRelocate = false>
+  inline static VrtNode<kWriteLock> *CreateVrtNodeByRemoveChild(VrtNode<kWriteLock> *node, char edge,
+                                                                VrtNodeType node_type) {
+    auto key = GetKeyView(node);
+    VrtNode<kWriteLock> *new_node;
+    if (node->has_value) {
+      new_node =
+          CreateVrtNodeByType<ValueType>(node_type, key, TakeValue<ValueType, kRelocate>(GetValuePtr<ValueType>(node)));
+    } else {
+      new_node = CreateVrtNodeWithoutValueByType(node_type, key);
+    }
+    ForEachChild(node, [new_node, edge](char cur_edge, VrtChildPtr<kWriteLock> child) {
+      if (cur_edge != edge) {
+        AddChild<ValueType>(new_node, cur_edge, child);
+      }
+      return true;
+    });
+    return new_node;
+  }
+
+  // 只有Node256可以原地删除子节点，其他类型的子节点是紧凑存放的，原地删除会让并发的读看到错位的边和子节点
+  inline static void RemoveChildInPlace(VrtNode<kWriteLock> *node, char edge) {
+    assert(Node256 == node->type);
+    auto *node256 = static_cast<VrtNode256<kWriteLock> *>(node);
+    node256->childs[static_cast<uint8_t>(edge)] = nullptr;
+    node256->child_cnt--;
+  }
+
+  // 把没有值的parent和它唯一的子节点child合并，新节点的key为parent的key + edge + child的key，其余部分和child相同。
+  // child是InlineLeaf时合并成一个叶子节点。kRelocate为true时把child的值搬到新节点上。
+  template <class ValueType, bool kRelocate = false>
+  inline static VrtNode<kWriteLock> *CreateVrtNodeByMerge(VrtNode<kWriteLock> *parent, char edge,
+                                                          VrtChildPtr<kWriteLock> child) {
+    if (child.IsInline()) {
+      std::string key;
+      key.reserve(parent->key_length + 1);
+      key.append(GetKeyView(parent)).append(1, edge);
+      return CreateVrtNode<LeafNode, ValueType>(key, VrtInlineValue<ValueType>::Decode(child.GetPayload()));
+    }
+    std::string key;
+    key.reserve(parent->key_length + 1 + child->key_length);
+    key.append(GetKeyView(parent)).append(1, edge).append(GetKeyView(child));
+    auto node_type = static_cast<VrtNodeType>(child->type);
+    VrtNode<kWriteLock> *new_node;
+    if (child->has_value) {
+      new_node = CreateVrtNodeByType<ValueType>(node_type, key,
+                                                TakeValue<ValueType, kRelocate>(GetValuePtr<ValueType>(child)));
+    } else {
+      new_node = CreateVrtNodeWithoutValueByType(node_type, key);
+    }
+    ForEachChild(child, [new_node](char cur_edge, VrtChildPtr<kWriteLock> grandson) {
+      AddChild<ValueType>(new_node, cur_edge, grandson);
+      return true;
+    });
+    return new_node;
+  }
+
+  // kRelocate为true时把node的值搬到新节点上
+  template <class ValueType, bool kRelocate = false>
   inline static VrtNode<kWriteLock> *CreateVrtNodeByRemovePrefix(VrtNode<kWriteLock> *node, size_t remove_size) {
 #ifdef MEM_DEBUG
     create_node_cnt++;
 #endif
     switch (node->type) {
       case Node4: {
-        size_t new_node_size =
-            sizeof(VrtNode4<kWriteLock>) + node->key_length - remove_size + (node->has_value ? sizeof(ValueType) : 0);
-        VrtNode4<kWriteLock> *new_node = reinterpret_cast<VrtNode4<kWriteLock> *>(malloc(new_node_size));
+        size_t new_key_length = node->key_length - remove_size;
+        size_t new_node_size = node->has_value ? GetNodeSizeWithValue<VrtNode4<kWriteLock>, ValueType>(new_key_length)
+                                               : sizeof(VrtNode4<kWriteLock>) + new_key_length;
+        VrtNode4<kWriteLock> *new_node = reinterpret_cast<VrtNode4<kWriteLock> *>(Allocator::Allocate(new_node_size));
         auto *old_node = reinterpret_cast<VrtNode4<kWriteLock> *>(node);
         new_node->type = Node4;
         new_node->has_value = old_node->has_value;
@@ -473,16 +1247,39 @@ class VrtNodeHelper {
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data + remove_size, new_node->key_length);
         if (new_node->has_value) {
-          new (new_node->data + new_node->key_length)
-              ValueType(*reinterpret_cast<ValueType *>(old_node->data + old_node->key_length));
+          auto *old_value = GetValueSlot<ValueType>(old_node->data, old_node->key_length);
+          ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length),
+                         TakeValue<ValueType, kRelocate>(old_value));
+        }
+        new_node->InitLock();
+        return new_node;
+      } break;
+      case Node8: {
+        size_t new_key_length = node->key_length - remove_size;
+        size_t new_node_size = node->has_value ? GetNodeSizeWithValue<VrtNode8<kWriteLock>, ValueType>(new_key_length)
+                                               : sizeof(VrtNode8<kWriteLock>) + new_key_length;
+        VrtNode8<kWriteLock> *new_node = reinterpret_cast<VrtNode8<kWriteLock> *>(Allocator::Allocate(new_node_size));
+        auto *old_node = reinterpret_cast<VrtNode8<kWriteLock> *>(node);
+        new_node->type = Node8;
+        new_node->has_value = old_node->has_value;
+        new_node->key_length = old_node->key_length - remove_size;
+        new_node->child_cnt = old_node->child_cnt;
+        memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
+        memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
+        memcpy(new_node->data, old_node->data + remove_size, new_node->key_length);
+        if (new_node->has_value) {
+          auto *old_value = GetValueSlot<ValueType>(old_node->data, old_node->key_length);
+          ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length),
+                         TakeValue<ValueType, kRelocate>(old_value));
         }
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
         return new_node;
       } break;
       case Node16: {
-        size_t new_node_size =
-            sizeof(VrtNode16<kWriteLock>) + node->key_length - remove_size + (node->has_value ? sizeof(ValueType) : 0);
-        VrtNode16<kWriteLock> *new_node = reinterpret_cast<VrtNode16<kWriteLock> *>(malloc(new_node_size));
+        size_t new_key_length = node->key_length - remove_size;
+        size_t new_node_size = node->has_value ? GetNodeSizeWithValue<VrtNode16<kWriteLock>, ValueType>(new_key_length)
+                                               : sizeof(VrtNode16<kWriteLock>) + new_key_length;
+        VrtNode16<kWriteLock> *new_node = reinterpret_cast<VrtNode16<kWriteLock> *>(Allocator::Allocate(new_node_size));
         auto *old_node = reinterpret_cast<VrtNode16<kWriteLock> *>(node);
         new_node->type = Node16;
         new_node->has_value = old_node->has_value;
@@ -492,16 +1289,39 @@ class VrtNodeHelper {
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data + remove_size, new_node->key_length);
         if (new_node->has_value) {
-          new (new_node->data + new_node->key_length)
-              ValueType(*reinterpret_cast<ValueType *>(old_node->data + old_node->key_length));
+          auto *old_value = GetValueSlot<ValueType>(old_node->data, old_node->key_length);
+          ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length),
+                         TakeValue<ValueType, kRelocate>(old_value));
         }
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
+        return new_node;
+      } break;
+      case Node32: {
+        size_t new_key_length = node->key_length - remove_size;
+        size_t new_node_size = node->has_value ? GetNodeSizeWithValue<VrtNode32<kWriteLock>, ValueType>(new_key_length)
+                                               : sizeof(VrtNode32<kWriteLock>) + new_key_length;
+        VrtNode32<kWriteLock> *new_node = reinterpret_cast<VrtNode32<kWriteLock> *>(Allocator::Allocate(new_node_size));
+        auto *old_node = reinterpret_cast<VrtNode32<kWriteLock> *>(node);
+        new_node->type = Node32;
+        new_node->has_value = old_node->has_value;
+        new_node->key_length = old_node->key_length - remove_size;
+        new_node->child_cnt = old_node->child_cnt;
+        memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
+        memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
+        memcpy(new_node->data, old_node->data + remove_size, new_node->key_length);
+        if (new_node->has_value) {
+          auto *old_value = GetValueSlot<ValueType>(old_node->data, old_node->key_length);
+          ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length),
+                         TakeValue<ValueType, kRelocate>(old_value));
+        }
+        new_node->InitLock();
         return new_node;
       } break;
       case Node48: {
-        size_t new_node_size =
-            sizeof(VrtNode48<kWriteLock>) + node->key_length - remove_size + (node->has_value ? sizeof(ValueType) : 0);
-        VrtNode48<kWriteLock> *new_node = reinterpret_cast<VrtNode48<kWriteLock> *>(malloc(new_node_size));
+        size_t new_key_length = node->key_length - remove_size;
+        size_t new_node_size = node->has_value ? GetNodeSizeWithValue<VrtNode48<kWriteLock>, ValueType>(new_key_length)
+                                               : sizeof(VrtNode48<kWriteLock>) + new_key_length;
+        VrtNode48<kWriteLock> *new_node = reinterpret_cast<VrtNode48<kWriteLock> *>(Allocator::Allocate(new_node_size));
         auto *old_node = reinterpret_cast<VrtNode48<kWriteLock> *>(node);
         new_node->type = Node48;
         new_node->has_value = old_node->has_value;
@@ -511,16 +1331,19 @@ class VrtNodeHelper {
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data + remove_size, new_node->key_length);
         if (new_node->has_value) {
-          new (new_node->data + new_node->key_length)
-              ValueType(*reinterpret_cast<ValueType *>(old_node->data + old_node->key_length));
+          auto *old_value = GetValueSlot<ValueType>(old_node->data, old_node->key_length);
+          ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length),
+                         TakeValue<ValueType, kRelocate>(old_value));
         }
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
         return new_node;
       } break;
       case Node256: {
-        size_t new_node_size =
-            sizeof(VrtNode256<kWriteLock>) + node->key_length - remove_size + (node->has_value ? sizeof(ValueType) : 0);
-        VrtNode256<kWriteLock> *new_node = reinterpret_cast<VrtNode256<kWriteLock> *>(malloc(new_node_size));
+        size_t new_key_length = node->key_length - remove_size;
+        size_t new_node_size = node->has_value ? GetNodeSizeWithValue<VrtNode256<kWriteLock>, ValueType>(new_key_length)
+                                               : sizeof(VrtNode256<kWriteLock>) + new_key_length;
+        VrtNode256<kWriteLock> *new_node = reinterpret_cast<VrtNode256<kWriteLock> *>(
+            Allocator::Allocate(new_node_size));
         auto *old_node = reinterpret_cast<VrtNode256<kWriteLock> *>(node);
         new_node->type = Node256;
         new_node->has_value = old_node->has_value;
@@ -529,16 +1352,20 @@ class VrtNodeHelper {
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data + remove_size, new_node->key_length);
         if (new_node->has_value) {
-          new (new_node->data + new_node->key_length)
-              ValueType(*reinterpret_cast<ValueType *>(old_node->data + old_node->key_length));
+          auto *old_value = GetValueSlot<ValueType>(old_node->data, old_node->key_length);
+          ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length),
+                         TakeValue<ValueType, kRelocate>(old_value));
         }
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
         return new_node;
       } break;
       case LeafNode: {
-        size_t new_node_size = sizeof(VrtLeafNode<kWriteLock>) + node->key_length - remove_size +
-                               (node->has_value ? sizeof(ValueType) : 0);
-        VrtLeafNode<kWriteLock> *new_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(malloc(new_node_size));
+        size_t new_key_length = node->key_length - remove_size;
+        size_t new_node_size = node->has_value
+                                   ? GetNodeSizeWithValue<VrtLeafNode<kWriteLock>, ValueType>(new_key_length)
+                                   : sizeof(VrtLeafNode<kWriteLock>) + new_key_length;
+        VrtLeafNode<kWriteLock> *new_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(
+            Allocator::Allocate(new_node_size));
         auto *old_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(node);
         new_node->type = LeafNode;
         new_node->has_value = old_node->has_value;
@@ -546,10 +1373,11 @@ class VrtNodeHelper {
         new_node->child_cnt = old_node->child_cnt;
         memcpy(new_node->data, old_node->data + remove_size, new_node->key_length);
         if (new_node->has_value) {
-          new (new_node->data + new_node->key_length)
-              ValueType(*reinterpret_cast<ValueType *>(old_node->data + old_node->key_length));
+          auto *old_value = GetValueSlot<ValueType>(old_node->data, old_node->key_length);
+          ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length),
+                         TakeValue<ValueType, kRelocate>(old_value));
         }
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
         return new_node;
       } break;
       default:
@@ -568,7 +1396,7 @@ class VrtNodeHelper {
       case Node4: {
         auto *old_node = reinterpret_cast<VrtNode4<kWriteLock> *>(node);
         auto *new_node = reinterpret_cast<VrtNode4<kWriteLock> *>(
-            malloc(sizeof(VrtNode4<kWriteLock>) + old_node->key_length + sizeof(ValueType)));
+            Allocator::Allocate(GetNodeSizeWithValue<VrtNode4<kWriteLock>, ValueType>(old_node->key_length)));
         new_node->type = Node4;
         new_node->has_value = true;
         new_node->key_length = old_node->key_length;
@@ -576,14 +1404,29 @@ class VrtNodeHelper {
         memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-        new (&new_node->spin_lock) SpinLock();
+        ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+        new_node->InitLock();
+        return new_node;
+      } break;
+      case Node8: {
+        auto *old_node = reinterpret_cast<VrtNode8<kWriteLock> *>(node);
+        auto *new_node = reinterpret_cast<VrtNode8<kWriteLock> *>(
+            Allocator::Allocate(GetNodeSizeWithValue<VrtNode8<kWriteLock>, ValueType>(old_node->key_length)));
+        new_node->type = Node8;
+        new_node->has_value = true;
+        new_node->key_length = old_node->key_length;
+        new_node->child_cnt = old_node->child_cnt;
+        memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
+        memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
+        memcpy(new_node->data, old_node->data, old_node->key_length);
+        ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+        new_node->InitLock();
         return new_node;
       } break;
       case Node16: {
         auto *old_node = reinterpret_cast<VrtNode16<kWriteLock> *>(node);
         auto *new_node = reinterpret_cast<VrtNode16<kWriteLock> *>(
-            malloc(sizeof(VrtNode16<kWriteLock>) + old_node->key_length + sizeof(ValueType)));
+            Allocator::Allocate(GetNodeSizeWithValue<VrtNode16<kWriteLock>, ValueType>(old_node->key_length)));
         new_node->type = Node16;
         new_node->has_value = true;
         new_node->key_length = old_node->key_length;
@@ -591,14 +1434,29 @@ class VrtNodeHelper {
         memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-        new (&new_node->spin_lock) SpinLock();
+        ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+        new_node->InitLock();
+        return new_node;
+      } break;
+      case Node32: {
+        auto *old_node = reinterpret_cast<VrtNode32<kWriteLock> *>(node);
+        auto *new_node = reinterpret_cast<VrtNode32<kWriteLock> *>(
+            Allocator::Allocate(GetNodeSizeWithValue<VrtNode32<kWriteLock>, ValueType>(old_node->key_length)));
+        new_node->type = Node32;
+        new_node->has_value = true;
+        new_node->key_length = old_node->key_length;
+        new_node->child_cnt = old_node->child_cnt;
+        memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
+        memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
+        memcpy(new_node->data, old_node->data, old_node->key_length);
+        ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+        new_node->InitLock();
         return new_node;
       } break;
       case Node48: {
         auto *old_node = reinterpret_cast<VrtNode48<kWriteLock> *>(node);
         auto *new_node = reinterpret_cast<VrtNode48<kWriteLock> *>(
-            malloc(sizeof(VrtNode48<kWriteLock>) + old_node->key_length + sizeof(ValueType)));
+            Allocator::Allocate(GetNodeSizeWithValue<VrtNode48<kWriteLock>, ValueType>(old_node->key_length)));
         new_node->type = Node48;
         new_node->has_value = true;
         new_node->key_length = old_node->key_length;
@@ -606,35 +1464,35 @@ class VrtNodeHelper {
         memcpy(new_node->childs_index, old_node->childs_index, sizeof(new_node->childs_index));
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-        new (&new_node->spin_lock) SpinLock();
+        ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+        new_node->InitLock();
         return new_node;
       } break;
       case Node256: {
         auto *old_node = reinterpret_cast<VrtNode256<kWriteLock> *>(node);
         auto *new_node = reinterpret_cast<VrtNode256<kWriteLock> *>(
-            malloc(sizeof(VrtNode256<kWriteLock>) + old_node->key_length + sizeof(ValueType)));
+            Allocator::Allocate(GetNodeSizeWithValue<VrtNode256<kWriteLock>, ValueType>(old_node->key_length)));
         new_node->type = Node256;
         new_node->has_value = true;
         new_node->key_length = old_node->key_length;
         new_node->child_cnt = old_node->child_cnt;
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-        new (&new_node->spin_lock) SpinLock();
+        ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+        new_node->InitLock();
         return new_node;
       } break;
       case LeafNode: {
         auto *old_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(node);
         auto *new_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(
-            malloc(sizeof(VrtLeafNode<kWriteLock>) + old_node->key_length + sizeof(ValueType)));
+            Allocator::Allocate(GetNodeSizeWithValue<VrtLeafNode<kWriteLock>, ValueType>(old_node->key_length)));
         new_node->type = LeafNode;
         new_node->has_value = true;
         new_node->key_length = old_node->key_length;
         new_node->child_cnt = old_node->child_cnt;
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (new_node->data + new_node->key_length) ValueType(std::forward<Args>(args)...);
-        new (&new_node->spin_lock) SpinLock();
+        ConstructValue(GetValueSlot<ValueType>(new_node->data, new_node->key_length), std::forward<Args>(args)...);
+        new_node->InitLock();
         return new_node;
       } break;
       default:
@@ -651,8 +1509,8 @@ class VrtNodeHelper {
     switch (node->type) {
       case Node4: {
         auto *old_node = reinterpret_cast<VrtNode4<kWriteLock> *>(node);
-        auto *new_node =
-            reinterpret_cast<VrtNode4<kWriteLock> *>(malloc(sizeof(VrtNode4<kWriteLock>) + old_node->key_length));
+        auto *new_node = reinterpret_cast<VrtNode4<kWriteLock> *>(
+            Allocator::Allocate(sizeof(VrtNode4<kWriteLock>) + old_node->key_length));
         new_node->type = Node4;
         new_node->has_value = false;
         new_node->key_length = old_node->key_length;
@@ -660,13 +1518,27 @@ class VrtNodeHelper {
         memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
+        return new_node;
+      } break;
+      case Node8: {
+        auto *old_node = reinterpret_cast<VrtNode8<kWriteLock> *>(node);
+        auto *new_node = reinterpret_cast<VrtNode8<kWriteLock> *>(
+            Allocator::Allocate(sizeof(VrtNode8<kWriteLock>) + old_node->key_length));
+        new_node->type = Node8;
+        new_node->has_value = false;
+        new_node->key_length = old_node->key_length;
+        new_node->child_cnt = old_node->child_cnt;
+        memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
+        memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
+        memcpy(new_node->data, old_node->data, old_node->key_length);
+        new_node->InitLock();
         return new_node;
       } break;
       case Node16: {
         auto *old_node = reinterpret_cast<VrtNode16<kWriteLock> *>(node);
-        auto *new_node =
-            reinterpret_cast<VrtNode16<kWriteLock> *>(malloc(sizeof(VrtNode16<kWriteLock>) + old_node->key_length));
+        auto *new_node = reinterpret_cast<VrtNode16<kWriteLock> *>(
+            Allocator::Allocate(sizeof(VrtNode16<kWriteLock>) + old_node->key_length));
         new_node->type = Node16;
         new_node->has_value = false;
         new_node->key_length = old_node->key_length;
@@ -674,13 +1546,27 @@ class VrtNodeHelper {
         memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
+        return new_node;
+      } break;
+      case Node32: {
+        auto *old_node = reinterpret_cast<VrtNode32<kWriteLock> *>(node);
+        auto *new_node = reinterpret_cast<VrtNode32<kWriteLock> *>(
+            Allocator::Allocate(sizeof(VrtNode32<kWriteLock>) + old_node->key_length));
+        new_node->type = Node32;
+        new_node->has_value = false;
+        new_node->key_length = old_node->key_length;
+        new_node->child_cnt = old_node->child_cnt;
+        memcpy(new_node->edge, old_node->edge, sizeof(new_node->edge));
+        memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
+        memcpy(new_node->data, old_node->data, old_node->key_length);
+        new_node->InitLock();
         return new_node;
       } break;
       case Node48: {
         auto *old_node = reinterpret_cast<VrtNode48<kWriteLock> *>(node);
-        auto *new_node =
-            reinterpret_cast<VrtNode48<kWriteLock> *>(malloc(sizeof(VrtNode48<kWriteLock>) + old_node->key_length));
+        auto *new_node = reinterpret_cast<VrtNode48<kWriteLock> *>(
+            Allocator::Allocate(sizeof(VrtNode48<kWriteLock>) + old_node->key_length));
         new_node->type = Node48;
         new_node->has_value = false;
         new_node->key_length = old_node->key_length;
@@ -688,32 +1574,32 @@ class VrtNodeHelper {
         memcpy(new_node->childs_index, old_node->childs_index, sizeof(new_node->childs_index));
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
         return new_node;
       } break;
       case Node256: {
         auto *old_node = reinterpret_cast<VrtNode256<kWriteLock> *>(node);
-        auto *new_node =
-            reinterpret_cast<VrtNode256<kWriteLock> *>(malloc(sizeof(VrtNode256<kWriteLock>) + old_node->key_length));
+        auto *new_node = reinterpret_cast<VrtNode256<kWriteLock> *>(
+            Allocator::Allocate(sizeof(VrtNode256<kWriteLock>) + old_node->key_length));
         new_node->type = Node256;
         new_node->has_value = false;
         new_node->key_length = old_node->key_length;
         new_node->child_cnt = old_node->child_cnt;
         memcpy(new_node->childs, old_node->childs, sizeof(new_node->childs));
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
         return new_node;
       } break;
       case LeafNode: {
         auto *old_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(node);
-        auto *new_node =
-            reinterpret_cast<VrtLeafNode<kWriteLock> *>(malloc(sizeof(VrtLeafNode<kWriteLock>) + old_node->key_length));
+        auto *new_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(
+            Allocator::Allocate(sizeof(VrtLeafNode<kWriteLock>) + old_node->key_length));
         new_node->type = LeafNode;
         new_node->has_value = false;
         new_node->key_length = old_node->key_length;
         new_node->child_cnt = old_node->child_cnt;
         memcpy(new_node->data, old_node->data, old_node->key_length);
-        new (&new_node->spin_lock) SpinLock();
+        new_node->InitLock();
         return new_node;
       } break;
       default:
@@ -722,56 +1608,75 @@ class VrtNodeHelper {
     return nullptr;
   }
 
+  // destroy_value为false时值已经被搬到其他节点上，只释放节点
   template <class ValueType>
-  inline static void DestroyNode(VrtNode<kWriteLock> *node) {
+  inline static void DestroyNode(VrtNode<kWriteLock> *node, bool destroy_value = true) {
 #ifdef MEM_DEBUG
     destroy_node_cnt++;
 #endif
     switch (node->type) {
       case Node4: {
         auto *real_node = reinterpret_cast<VrtNode4<kWriteLock> *>(node);
-        if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+        if (node->has_value && destroy_value) {
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
+          value->~ValueType();
+        }
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
+      } break;
+      case Node8: {
+        auto *real_node = reinterpret_cast<VrtNode8<kWriteLock> *>(node);
+        if (node->has_value && destroy_value) {
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       case Node16: {
         auto *real_node = reinterpret_cast<VrtNode16<kWriteLock> *>(node);
-        if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+        if (node->has_value && destroy_value) {
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
+          value->~ValueType();
+        }
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
+      } break;
+      case Node32: {
+        auto *real_node = reinterpret_cast<VrtNode32<kWriteLock> *>(node);
+        if (node->has_value && destroy_value) {
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       case Node48: {
         auto *real_node = reinterpret_cast<VrtNode48<kWriteLock> *>(node);
-        if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+        if (node->has_value && destroy_value) {
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       case Node256: {
         auto *real_node = reinterpret_cast<VrtNode256<kWriteLock> *>(node);
-        if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+        if (node->has_value && destroy_value) {
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       case LeafNode: {
         auto *real_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(node);
-        if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+        if (node->has_value && destroy_value) {
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       default:
         assert(false);
@@ -779,7 +1684,11 @@ class VrtNodeHelper {
   }
 
   template <class ValueType>
-  inline static void DestroyTree(VrtNode<kWriteLock> *node) {
+  inline static void DestroyTree(VrtChildPtr<kWriteLock> ptr) {
+    if (ptr.IsInline()) {
+      return;
+    }
+    VrtNode<kWriteLock> *node = ptr;
 #ifdef MEM_DEBUG
     destroy_node_cnt++;
 #endif
@@ -790,11 +1699,23 @@ class VrtNodeHelper {
           DestroyTree<ValueType>(real_node->childs[i]);
         }
         if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
+          value->~ValueType();
+        }
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
+      } break;
+      case Node8: {
+        auto *real_node = reinterpret_cast<VrtNode8<kWriteLock> *>(node);
+        for (int i = 0; i < real_node->child_cnt; i++) {
+          DestroyTree<ValueType>(real_node->childs[i]);
+        }
+        if (node->has_value) {
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       case Node16: {
         auto *real_node = reinterpret_cast<VrtNode16<kWriteLock> *>(node);
@@ -802,11 +1723,23 @@ class VrtNodeHelper {
           DestroyTree<ValueType>(real_node->childs[i]);
         }
         if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
+      } break;
+      case Node32: {
+        auto *real_node = reinterpret_cast<VrtNode32<kWriteLock> *>(node);
+        for (int i = 0; i < real_node->child_cnt; i++) {
+          DestroyTree<ValueType>(real_node->childs[i]);
+        }
+        if (node->has_value) {
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
+          value->~ValueType();
+        }
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       case Node48: {
         auto *real_node = reinterpret_cast<VrtNode48<kWriteLock> *>(node);
@@ -814,11 +1747,11 @@ class VrtNodeHelper {
           DestroyTree<ValueType>(real_node->childs[i]);
         }
         if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       case Node256: {
         auto *real_node = reinterpret_cast<VrtNode256<kWriteLock> *>(node);
@@ -829,20 +1762,20 @@ class VrtNodeHelper {
           DestroyTree<ValueType>(real_node->childs[i]);
         }
         if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       case LeafNode: {
         auto *real_node = reinterpret_cast<VrtLeafNode<kWriteLock> *>(node);
         if (node->has_value) {
-          auto *value = reinterpret_cast<ValueType *>(real_node->data + real_node->key_length);
+          auto *value = GetValueSlot<ValueType>(real_node->data, real_node->key_length);
           value->~ValueType();
         }
-        real_node->spin_lock.~SpinLock();
-        free(real_node);
+        real_node->DestroyLock();
+        Allocator::Deallocate(real_node, GetNodeSize<ValueType>(node));
       } break;
       default:
         assert(false);
@@ -855,32 +1788,115 @@ class VrtNodeHelper {
 #endif
 
  private:
-  static VrtNode<kWriteLock> *kVrtNodeNullObject;
+  // 已满的线性节点(Node4/Node8/Node16)复制到更大的线性节点NewNode上，再追加edge对应的子节点
+  template <class ValueType, bool kRelocate, VrtNodeType new_type, class NewNode, class OldNode>
+  inline static VrtNode<kWriteLock> *GrowLinearNode(OldNode *old_node, char edge, VrtChildPtr<kWriteLock> child) {
+    constexpr size_t kOldCapacity = sizeof(old_node->edge);
+    NewNode *new_node;
+    std::string_view key(old_node->data, old_node->key_length);
+    if (old_node->has_value) {
+      auto *value_ptr = GetValueSlot<ValueType>(old_node->data, old_node->key_length);
+      new_node = reinterpret_cast<NewNode *>(
+          CreateVrtNode<new_type, ValueType>(key, TakeValue<ValueType, kRelocate>(value_ptr)));
+    } else {
+      new_node = reinterpret_cast<NewNode *>(CreateVrtNodeWithoutValue<new_type>(key));
+    }
+    memcpy(new_node->edge, old_node->edge, sizeof(old_node->edge));
+    memcpy(new_node->childs, old_node->childs, sizeof(old_node->childs));
+    new_node->edge[kOldCapacity] = edge;
+    new_node->childs[kOldCapacity] = child;
+    new_node->child_cnt = kOldCapacity + 1;
+    return new_node;
+  }
+
+  // 已满的Node16/Node32复制到Node48上，再追加edge对应的子节点
+  template <class ValueType, bool kRelocate, class OldNode>
+  inline static VrtNode<kWriteLock> *GrowToNode48(OldNode *old_node, char edge, VrtChildPtr<kWriteLock> child) {
+    constexpr size_t kOldCapacity = sizeof(old_node->edge);
+    VrtNode48<kWriteLock> *node48;
+    std::string_view key(old_node->data, old_node->key_length);
+    if (old_node->has_value) {
+      auto *value_ptr = GetValueSlot<ValueType>(old_node->data, old_node->key_length);
+      node48 = reinterpret_cast<VrtNode48<kWriteLock> *>(
+          CreateVrtNode<Node48, ValueType>(key, TakeValue<ValueType, kRelocate>(value_ptr)));
+    } else {
+      node48 = reinterpret_cast<VrtNode48<kWriteLock> *>(CreateVrtNodeWithoutValue<Node48>(key));
+    }
+    for (size_t i = 0; i < kOldCapacity; i++) {
+      node48->childs_index[static_cast<uint8_t>(old_node->edge[i])] = i;
+    }
+    memcpy(node48->childs, old_node->childs, sizeof(old_node->childs));
+    node48->childs_index[static_cast<uint8_t>(edge)] = kOldCapacity;
+    node48->childs[kOldCapacity] = child;
+    node48->child_cnt = kOldCapacity + 1;
+    return node48;
+  }
+
+  template <size_t kSize, class Visitor>
+  inline static bool ForEachSortedChild(char *edge, VrtChildPtr<kWriteLock> *childs, uint32_t child_cnt,
+                                        Visitor &visitor, uint8_t from) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint8_t sorted_edge[kSize];
+    uint8_t sorted_index[kSize];
+    uint32_t cnt = 0;
+    for (uint32_t i = 0; i < child_cnt; i++) {
+      auto cur_edge = static_cast<uint8_t>(edge[i]);
+      if (cur_edge < from) {
+        continue;
+      }
+      uint32_t pos = cnt++;
+      for (; pos > 0 && sorted_edge[pos - 1] > cur_edge; pos--) {
+        sorted_edge[pos] = sorted_edge[pos - 1];
+        sorted_index[pos] = sorted_index[pos - 1];
+      }
+      sorted_edge[pos] = cur_edge;
+      sorted_index[pos] = i;
+    }
+    for (uint32_t i = 0; i < cnt; i++) {
+      if (!visitor(static_cast<char>(sorted_edge[i]), childs[sorted_index[i]])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static VrtChildPtr<kWriteLock> kVrtNodeNullObject;
 #ifdef MEM_DEBUG
   static uint32_t create_node_cnt;
   static uint32_t destroy_node_cnt;
 #endif
 };
 
-template <class ValueType, bool kWriteLock = true>
+template <class ValueType, bool kWriteLock = true, class Allocator = MallocAllocator,
+          VrtNodeLadder kLadder = VrtNodeLadder::kDefault>
 class VrtNodeDestroy {
  public:
   VrtNodeDestroy() = delete;
-  VrtNodeDestroy(VrtNode<kWriteLock> *node) { VrtNodeHelper<kWriteLock>::template DestroyNode<ValueType>(node); }
+  VrtNodeDestroy(VrtNode<kWriteLock> *node) {
+    using NodeHelper = VrtNodeHelper<kWriteLock, Allocator, kLadder>;
+    if constexpr (VrtIsValueBox<ValueType>::value) {
+      if (NodeHelper::IsValueBox(node)) {
+        ValueType::Release(NodeHelper::ClearValueBox(node));
+        return;
+      }
+    }
+    NodeHelper::template DestroyNode<ValueType>(NodeHelper::ClearValueRelocated(node),
+                                                !NodeHelper::IsValueRelocated(node));
+  }
   VrtNodeDestroy(const VrtNodeDestroy &) = delete;
   VrtNodeDestroy &operator=(const VrtNodeDestroy &) = delete;
   VrtNodeDestroy(VrtNodeDestroy &&) = delete;
 };
 
-template <bool kWriteLock>
-VrtNode<kWriteLock> *VrtNodeHelper<kWriteLock>::kVrtNodeNullObject{nullptr};
+template <bool kWriteLock, class Allocator, VrtNodeLadder kLadder>
+VrtChildPtr<kWriteLock> VrtNodeHelper<kWriteLock, Allocator, kLadder>::kVrtNodeNullObject{nullptr};
 
 #ifdef MEM_DEBUG
-template <bool kWriteLock>
-uint32_t VrtNodeHelper<kWriteLock>::create_node_cnt{0};
+template <bool kWriteLock, class Allocator, VrtNodeLadder kLadder>
+uint32_t VrtNodeHelper<kWriteLock, Allocator, kLadder>::create_node_cnt{0};
 
-template <bool kWriteLock>
-uint32_t VrtNodeHelper<kWriteLock>::destroy_node_cnt{0};
+template <bool kWriteLock, class Allocator, VrtNodeLadder kLadder>
+uint32_t VrtNodeHelper<kWriteLock, Allocator, kLadder>::destroy_node_cnt{0};
 #endif
 
 }  // namespace vrt
\ No newline at end of file
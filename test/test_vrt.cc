@@ -5,8 +5,13 @@
  * @Last Modified time: 2024-04-05 19:02:02 
  */
 #include <array>
+#include <atomic>
+#include <map>
 #include <random>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "vrt.h"
 #include "gtest/gtest.h"
@@ -74,6 +79,87 @@ TEST(ErrTest, ErrDeleteTest) {
   }
 }
 
+TEST(NormalDeleteTest, ChurnTest) {
+  constexpr uint32_t kOpCnt = 200000;
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  // 字符集中包含256种字符，让各种类型的节点都会出现并被缩容
+  std::uniform_int_distribution<int> len_distrib(1, 4);
+  std::uniform_int_distribution<int> char_distrib(-128, 127);
+  std::uniform_int_distribution<int> narrow_distrib(0, 3);
+  vrt::Vrt<uint32_t, true, 1> vrt_tree;
+  std::map<std::string, uint32_t> expect;
+  auto check = [&vrt_tree, &expect]() {
+    auto iter = expect.begin();
+    EXPECT_EQ(vrt_tree.Scan("", "", [&iter](std::string_view key, const uint32_t &value) {
+      EXPECT_EQ(key, iter->first);
+      EXPECT_EQ(value, iter->second);
+      ++iter;
+      return true;
+    }), expect.size());
+  };
+  for (uint32_t i = 0; i < kOpCnt; i++) {
+    std::string key(len_distrib(gen), 0);
+    for (size_t j = 0; j < key.length(); j++) {
+      key[j] = j == 0 ? char_distrib(gen) : narrow_distrib(gen);
+    }
+    // 前半段插入多于删除，后半段删除多于插入
+    if (narrow_distrib(gen) < (i < kOpCnt / 2 ? 3 : 1)) {
+      EXPECT_EQ(vrt_tree.Upsert(key, i), true);
+      expect[key] = i;
+    } else {
+      EXPECT_EQ(vrt_tree.Delete(key), expect.erase(key) > 0);
+    }
+    if (i % (kOpCnt / 10) == 0) {
+      check();
+    }
+  }
+  check();
+  for (auto &[key, value] : expect) {
+    EXPECT_EQ(vrt_tree.Delete(key), true);
+  }
+  uint32_t value;
+  EXPECT_EQ(vrt_tree.Scan("", "", [](std::string_view, const uint32_t &) { return true; }), 0);
+  EXPECT_EQ(vrt_tree.Find(expect.begin()->first, &value), false);
+  EXPECT_EQ(vrt_tree.Insert(expect.begin()->first, nullptr, 1), true);
+}
+
+TEST(NormalDeleteTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 2;
+  constexpr uint32_t kMaxKey = 2000;
+  vrt::Vrt<uint32_t, true, kThreadNum + 2> vrt_tree;
+  // 偶数key一直存在，写线程反复插入删除奇数key，触发节点的扩缩容和合并
+  for (uint32_t i = 0; i < kMaxKey; i += 2) {
+    vrt_tree.Insert(std::to_string(i), nullptr, i);
+  }
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t < kThreadNum; t++) {
+    writers.emplace_back([&vrt_tree, &stop, t]() {
+      while (!stop.load()) {
+        for (uint32_t i = 1 + t * 2; i < kMaxKey; i += kThreadNum * 2) {
+          vrt_tree.Insert(std::to_string(i), nullptr, i);
+        }
+        for (uint32_t i = 1 + t * 2; i < kMaxKey; i += kThreadNum * 2) {
+          EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+        }
+      }
+    });
+  }
+  for (int round = 0; round < 20; round++) {
+    for (uint32_t i = 0; i < kMaxKey; i += 2) {
+      uint32_t value = 0;
+      EXPECT_EQ(vrt_tree.Find(std::to_string(i), &value), true);
+      EXPECT_EQ(value, i);
+    }
+  }
+  stop.store(true);
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  EXPECT_EQ(vrt_tree.Scan("", "", [](std::string_view key, const uint32_t &) { return true; }), kMaxKey / 2);
+}
+
 TEST(RandomTest, RandomTest) {
   // TODO优化，没有解决key冲突的情况，但这个范围一般来说不会冲突
   constexpr uint32_t kMaxKeyLength = 20;
@@ -138,6 +224,1594 @@ TEST(RandomTest, RandomTest) {
   }
 }
 
+TEST(SlabPolicyTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 4;
+  constexpr uint32_t kMaxKey = 100000;
+  vrt::Vrt<std::string, true, kThreadNum + 1, vrt::VrtSlabPolicy> vrt_tree;
+  // 每个线程写自己的key，删除一半，节点在线程之间通过EBR和slab仓库交叉释放和复用
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kThreadNum; t++) {
+    threads.emplace_back([&vrt_tree, t]() {
+      for (uint32_t i = t; i < kMaxKey; i += kThreadNum) {
+        EXPECT_EQ(vrt_tree.Insert(std::to_string(i), nullptr, std::to_string(i)), true);
+      }
+      for (uint32_t i = t; i < kMaxKey; i += kThreadNum) {
+        EXPECT_EQ(vrt_tree.Upsert(std::to_string(i), std::to_string(i * 2)), true);
+      }
+      for (uint32_t i = t; i < kMaxKey; i += kThreadNum * 2) {
+        EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    std::string value;
+    bool deleted = i % (kThreadNum * 2) < kThreadNum;
+    EXPECT_EQ(vrt_tree.Find(std::to_string(i), &value), !deleted);
+    if (!deleted) {
+      EXPECT_EQ(value, std::to_string(i * 2));
+    }
+  }
+}
+
+TEST(InlineLeafTest, RandomTest) {
+  constexpr uint32_t kOpCnt = 100000;
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  // key很短并且互为前缀，大量叶子的key剩余部分为空，超出61位的值退回到叶子节点
+  std::uniform_int_distribution<int> len_distrib(1, 3);
+  std::uniform_int_distribution<int> char_distrib(0, 5);
+  std::uniform_int_distribution<int> op_distrib(0, 7);
+  std::uniform_int_distribution<int64_t> value_distrib(INT64_MIN, INT64_MAX);
+  vrt::Vrt<int64_t, true, 1, vrt::VrtInlineLeafPolicy> vrt_tree;
+  std::map<std::string, int64_t> expect;
+  auto random_value = [&]() {
+    auto value = value_distrib(gen);
+    return char_distrib(gen) == 0 ? value : value >> 8;
+  };
+  auto check = [&vrt_tree, &expect]() {
+    auto iter = expect.begin();
+    EXPECT_EQ(vrt_tree.Scan("", "", [&iter](std::string_view key, const int64_t &value) {
+      EXPECT_EQ(key, iter->first);
+      EXPECT_EQ(value, iter->second);
+      ++iter;
+      return true;
+    }), expect.size());
+    for (auto &[key, value] : expect) {
+      int64_t find_value;
+      EXPECT_EQ(vrt_tree.Find(key, &find_value), true);
+      EXPECT_EQ(find_value, value);
+      size_t matched_length;
+      EXPECT_EQ(vrt_tree.FindLongestPrefix(key + "\x01", &find_value, &matched_length), true);
+      EXPECT_EQ(matched_length, key.length());
+      EXPECT_EQ(find_value, value);
+    }
+  };
+  for (uint32_t i = 0; i < kOpCnt; i++) {
+    std::string key(len_distrib(gen), 0);
+    for (auto &ch : key) {
+      ch = 'a' + char_distrib(gen);
+    }
+    auto value = random_value();
+    auto iter = expect.find(key);
+    switch (op_distrib(gen)) {
+      case 0: {
+        int64_t old_value;
+        EXPECT_EQ(vrt_tree.Insert(key, &old_value, value), iter == expect.end());
+        if (iter == expect.end()) {
+          expect[key] = value;
+        } else {
+          EXPECT_EQ(old_value, iter->second);
+        }
+      } break;
+      case 1:
+      case 2:
+        EXPECT_EQ(vrt_tree.Upsert(key, value), true);
+        expect[key] = value;
+        break;
+      case 3:
+        EXPECT_EQ(vrt_tree.Update(key, value), iter != expect.end());
+        if (iter != expect.end()) {
+          iter->second = value;
+        }
+        break;
+      case 4:
+        EXPECT_EQ(vrt_tree.FetchAdd(key, 1), iter != expect.end());
+        if (iter != expect.end()) {
+          iter->second = static_cast<int64_t>(static_cast<uint64_t>(iter->second) + 1);
+        }
+        break;
+      case 5:
+        EXPECT_EQ(vrt_tree.Merge(key, value, [](int64_t old_value, int64_t delta) { return old_value ^ delta; }),
+                  true);
+        expect[key] = iter == expect.end() ? value : iter->second ^ value;
+        break;
+      default:
+        EXPECT_EQ(vrt_tree.Delete(key), iter != expect.end());
+        if (iter != expect.end()) {
+          expect.erase(iter);
+        }
+    }
+    if (i % (kOpCnt / 10) == 0) {
+      check();
+    }
+  }
+  check();
+  std::vector<int64_t> prefix_values;
+  vrt_tree.ForEachPrefix("a", [&prefix_values](std::string_view, const int64_t &value) {
+    prefix_values.push_back(value);
+    return true;
+  });
+  std::vector<int64_t> expect_prefix_values;
+  for (auto iter = expect.lower_bound("a"); iter != expect.end() && iter->first[0] == 'a'; ++iter) {
+    expect_prefix_values.push_back(iter->second);
+  }
+  EXPECT_EQ(prefix_values, expect_prefix_values);
+  // 快照中的值不受之后写入的影响
+  auto snapshot = vrt_tree.Snapshot();
+  std::vector<std::pair<std::string_view, int64_t>> kvs;
+  for (auto &[key, value] : expect) {
+    kvs.emplace_back(key, value ^ 1);
+  }
+  EXPECT_EQ(vrt_tree.MultiUpsert(&kvs, true), expect.size());
+  for (auto &[key, value] : expect) {
+    int64_t find_value;
+    EXPECT_EQ(snapshot.Find(key, &find_value), true);
+    EXPECT_EQ(find_value, value);
+    EXPECT_EQ(vrt_tree.Find(key, &find_value), true);
+    EXPECT_EQ(find_value, value ^ 1);
+  }
+}
+
+// 记录复制次数的大值
+struct CopyCountedValue {
+  static inline std::atomic<uint32_t> copy_cnt{0};
+  CopyCountedValue(uint32_t id) : id(id) {}
+  CopyCountedValue(const CopyCountedValue &other) : id(other.id) { copy_cnt++; }
+  CopyCountedValue &operator=(const CopyCountedValue &other) = default;
+  uint32_t id;
+  char payload[1024];
+};
+
+TEST(BoxedValueTest, RandomTest) {
+  constexpr uint32_t kMaxKey = 20000;
+  vrt::Vrt<CopyCountedValue, true, 1, vrt::VrtBoxedValuePolicy> vrt_tree;
+  std::mt19937 gen(std::random_device{}());
+  std::map<std::string, uint32_t> expect;
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    auto key = std::to_string(gen() % kMaxKey);
+    EXPECT_EQ(vrt_tree.Insert(key, nullptr, i), expect.emplace(key, i).second);
+  }
+  // 结构修改只复制指针，不复制值
+  EXPECT_EQ(CopyCountedValue::copy_cnt.load(), 0);
+  auto snapshot = vrt_tree.Snapshot();
+  auto snapshot_expect = expect;
+  for (uint32_t i = 0; i < kMaxKey; i += 3) {
+    auto key = std::to_string(i);
+    EXPECT_EQ(vrt_tree.Delete(key), expect.erase(key) > 0);
+  }
+  for (uint32_t i = 0; i < kMaxKey; i += 2) {
+    auto key = std::to_string(i);
+    EXPECT_EQ(vrt_tree.Upsert(key, i + kMaxKey), true);
+    expect[key] = i + kMaxKey;
+  }
+  EXPECT_EQ(CopyCountedValue::copy_cnt.load(), 0);
+  auto iter = expect.begin();
+  EXPECT_EQ(vrt_tree.Scan("", "", [&iter](std::string_view key, const CopyCountedValue &value) {
+    EXPECT_EQ(key, iter->first);
+    EXPECT_EQ(value.id, iter->second);
+    ++iter;
+    return true;
+  }), expect.size());
+  for (auto &[key, id] : expect) {
+    EXPECT_EQ(vrt_tree.FindAndApply(key, [id = id](const CopyCountedValue &value) { EXPECT_EQ(value.id, id); }),
+              true);
+  }
+  // 快照中的节点和新树共享没有修改过的值，快照看到的仍然是修改前的值
+  auto snapshot_iter = snapshot_expect.begin();
+  EXPECT_EQ(snapshot.Scan("", "", [&snapshot_iter](std::string_view key, const CopyCountedValue &value) {
+    EXPECT_EQ(key, snapshot_iter->first);
+    EXPECT_EQ(value.id, snapshot_iter->second);
+    ++snapshot_iter;
+    return true;
+  }), snapshot_expect.size());
+}
+
+// 声明可以按字节搬动的值，统计存活的对象数和复制次数
+struct RelocatableValue {
+  static inline std::atomic<int32_t> live_cnt{0};
+  static inline std::atomic<uint32_t> copy_cnt{0};
+  RelocatableValue(uint32_t id) : ids(16, id) { live_cnt++; }
+  RelocatableValue(const RelocatableValue &other) : ids(other.ids) {
+    live_cnt++;
+    copy_cnt++;
+  }
+  ~RelocatableValue() { live_cnt--; }
+  RelocatableValue &operator=(const RelocatableValue &other) = default;
+  std::vector<uint32_t> ids;
+};
+
+template <>
+struct vrt::VrtIsTriviallyRelocatable<RelocatableValue> : std::true_type {};
+
+TEST(RelocateValueTest, RandomTest) {
+  constexpr uint32_t kMaxKey = 20000;
+  {
+    vrt::Vrt<RelocatableValue, true, 2> vrt_tree;
+    std::atomic<bool> stop(false);
+    // 读线程可能还在读被替换的旧节点，旧节点上的值被搬走后仍然完整
+    std::thread reader([&vrt_tree, &stop]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (uint32_t i = 0; i < kMaxKey; i += 7) {
+          vrt_tree.FindAndApply(std::to_string(i), [](const RelocatableValue &value) {
+            EXPECT_EQ(value.ids.size(), 16);
+            EXPECT_EQ(value.ids.front(), value.ids.back());
+          });
+        }
+      }
+    });
+    std::mt19937 gen(std::random_device{}());
+    std::map<std::string, uint32_t> expect;
+    for (uint32_t i = 0; i < kMaxKey; i++) {
+      auto key = std::to_string(gen() % kMaxKey);
+      EXPECT_EQ(vrt_tree.Insert(key, nullptr, i), expect.emplace(key, i).second);
+    }
+    for (uint32_t i = 0; i < kMaxKey; i += 3) {
+      auto key = std::to_string(i);
+      EXPECT_EQ(vrt_tree.Delete(key), expect.erase(key) > 0);
+    }
+    stop.store(true, std::memory_order_relaxed);
+    reader.join();
+    // 扩容、去前缀、合并和缩容都只搬动值，不复制
+    EXPECT_EQ(RelocatableValue::copy_cnt.load(), 0);
+    for (auto &[key, id] : expect) {
+      EXPECT_EQ(vrt_tree.FindAndApply(key, [id = id](const RelocatableValue &value) {
+        EXPECT_EQ(value.ids, std::vector<uint32_t>(16, id));
+      }), true);
+    }
+    auto snapshot = vrt_tree.Snapshot();
+    auto snapshot_expect = expect;
+    for (uint32_t i = 1; i < kMaxKey; i += 3) {
+      auto key = std::to_string(i);
+      EXPECT_EQ(vrt_tree.Delete(key), expect.erase(key) > 0);
+    }
+    auto snapshot_iter = snapshot_expect.begin();
+    EXPECT_EQ(snapshot.Scan("", "", [&snapshot_iter](std::string_view key, const RelocatableValue &value) {
+      EXPECT_EQ(key, snapshot_iter->first);
+      EXPECT_EQ(value.ids, std::vector<uint32_t>(16, snapshot_iter->second));
+      ++snapshot_iter;
+      return true;
+    }), snapshot_expect.size());
+  }
+  // 被搬走值的旧节点回收时没有重复析构
+  EXPECT_EQ(RelocatableValue::live_cnt.load(), 0);
+}
+
+TEST(FineNodeTest, RandomTest) {
+  constexpr uint32_t kOpCnt = 100000;
+  std::mt19937 gen(std::random_device{}());
+  // 40个字符的字符集，节点的子节点数会反复穿过Node8/Node16/Node32/Node48的扩缩容阈值
+  std::uniform_int_distribution<int> len_distrib(1, 3);
+  std::uniform_int_distribution<int> char_distrib(0, 39);
+  std::uniform_int_distribution<int> op_distrib(0, 3);
+  vrt::Vrt<uint32_t, true, 1, vrt::VrtFineNodePolicy> vrt_tree;
+  std::map<std::string, uint32_t> expect;
+  auto check = [&vrt_tree, &expect]() {
+    auto iter = expect.begin();
+    EXPECT_EQ(vrt_tree.Scan("", "", [&iter](std::string_view key, const uint32_t &value) {
+      EXPECT_EQ(key, iter->first);
+      EXPECT_EQ(value, iter->second);
+      ++iter;
+      return true;
+    }), expect.size());
+    for (auto &[key, value] : expect) {
+      uint32_t find_value;
+      EXPECT_EQ(vrt_tree.Find(key, &find_value), true);
+      EXPECT_EQ(find_value, value);
+    }
+  };
+  for (uint32_t i = 0; i < kOpCnt; i++) {
+    std::string key(len_distrib(gen), 0);
+    for (auto &ch : key) {
+      ch = '0' + char_distrib(gen);
+    }
+    switch (op_distrib(gen)) {
+      case 0:
+      case 1:
+        EXPECT_EQ(vrt_tree.Insert(key, nullptr, i), expect.emplace(key, i).second);
+        break;
+      case 2:
+        EXPECT_EQ(vrt_tree.Delete(key), expect.erase(key) > 0);
+        break;
+      case 3: {
+        // 批量写入走MultiUpsert，按子节点数一次选出合适的节点类型
+        std::vector<std::pair<std::string_view, uint32_t>> kvs;
+        std::vector<std::string> keys(10);
+        for (auto &batch_key : keys) {
+          batch_key = key + static_cast<char>('0' + char_distrib(gen));
+          kvs.emplace_back(batch_key, i);
+          expect[batch_key] = i;
+        }
+        vrt_tree.MultiUpsert(&kvs);
+      } break;
+    }
+    if (i % (kOpCnt / 10) == 0) {
+      check();
+    }
+  }
+  check();
+}
+
+TEST(PartitionedRootTest, RandomTest) {
+  constexpr uint32_t kOpCnt = 50000;
+  std::mt19937 gen(std::random_device{}());
+  // 首字节取遍0~255，覆盖所有分区，也检查大于0x7f的首字节按无符号顺序遍历
+  std::uniform_int_distribution<int> len_distrib(1, 3);
+  std::uniform_int_distribution<int> first_distrib(0, 255);
+  std::uniform_int_distribution<int> char_distrib('a', 'd');
+  std::uniform_int_distribution<int> op_distrib(0, 3);
+  vrt::Vrt<uint32_t, true, 1, vrt::VrtPartitionedRootPolicy> vrt_tree;
+  std::map<std::string, uint32_t> expect;
+  auto gen_key = [&]() {
+    std::string key(len_distrib(gen), 0);
+    key[0] = static_cast<char>(first_distrib(gen));
+    for (size_t i = 1; i < key.size(); i++) {
+      key[i] = static_cast<char>(char_distrib(gen));
+    }
+    return key;
+  };
+  auto check = [&]() {
+    auto iter = expect.begin();
+    EXPECT_EQ(vrt_tree.Scan("", "", [&iter](std::string_view key, const uint32_t &value) {
+      EXPECT_EQ(key, iter->first);
+      EXPECT_EQ(value, iter->second);
+      ++iter;
+      return true;
+    }), expect.size());
+    auto start = gen_key();
+    auto end = gen_key();
+    if (end < start) {
+      std::swap(start, end);
+    }
+    iter = expect.lower_bound(start);
+    auto scan_cnt = vrt_tree.Scan(start, end, [&iter](std::string_view key, const uint32_t &value) {
+      EXPECT_EQ(key, iter->first);
+      ++iter;
+      return true;
+    });
+    EXPECT_EQ(scan_cnt, std::distance(expect.lower_bound(start), expect.lower_bound(end)));
+    EXPECT_EQ(vrt_tree.ForEachPrefix("", [](std::string_view, const uint32_t &) { return true; }), expect.size());
+    EXPECT_EQ(vrt_tree.ForEachPrefix("", [](std::string_view, const uint32_t &) { return true; }, 10),
+              std::min<size_t>(10, expect.size()));
+    auto prefix = start.substr(0, 1);
+    size_t prefix_cnt = 0;
+    for (auto prefix_iter = expect.lower_bound(prefix);
+         prefix_iter != expect.end() && prefix_iter->first.compare(0, 1, prefix) == 0; ++prefix_iter) {
+      prefix_cnt++;
+    }
+    EXPECT_EQ(vrt_tree.ForEachPrefix(prefix, [](std::string_view, const uint32_t &) { return true; }), prefix_cnt);
+    std::vector<std::string> keys;
+    for (int i = 0; i < 100; i++) {
+      keys.emplace_back(gen_key());
+    }
+    std::vector<std::string_view> key_views(keys.begin(), keys.end());
+    std::vector<uint32_t> values(keys.size());
+    std::vector<uint64_t> found_bitmap((keys.size() + 63) / 64);
+    size_t found_cnt = 0;
+    for (auto &key : keys) {
+      found_cnt += expect.count(key);
+    }
+    EXPECT_EQ(vrt_tree.MultiFind(key_views.data(), key_views.size(), values.data(), found_bitmap.data()), found_cnt);
+  };
+  for (uint32_t i = 0; i < kOpCnt; i++) {
+    auto key = gen_key();
+    switch (op_distrib(gen)) {
+      case 0:
+      case 1:
+        EXPECT_EQ(vrt_tree.Insert(key, nullptr, i), expect.emplace(key, i).second);
+        break;
+      case 2:
+        EXPECT_EQ(vrt_tree.Delete(key), expect.erase(key) > 0);
+        break;
+      case 3: {
+        // 一批key跨越多个分区
+        std::vector<std::pair<std::string_view, uint32_t>> kvs;
+        std::vector<std::string> keys(10);
+        for (auto &batch_key : keys) {
+          batch_key = gen_key();
+          kvs.emplace_back(batch_key, i);
+          expect[batch_key] = i;
+        }
+        vrt_tree.MultiUpsert(&kvs);
+      } break;
+    }
+    if (i % (kOpCnt / 10) == 0) {
+      check();
+    }
+  }
+  check();
+  auto snapshot = vrt_tree.Snapshot();
+  vrt_tree.Upsert(std::string(1, '\xff'), 0);
+  auto iter = expect.begin();
+  EXPECT_EQ(snapshot.Scan("", "", [&iter](std::string_view key, const uint32_t &value) {
+    EXPECT_EQ(key, iter->first);
+    EXPECT_EQ(value, iter->second);
+    ++iter;
+    return true;
+  }), expect.size());
+
+  // 只有所有分区都为空时才能BulkLoad
+  vrt::Vrt<uint32_t, true, 1, vrt::VrtPartitionedRootPolicy> bulk_tree;
+  std::vector<std::pair<std::string, uint32_t>> kvs(expect.begin(), expect.end());
+  EXPECT_EQ(bulk_tree.BulkLoad(kvs.begin(), kvs.end()), true);
+  EXPECT_EQ(bulk_tree.BulkLoad(kvs.begin(), kvs.end()), false);
+  iter = expect.begin();
+  EXPECT_EQ(bulk_tree.Scan("", "", [&iter](std::string_view key, const uint32_t &value) {
+    EXPECT_EQ(key, iter->first);
+    EXPECT_EQ(value, iter->second);
+    ++iter;
+    return true;
+  }), expect.size());
+}
+
+struct PartitionedOptimisticPolicy : public vrt::VrtOptimisticWritePolicy {
+  static constexpr bool kPartitionedRoot = true;
+};
+
+TEST(PartitionedRootTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 4;
+  constexpr uint32_t kMaxKey = 100000;
+  vrt::Vrt<std::string, true, kThreadNum + 1, PartitionedOptimisticPolicy> vrt_tree;
+  // 每个线程写自己的key，首字节分布在所有分区上
+  auto gen_key = [](uint32_t i) { return std::string(1, static_cast<char>(i % 256)) + std::to_string(i); };
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kThreadNum; t++) {
+    threads.emplace_back([&vrt_tree, &gen_key, t]() {
+      for (uint32_t i = t; i < kMaxKey; i += kThreadNum) {
+        EXPECT_EQ(vrt_tree.Insert(gen_key(i), nullptr, std::to_string(i)), true);
+      }
+      for (uint32_t i = t; i < kMaxKey; i += kThreadNum * 2) {
+        EXPECT_EQ(vrt_tree.Delete(gen_key(i)), true);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    std::string value;
+    bool deleted = i % (kThreadNum * 2) < kThreadNum;
+    EXPECT_EQ(vrt_tree.Find(gen_key(i), &value), !deleted);
+    if (!deleted) {
+      EXPECT_EQ(value, std::to_string(i));
+    }
+  }
+  EXPECT_EQ(vrt_tree.Scan("", "", [](std::string_view, const std::string &) { return true; }), kMaxKey / 2);
+}
+
+TEST(OptimisticWriteTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 4;
+  constexpr uint32_t kMaxKey = 4000;
+  // 写线程也会进入读区间，kReadThreadNum要算上写线程
+  vrt::Vrt<std::string, true, kThreadNum + 2, vrt::VrtOptimisticWritePolicy> vrt_tree;
+  // 偶数key一直存在，写线程在同一批节点下反复插入、更新、删除奇数key，触发扩缩容、分裂和合并
+  for (uint32_t i = 0; i < kMaxKey; i += 2) {
+    EXPECT_EQ(vrt_tree.Insert(std::to_string(i), nullptr, std::to_string(i)), true);
+  }
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t < kThreadNum; t++) {
+    writers.emplace_back([&vrt_tree, &stop, t]() {
+      while (!stop.load()) {
+        for (uint32_t i = 1 + t * 2; i < kMaxKey; i += kThreadNum * 2) {
+          EXPECT_EQ(vrt_tree.Insert(std::to_string(i), nullptr, std::to_string(i)), true);
+        }
+        for (uint32_t i = 1 + t * 2; i < kMaxKey; i += kThreadNum * 2) {
+          EXPECT_EQ(vrt_tree.Upsert(std::to_string(i), std::to_string(i * 2)), true);
+          EXPECT_EQ(vrt_tree.Update(std::to_string(i), std::to_string(i * 3)), true);
+        }
+        for (uint32_t i = 1 + t * 2; i < kMaxKey; i += kThreadNum * 2) {
+          EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+        }
+      }
+    });
+  }
+  for (int round = 0; round < 20; round++) {
+    for (uint32_t i = 0; i < kMaxKey; i += 2) {
+      std::string value;
+      EXPECT_EQ(vrt_tree.Find(std::to_string(i), &value), true);
+      EXPECT_EQ(value, std::to_string(i));
+    }
+  }
+  stop.store(true);
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  EXPECT_EQ(vrt_tree.Scan("", "", [](std::string_view key, const std::string &) { return true; }), kMaxKey / 2);
+  for (uint32_t i = 0; i < kMaxKey; i += 2) {
+    EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+  }
+  EXPECT_EQ(vrt_tree.Scan("", "", [](std::string_view key, const std::string &) { return true; }), 0);
+}
+
+TEST(OptimisticWriteTest, SnapshotTest) {
+  constexpr uint32_t kThreadNum = 2;
+  constexpr uint32_t kMaxKey = 20000;
+  vrt::Vrt<uint32_t, true, kThreadNum + 1, vrt::VrtOptimisticWritePolicy> vrt_tree;
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    vrt_tree.Insert(std::to_string(i), nullptr, 0);
+  }
+  // 乐观写和快照交替进行，快照创建后乐观写退回复制路径
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t < kThreadNum; t++) {
+    writers.emplace_back([&vrt_tree, &stop, t]() {
+      for (uint32_t round = 1; !stop.load(); round++) {
+        for (uint32_t i = t * 3; i < kMaxKey && !stop.load(); i += kThreadNum * 3) {
+          vrt_tree.Upsert(std::to_string(i), round);
+          vrt_tree.Delete(std::to_string(i + 1));
+          vrt_tree.Insert(std::to_string(i + 1), nullptr, round);
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 5; i++) {
+    auto snapshot = vrt_tree.Snapshot();
+    std::map<std::string, uint32_t> first_scan;
+    snapshot.Scan("", "", [&first_scan](std::string_view key, const uint32_t &value) {
+      first_scan[std::string(key)] = value;
+      return true;
+    });
+    auto iter = first_scan.begin();
+    EXPECT_EQ(snapshot.Scan("", "", [&iter](std::string_view key, const uint32_t &value) {
+      EXPECT_EQ(key, iter->first);
+      EXPECT_EQ(value, iter->second);
+      ++iter;
+      return true;
+    }), first_scan.size());
+  }
+  stop.store(true);
+  for (auto &writer : writers) {
+    writer.join();
+  }
+}
+
+TEST(ReaderRegistryTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 100;
+  constexpr uint32_t kMaxKey = 2000;
+  // 读线程数远超kReadThreadNum，槽位按需增加，线程退出后槽位被复用
+  vrt::Vrt<uint32_t, true, 1> vrt_tree;
+  for (uint32_t i = 0; i < kMaxKey; i += 2) {
+    vrt_tree.Insert(std::to_string(i), nullptr, i);
+  }
+  std::atomic<bool> stop = false;
+  std::thread writer([&vrt_tree, &stop]() {
+    while (!stop.load()) {
+      for (uint32_t i = 1; i < kMaxKey; i += 2) {
+        vrt_tree.Insert(std::to_string(i), nullptr, i);
+      }
+      for (uint32_t i = 1; i < kMaxKey; i += 2) {
+        EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+      }
+    }
+  });
+  for (int round = 0; round < 3; round++) {
+    std::vector<std::thread> readers;
+    for (uint32_t t = 0; t < kThreadNum; t++) {
+      readers.emplace_back([&vrt_tree]() {
+        for (uint32_t i = 0; i < kMaxKey; i += 2) {
+          uint32_t value = 0;
+          EXPECT_EQ(vrt_tree.Find(std::to_string(i), &value), true);
+          EXPECT_EQ(value, i);
+        }
+      });
+    }
+    for (auto &reader : readers) {
+      reader.join();
+    }
+  }
+  stop.store(true);
+  writer.join();
+}
+
+TEST(ReaderRegistryTest, OptimisticSnapshotTest) {
+  constexpr uint32_t kThreadNum = 70;
+  constexpr uint32_t kMaxKey = 7000;
+  // 乐观写线程数超过第一块TLS的槽位，每个线程的计数都在自己的槽位上，快照要等到所有进行中的乐观写结束
+  vrt::Vrt<uint32_t, true, 1, vrt::VrtOptimisticWritePolicy> vrt_tree;
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    vrt_tree.Insert(std::to_string(i), nullptr, 0);
+  }
+  std::atomic<uint32_t> done_cnt = 0;
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t < kThreadNum; t++) {
+    writers.emplace_back([&vrt_tree, &done_cnt, t]() {
+      for (uint32_t round = 1; round <= 10; round++) {
+        for (uint32_t i = t; i < kMaxKey; i += kThreadNum) {
+          vrt_tree.Upsert(std::to_string(i), round);
+        }
+      }
+      done_cnt++;
+    });
+  }
+  while (done_cnt.load() < kThreadNum) {
+    auto snapshot = vrt_tree.Snapshot();
+    std::vector<uint32_t> first_scan;
+    snapshot.Scan("", "", [&first_scan](std::string_view, const uint32_t &value) {
+      first_scan.emplace_back(value);
+      return true;
+    });
+    EXPECT_EQ(first_scan.size(), kMaxKey);
+    size_t i = 0;
+    snapshot.Scan("", "", [&first_scan, &i](std::string_view, const uint32_t &value) {
+      EXPECT_EQ(value, first_scan[i++]);
+      return true;
+    });
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    uint32_t value = 0;
+    EXPECT_EQ(vrt_tree.Find(std::to_string(i), &value), true);
+    EXPECT_EQ(value, 10);
+  }
+}
+
+struct LiveCountValue {
+  static inline std::atomic<int> live_cnt = 0;
+  LiveCountValue(uint32_t v) : value(v) { live_cnt++; }
+  LiveCountValue(const LiveCountValue &other) : value(other.value) { live_cnt++; }
+  ~LiveCountValue() { live_cnt--; }
+  LiveCountValue &operator=(const LiveCountValue &other) = default;
+  uint32_t value;
+};
+
+// 统计申请次数的分配器
+struct CountingAllocator {
+  static inline std::atomic<uint32_t> allocate_cnt{0};
+  inline static void *Allocate(size_t size) {
+    allocate_cnt++;
+    return malloc(size);
+  }
+  inline static void Deallocate(void *ptr, size_t /*size*/) { free(ptr); }
+};
+
+struct CountingBoxedValuePolicy : public vrt::VrtBoxedValuePolicy {
+  using Allocator = CountingAllocator;
+};
+
+TEST(BoxedValueTest, ReplaceTest) {
+  {
+    vrt::Vrt<LiveCountValue, true, 2, CountingBoxedValuePolicy> vrt_tree;
+    EXPECT_EQ(vrt_tree.Insert("key", nullptr, 1), true);
+    EXPECT_EQ(vrt_tree.Insert("keys", nullptr, 1), true);
+    {
+      decltype(vrt_tree)::ReadGuard guard(vrt_tree);
+      auto *old_value = vrt_tree.Find("key", guard);
+      ASSERT_NE(old_value, nullptr);
+      auto allocate_cnt = CountingAllocator::allocate_cnt.load();
+      EXPECT_EQ(vrt_tree.Upsert("key", 2), true);
+      EXPECT_EQ(vrt_tree.Update("key", 3), true);
+      EXPECT_EQ(vrt_tree.Merge("key", 4, [](const LiveCountValue &old, uint32_t delta) { return old.value + delta; }),
+                true);
+      // 只申请新的值，节点原地换上新的指针
+      EXPECT_EQ(CountingAllocator::allocate_cnt.load(), allocate_cnt + 3);
+      // 换下来的值在读区间结束之前不会释放
+      EXPECT_EQ(old_value->value, 1);
+      EXPECT_EQ(LiveCountValue::live_cnt.load(), 5);
+      EXPECT_EQ(vrt_tree.Find("key", guard)->value, 7);
+    }
+    std::atomic<bool> stop = false;
+    std::thread reader([&vrt_tree, &stop]() {
+      uint32_t last = 0;
+      while (!stop.load()) {
+        EXPECT_EQ(vrt_tree.FindAndApply("key", [&last](const LiveCountValue &value) {
+          EXPECT_GE(value.value, last);
+          last = value.value;
+        }), true);
+      }
+    });
+    for (uint32_t i = 10; i < 20000; i++) {
+      vrt_tree.Upsert("key", i);
+    }
+    stop.store(true);
+    reader.join();
+    // 读线程结束后epoch可以推进，之后的写入会释放之前换下来的值
+    for (uint32_t i = 0; i < 100; i++) {
+      vrt_tree.Upsert("key", 20000 + i);
+    }
+    EXPECT_LT(LiveCountValue::live_cnt.load(), 64);
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+}
+
+// 上限和批量都很小，写线程频繁触发背压
+struct SmallRetirePolicy : public vrt::VrtBackgroundReclaimPolicy {
+  static constexpr uint32_t kReclaimIntervalUs = 100;
+  static constexpr uint32_t kReclaimBatch = 16;
+  static constexpr uint32_t kMaxRetireCnt = 256;
+};
+
+TEST(BackgroundReclaimTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 2;
+  constexpr uint32_t kMaxKey = 2000;
+  {
+    vrt::Vrt<LiveCountValue, true, kThreadNum + 2, SmallRetirePolicy> vrt_tree;
+    for (uint32_t i = 0; i < kMaxKey; i += 2) {
+      vrt_tree.Insert(std::to_string(i), nullptr, i);
+    }
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> writers;
+    for (uint32_t t = 0; t < kThreadNum; t++) {
+      writers.emplace_back([&vrt_tree, &stop, t]() {
+        while (!stop.load()) {
+          for (uint32_t i = 1 + t * 2; i < kMaxKey; i += kThreadNum * 2) {
+            vrt_tree.Insert(std::to_string(i), nullptr, i);
+          }
+          for (uint32_t i = 1 + t * 2; i < kMaxKey; i += kThreadNum * 2) {
+            EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+          }
+        }
+      });
+    }
+    for (int round = 0; round < 200; round++) {
+      // 长时间停留在读区间内，epoch无法推进，写线程在背压上等待之后继续写入
+      decltype(vrt_tree)::ReadGuard guard(vrt_tree);
+      for (uint32_t i = 0; i < kMaxKey; i += 2) {
+        auto *value = vrt_tree.Find(std::to_string(i), guard);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(value->value, i);
+      }
+    }
+    stop.store(true);
+    for (auto &writer : writers) {
+      writer.join();
+    }
+    EXPECT_EQ(vrt_tree.Scan("", "", [](std::string_view, const LiveCountValue &) { return true; }), kMaxKey / 2);
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+}
+
+TEST(ReclaimTest, ExitedWriterTest) {
+  constexpr uint32_t kThreadNum = 4;
+  constexpr uint32_t kMaxKey = 1000;
+  {
+    vrt::Vrt<LiveCountValue, true, kThreadNum, vrt::VrtDefaultPolicy> vrt_tree;
+    {
+      // 读区间阻止epoch推进，写线程退休的对象都留在它们自己的TLS中
+      decltype(vrt_tree)::ReadGuard guard(vrt_tree);
+      std::vector<std::thread> writers;
+      for (uint32_t t = 0; t < kThreadNum; t++) {
+        writers.emplace_back([&vrt_tree, t]() {
+          for (uint32_t round = 0; round < 5; round++) {
+            for (uint32_t i = t; i < kMaxKey; i += kThreadNum) {
+              vrt_tree.Upsert(std::to_string(i), i + round);
+            }
+          }
+        });
+      }
+      for (auto &writer : writers) {
+        writer.join();
+      }
+    }
+    // 退出的写线程留在自己TLS中的退休对象交给了共享的退休列表，之后其他线程的写入仍然能推进epoch释放它们
+    for (uint32_t i = 0; i < 1000; i++) {
+      vrt_tree.Upsert("x", i);
+    }
+    EXPECT_LT(LiveCountValue::live_cnt.load(), kMaxKey + 64);
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+}
+
+TEST(QsbrTest, NormalTest) {
+  constexpr uint32_t kChurnCnt = 10000;
+  {
+    vrt::Vrt<LiveCountValue, true, 1, vrt::VrtQsbrPolicy> vrt_tree;
+    vrt_tree.Insert("key", nullptr, 7);
+    {
+      decltype(vrt_tree)::ReadGuard guard(vrt_tree);
+      auto *value = vrt_tree.Find("key", guard);
+      ASSERT_NE(value, nullptr);
+      EXPECT_EQ(vrt_tree.Delete("key"), true);
+      // 当前线程在线且没有调用Quiescent，删除的值和之后退休的节点都不会被释放
+      for (uint32_t i = 0; i < kChurnCnt; i++) {
+        vrt_tree.Insert("churn", nullptr, i);
+        vrt_tree.Delete("churn");
+      }
+      EXPECT_EQ(value->value, 7);
+      EXPECT_GT(LiveCountValue::live_cnt.load(), kChurnCnt);
+    }
+    for (uint32_t i = 0; i < kChurnCnt; i++) {
+      vrt_tree.Insert("churn", nullptr, i);
+      vrt_tree.Delete("churn");
+      vrt_tree.Quiescent();
+    }
+    EXPECT_LT(LiveCountValue::live_cnt.load(), kChurnCnt / 10);
+    vrt_tree.Offline();
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+}
+
+TEST(QsbrTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 4;
+  constexpr uint32_t kMaxKey = 2000;
+  {
+    vrt::Vrt<LiveCountValue, true, kThreadNum, vrt::VrtQsbrPolicy> vrt_tree;
+    for (uint32_t i = 0; i < kMaxKey; i += 2) {
+      vrt_tree.Insert(std::to_string(i), nullptr, i);
+    }
+    std::atomic<bool> stop = false;
+    std::thread writer([&vrt_tree, &stop]() {
+      while (!stop.load()) {
+        for (uint32_t i = 1; i < kMaxKey; i += 2) {
+          vrt_tree.Insert(std::to_string(i), nullptr, i);
+        }
+        for (uint32_t i = 1; i < kMaxKey; i += 2) {
+          EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+        }
+      }
+    });
+    std::vector<std::thread> readers;
+    for (uint32_t t = 0; t < kThreadNum; t++) {
+      readers.emplace_back([&vrt_tree]() {
+        for (int round = 0; round < 20; round++) {
+          decltype(vrt_tree)::ReadGuard guard(vrt_tree);
+          for (uint32_t i = 0; i < kMaxKey; i += 2) {
+            auto *value = vrt_tree.Find(std::to_string(i), guard);
+            ASSERT_NE(value, nullptr);
+            EXPECT_EQ(value->value, i);
+          }
+          vrt_tree.Quiescent();
+        }
+        vrt_tree.Offline();
+      });
+    }
+    for (auto &reader : readers) {
+      reader.join();
+    }
+    stop.store(true);
+    writer.join();
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+}
+
+struct QsbrOptimisticPolicy : public vrt::VrtOptimisticWritePolicy {
+  static constexpr vrt::VrtReclaimScheme kReclaimScheme = vrt::VrtReclaimScheme::kQsbr;
+};
+
+TEST(QsbrTest, OfflineTest) {
+  constexpr uint32_t kChurnCnt = 10000;
+  {
+    // 读线程没有调用Offline就退出，退出时槽位被清掉，不阻塞之后的回收。另一个线程占住更大的tid，
+    // 退出线程的槽位仍在GC扫描的范围内
+    vrt::Vrt<LiveCountValue, true, 1, vrt::VrtQsbrPolicy> vrt_tree;
+    vrt_tree.Insert("key", nullptr, 7);
+    std::atomic<int> step = 0;
+    std::thread reader([&vrt_tree, &step]() {
+      {
+        decltype(vrt_tree)::ReadGuard guard(vrt_tree);
+        EXPECT_NE(vrt_tree.Find("key", guard), nullptr);
+      }
+      step.store(1);
+      while (step.load() < 2) {
+      }
+    });
+    std::thread holder([&vrt_tree, &step]() {
+      while (step.load() < 1) {
+      }
+      vrt_tree.Offline();
+      step.store(2);
+      while (step.load() < 3) {
+      }
+    });
+    reader.join();
+    for (uint32_t i = 0; i < kChurnCnt; i++) {
+      vrt_tree.Insert("churn", nullptr, i);
+      vrt_tree.Delete("churn");
+    }
+    EXPECT_LT(LiveCountValue::live_cnt.load(), kChurnCnt / 10);
+    step.store(3);
+    holder.join();
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+  {
+    // 乐观写只在下降时上线，只写不读的线程从不调用Quiescent也不会阻塞回收
+    vrt::Vrt<LiveCountValue, true, 1, QsbrOptimisticPolicy> vrt_tree;
+    vrt_tree.Insert("key", nullptr, 7);
+    for (uint32_t i = 0; i < kChurnCnt; i++) {
+      vrt_tree.Upsert("churn", i);
+      vrt_tree.Delete("churn");
+    }
+    EXPECT_LT(LiveCountValue::live_cnt.load(), kChurnCnt / 10);
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+}
+
+TEST(HazardPointerTest, NormalTest) {
+  constexpr uint32_t kMaxKey = 1000;
+  {
+    vrt::Vrt<LiveCountValue, true, 1, vrt::VrtHazardPointerPolicy> vrt_tree;
+    for (uint32_t i = 0; i < kMaxKey; i++) {
+      EXPECT_EQ(vrt_tree.Insert(std::to_string(i), nullptr, i), true);
+    }
+    for (uint32_t i = 0; i < kMaxKey; i++) {
+      LiveCountValue value(0);
+      EXPECT_EQ(vrt_tree.Find(std::to_string(i), &value), true);
+      EXPECT_EQ(value.value, i);
+      EXPECT_EQ(vrt_tree.FindAndApply(std::to_string(i), [i](const LiveCountValue &value) { EXPECT_EQ(value.value, i); }),
+                true);
+    }
+    std::vector<std::string> keys = {"1", "12", "x", "123", "999"};
+    std::vector<std::string_view> key_views(keys.begin(), keys.end());
+    std::vector<LiveCountValue> values(keys.size(), LiveCountValue(0));
+    uint64_t found_bitmap = 0;
+    EXPECT_EQ(vrt_tree.MultiFind(key_views.data(), key_views.size(), values.data(), &found_bitmap), 4);
+    EXPECT_EQ(found_bitmap, 0b11011);
+    EXPECT_EQ(values[3].value, 123);
+    LiveCountValue value(0);
+    size_t matched_length = 0;
+    EXPECT_EQ(vrt_tree.FindLongestPrefix("12345", &value, &matched_length), true);
+    EXPECT_EQ(value.value, 123);
+    EXPECT_EQ(matched_length, 3);
+    EXPECT_EQ(vrt_tree.FindLongestPrefix("x", &value, &matched_length), false);
+    for (uint32_t i = 0; i < kMaxKey; i++) {
+      EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+    }
+    EXPECT_EQ(vrt_tree.Find("1", &value), false);
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+}
+
+TEST(HazardPointerTest, StalledReaderTest) {
+  constexpr uint32_t kChurnCnt = 10000;
+  {
+    vrt::Vrt<LiveCountValue, true, 2, vrt::VrtHazardPointerPolicy> vrt_tree;
+    vrt_tree.Insert("key", nullptr, 7);
+    std::atomic<bool> entered = false;
+    std::atomic<bool> release = false;
+    std::thread reader([&vrt_tree, &entered, &release]() {
+      EXPECT_EQ(vrt_tree.FindAndApply("key", [&entered, &release](const LiveCountValue &value) {
+        entered.store(true);
+        while (!release.load()) {
+          std::this_thread::yield();
+        }
+        // 停住期间key被更新了很多次，读线程访问的旧节点仍然没有释放
+        EXPECT_EQ(value.value, 7);
+      }), true);
+    });
+    while (!entered.load()) {
+      std::this_thread::yield();
+    }
+    for (uint32_t i = 0; i < kChurnCnt; i++) {
+      vrt_tree.Upsert("key", i);
+      vrt_tree.Upsert("other", i);
+    }
+    // 停住的读线程只保护它正在访问的节点，其他退休的节点照常释放
+    EXPECT_LT(LiveCountValue::live_cnt.load(), 64);
+    release.store(true);
+    reader.join();
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+}
+
+TEST(HazardPointerTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 4;
+  constexpr uint32_t kMaxKey = 2000;
+  {
+    vrt::Vrt<LiveCountValue, true, kThreadNum, vrt::VrtHazardPointerPolicy> vrt_tree;
+    for (uint32_t i = 0; i < kMaxKey; i += 2) {
+      vrt_tree.Insert(std::to_string(i), nullptr, i);
+    }
+    std::atomic<bool> stop = false;
+    std::thread writer([&vrt_tree, &stop]() {
+      while (!stop.load()) {
+        for (uint32_t i = 1; i < kMaxKey; i += 2) {
+          vrt_tree.Insert(std::to_string(i), nullptr, i);
+        }
+        for (uint32_t i = 0; i < kMaxKey; i += 2) {
+          vrt_tree.Upsert(std::to_string(i), i);
+        }
+        for (uint32_t i = 1; i < kMaxKey; i += 2) {
+          EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+        }
+      }
+    });
+    std::vector<std::thread> readers;
+    for (uint32_t t = 0; t < kThreadNum; t++) {
+      readers.emplace_back([&vrt_tree]() {
+        for (int round = 0; round < 20; round++) {
+          for (uint32_t i = 0; i < kMaxKey; i += 2) {
+            auto key = std::to_string(i);
+            LiveCountValue value(0);
+            EXPECT_EQ(vrt_tree.Find(key, &value), true);
+            EXPECT_EQ(value.value, i);
+            size_t matched_length = 0;
+            EXPECT_EQ(vrt_tree.FindLongestPrefix(key + "0", &value, &matched_length), true);
+            EXPECT_GE(matched_length, key.size());
+          }
+        }
+      });
+    }
+    for (auto &reader : readers) {
+      reader.join();
+    }
+    stop.store(true);
+    writer.join();
+  }
+  EXPECT_EQ(LiveCountValue::live_cnt.load(), 0);
+}
+
+TEST(LockFreeLayoutTest, SingleWriterTest) {
+  constexpr uint32_t kMaxKey = 20000;
+  // kWriteLock为false时节点不带锁，单个写线程和读线程并发
+  vrt::Vrt<std::string, false, 2> vrt_tree;
+  std::atomic<bool> stop(false);
+  std::thread reader([&vrt_tree, &stop]() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      for (uint32_t i = 0; i < kMaxKey; i += 7) {
+        std::string value;
+        if (vrt_tree.Find(std::to_string(i), &value)) {
+          EXPECT_EQ(value.substr(0, std::to_string(i).length()), std::to_string(i));
+        }
+      }
+    }
+  });
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    EXPECT_EQ(vrt_tree.Insert(std::to_string(i), nullptr, std::to_string(i)), true);
+  }
+  for (uint32_t i = 0; i < kMaxKey; i += 2) {
+    EXPECT_EQ(vrt_tree.Upsert(std::to_string(i), std::to_string(i) + "_"), true);
+  }
+  for (uint32_t i = 1; i < kMaxKey; i += 2) {
+    EXPECT_EQ(vrt_tree.Delete(std::to_string(i)), true);
+  }
+  stop.store(true, std::memory_order_relaxed);
+  reader.join();
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    std::string value;
+    EXPECT_EQ(vrt_tree.Find(std::to_string(i), &value), i % 2 == 0);
+    if (i % 2 == 0) {
+      EXPECT_EQ(value, std::to_string(i) + "_");
+    }
+  }
+}
+
+TEST(ScanTest, NormalTest) {
+  std::array<std::string, 8> keys = {
+      "abcdefg", "ab", "abcght", "abqert", "abcghq", "abcgh", "b", "\xff\x01",
+  };
+  vrt::Vrt<std::string, true, 1> vrt_tree;
+  std::map<std::string, std::string> expect;
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(vrt_tree.Insert(keys[i], nullptr, std::to_string(i)), true);
+    expect[keys[i]] = std::to_string(i);
+  }
+  std::vector<std::pair<std::string, std::string>> result;
+  auto collect = [&result](std::string_view key, const std::string &value) {
+    result.emplace_back(key, value);
+    return true;
+  };
+  EXPECT_EQ(vrt_tree.Scan("", "", collect), 8);
+  EXPECT_EQ(result, (std::vector<std::pair<std::string, std::string>>(expect.begin(), expect.end())));
+
+  result.clear();
+  EXPECT_EQ(vrt_tree.Scan("abc", "abcgh", collect), 1);
+  EXPECT_EQ(result, (std::vector<std::pair<std::string, std::string>>{{"abcdefg", "0"}}));
+
+  result.clear();
+  EXPECT_EQ(vrt_tree.Scan("abcgh", "b", collect), 4);
+  EXPECT_EQ(result, (std::vector<std::pair<std::string, std::string>>{
+                        {"abcgh", "5"}, {"abcghq", "4"}, {"abcght", "2"}, {"abqert", "3"}}));
+
+  result.clear();
+  EXPECT_EQ(vrt_tree.Scan("a", "", [&result](std::string_view key, const std::string &value) {
+    result.emplace_back(key, value);
+    return result.size() < 2;
+  }), 2);
+  EXPECT_EQ(result, (std::vector<std::pair<std::string, std::string>>{{"ab", "1"}, {"abcdefg", "0"}}));
+}
+
+TEST(ScanTest, RandomTest) {
+  constexpr uint32_t kMaxKey = 100000;
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<int> length_distrib(1, 6);
+  std::uniform_int_distribution<int> char_distrib(-128, 127);
+  vrt::Vrt<uint32_t, true, 1> vrt_tree;
+  std::map<std::string, uint32_t> expect;
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    std::string key(length_distrib(gen), 0);
+    for (auto &c : key) {
+      // 字符集大小不同，让各种类型的节点都能出现
+      c = static_cast<char>(char_distrib(gen) % (i % 4 == 0 ? 128 : (i % 4 == 1 ? 40 : 10)));
+    }
+    vrt_tree.Upsert(key, i);
+    expect[key] = i;
+  }
+  for (int i = 0; i < 100; i++) {
+    std::string start(length_distrib(gen), 0);
+    std::string end(length_distrib(gen), 0);
+    for (auto &c : start) {
+      c = static_cast<char>(char_distrib(gen));
+    }
+    for (auto &c : end) {
+      c = static_cast<char>(char_distrib(gen));
+    }
+    if (end < start) {
+      std::swap(start, end);
+    }
+    auto iter = expect.lower_bound(start);
+    auto end_iter = expect.lower_bound(end);
+    bool same = true;
+    auto visit_cnt = vrt_tree.Scan(start, end, [&](std::string_view key, const uint32_t &value) {
+      if (iter == end_iter || iter->first != key || iter->second != value) {
+        same = false;
+        return false;
+      }
+      ++iter;
+      return true;
+    });
+    EXPECT_TRUE(same);
+    EXPECT_EQ(iter, end_iter);
+    EXPECT_EQ(visit_cnt, std::distance(expect.lower_bound(start), end_iter));
+  }
+}
+
+TEST(ForEachPrefixTest, NormalTest) {
+  std::array<std::string, 8> keys = {
+      "abcdefg", "ab", "abcght", "abqert", "abcghq", "abcgh", "b", "a",
+  };
+  vrt::Vrt<std::string, true, 1> vrt_tree;
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(vrt_tree.Insert(keys[i], nullptr, std::to_string(i)), true);
+  }
+  std::vector<std::string> result;
+  auto collect = [&result](std::string_view key, const std::string &value) {
+    result.emplace_back(key);
+    return true;
+  };
+  EXPECT_EQ(vrt_tree.ForEachPrefix("abcg", collect), 3);
+  EXPECT_EQ(result, (std::vector<std::string>{"abcgh", "abcghq", "abcght"}));
+
+  result.clear();
+  EXPECT_EQ(vrt_tree.ForEachPrefix("ab", collect, 2), 2);
+  EXPECT_EQ(result, (std::vector<std::string>{"ab", "abcdefg"}));
+
+  result.clear();
+  EXPECT_EQ(vrt_tree.ForEachPrefix("", collect), 8);
+  EXPECT_EQ(result.front(), "a");
+  EXPECT_EQ(result.back(), "b");
+
+  result.clear();
+  EXPECT_EQ(vrt_tree.ForEachPrefix("abcgi", collect), 0);
+  EXPECT_EQ(vrt_tree.ForEachPrefix("abcdefgh", collect), 0);
+  EXPECT_EQ(vrt_tree.ForEachPrefix("abcd", collect), 1);
+  EXPECT_EQ(result, (std::vector<std::string>{"abcdefg"}));
+}
+
+TEST(FindLongestPrefixTest, NormalTest) {
+  std::array<std::string, 6> keys = {
+      "/", "/api", "/api/v1/", "/api/v1/user", "/static/", "10.0.",
+  };
+  vrt::Vrt<std::string, true, 1> vrt_tree;
+  for (int i = 0; i < 6; i++) {
+    EXPECT_EQ(vrt_tree.Insert(keys[i], nullptr, std::to_string(i)), true);
+  }
+  std::string value;
+  size_t matched_length = 0;
+  EXPECT_EQ(vrt_tree.FindLongestPrefix("/api/v1/user/123", &value, &matched_length), true);
+  EXPECT_EQ(value, "3");
+  EXPECT_EQ(matched_length, 12);
+  EXPECT_EQ(vrt_tree.FindLongestPrefix("/api/v1/order", &value, &matched_length), true);
+  EXPECT_EQ(value, "2");
+  EXPECT_EQ(matched_length, 8);
+  EXPECT_EQ(vrt_tree.FindLongestPrefix("/api/v2", &value, &matched_length), true);
+  EXPECT_EQ(value, "1");
+  EXPECT_EQ(matched_length, 4);
+  EXPECT_EQ(vrt_tree.FindLongestPrefix("/static", &value, &matched_length), true);
+  EXPECT_EQ(value, "0");
+  EXPECT_EQ(matched_length, 1);
+  EXPECT_EQ(vrt_tree.FindLongestPrefix("/api", &value, &matched_length), true);
+  EXPECT_EQ(value, "1");
+  EXPECT_EQ(matched_length, 4);
+  EXPECT_EQ(vrt_tree.FindLongestPrefix("10.0.0.1", &value, &matched_length), true);
+  EXPECT_EQ(value, "5");
+  EXPECT_EQ(matched_length, 5);
+  EXPECT_EQ(vrt_tree.FindLongestPrefix("10.1.0.1", &value, &matched_length), false);
+  EXPECT_EQ(vrt_tree.FindLongestPrefix("api", &value, &matched_length), false);
+}
+
+TEST(ZeroCopyFindTest, NormalTest) {
+  std::array<std::string, 4> keys = {
+      "abc", "abcd", "abd", "b",
+  };
+  vrt::Vrt<std::string, true, 1> vrt_tree;
+  std::string missing;
+  EXPECT_EQ(vrt_tree.Find("abc", &missing), false);
+  EXPECT_EQ(vrt_tree.FindAndApply("abc", [](const std::string &) {}), false);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(vrt_tree.Insert(keys[i], nullptr, keys[i] + "_value"), true);
+  }
+  for (int i = 0; i < 4; i++) {
+    size_t length = 0;
+    EXPECT_EQ(vrt_tree.FindAndApply(keys[i], [&length](const std::string &value) { length = value.length(); }), true);
+    EXPECT_EQ(length, keys[i].length() + 6);
+  }
+  EXPECT_EQ(vrt_tree.FindAndApply("ab", [](const std::string &) { FAIL(); }), false);
+  {
+    decltype(vrt_tree)::ReadGuard guard(vrt_tree);
+    const std::string *value = vrt_tree.Find("abcd", guard);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(vrt_tree.Find("abce", guard), nullptr);
+    // 守卫期间替换值，旧值仍然有效
+    EXPECT_EQ(vrt_tree.Upsert("abcd", "new_value"), true);
+    std::string new_value;
+    EXPECT_EQ(vrt_tree.Find("abcd", &new_value), true);
+    EXPECT_EQ(new_value, "new_value");
+    EXPECT_EQ(*value, "abcd_value");
+    EXPECT_EQ(*vrt_tree.Find("abcd", guard), "new_value");
+  }
+}
+
+TEST(AtomicValueTest, NormalTest) {
+  vrt::Vrt<uint64_t, true, 1> vrt_tree;
+  EXPECT_EQ(vrt_tree.FetchAdd("counter", 1), false);
+  EXPECT_EQ(vrt_tree.Insert("counter", nullptr, 10), true);
+  EXPECT_EQ(vrt_tree.Insert("count", nullptr, 0), true);
+  uint64_t old_value = 0;
+  EXPECT_EQ(vrt_tree.FetchAdd("counter", 5, &old_value), true);
+  EXPECT_EQ(old_value, 10);
+  EXPECT_EQ(vrt_tree.FetchAdd("counte", 5), false);
+  EXPECT_EQ(vrt_tree.Store("count", 7), true);
+  EXPECT_EQ(vrt_tree.Store("coun", 7), false);
+  uint64_t expected = 0;
+  EXPECT_EQ(vrt_tree.CompareExchange("count", &expected, 8), false);
+  EXPECT_EQ(expected, 7);
+  EXPECT_EQ(vrt_tree.CompareExchange("count", &expected, 8), true);
+  uint64_t value = 0;
+  EXPECT_EQ(vrt_tree.Find("counter", &value), true);
+  EXPECT_EQ(value, 15);
+  EXPECT_EQ(vrt_tree.Find("count", &value), true);
+  EXPECT_EQ(value, 8);
+}
+
+TEST(AtomicValueTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 4;
+  constexpr uint32_t kAddCnt = 20000;
+  std::array<std::string, 3> counters = {"a", "ab", "abc"};
+  vrt::Vrt<uint64_t, true, kThreadNum + 1> vrt_tree;
+  for (auto &counter : counters) {
+    EXPECT_EQ(vrt_tree.Insert(counter, nullptr, 0), true);
+  }
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < kThreadNum; i++) {
+    threads.emplace_back([&vrt_tree, &counters, i]() {
+      for (uint32_t j = 0; j < kAddCnt; j++) {
+        vrt_tree.FetchAdd(counters[j % counters.size()], 1);
+        // 同时插入新的子节点，迫使计数器所在的节点扩容复制
+        if (j % 64 == 0) {
+          vrt_tree.Insert(counters[j % counters.size()] + std::to_string(i * kAddCnt + j), nullptr, 0);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  uint64_t sum = 0;
+  for (auto &counter : counters) {
+    uint64_t value = 0;
+    EXPECT_EQ(vrt_tree.Find(counter, &value), true);
+    sum += value;
+  }
+  EXPECT_EQ(sum, kThreadNum * kAddCnt);
+}
+
+struct CopyCountValue {
+  static inline int copy_cnt = 0;
+  CopyCountValue(int v) : value(v) {}
+  CopyCountValue(const CopyCountValue &other) : value(other.value) { copy_cnt++; }
+  CopyCountValue(CopyCountValue &&other) : value(other.value) { copy_cnt++; }
+  CopyCountValue &operator=(const CopyCountValue &other) = default;
+  int value;
+};
+
+TEST(ComputeTest, NormalTest) {
+  vrt::Vrt<CopyCountValue, true, 1> vrt_tree;
+  CopyCountValue::copy_cnt = 0;
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(vrt_tree.Compute("abc", [](const CopyCountValue *old_value) {
+      return CopyCountValue(nullptr == old_value ? 1 : old_value->value * 10);
+    }), true);
+  }
+  // 新值直接构造在节点上
+  EXPECT_EQ(CopyCountValue::copy_cnt, 0);
+  EXPECT_EQ(vrt_tree.Compute("", [](const CopyCountValue *) { return CopyCountValue(0); }), false);
+  EXPECT_EQ(vrt_tree.Compute("ab", [](const CopyCountValue *old_value) {
+    EXPECT_EQ(old_value, nullptr);
+    return CopyCountValue(2);
+  }), true);
+  EXPECT_EQ(vrt_tree.FindAndApply("abc", [](const CopyCountValue &value) { EXPECT_EQ(value.value, 100); }), true);
+  EXPECT_EQ(vrt_tree.FindAndApply("ab", [](const CopyCountValue &value) { EXPECT_EQ(value.value, 2); }), true);
+}
+
+TEST(ComputeTest, BoxedValueTest) {
+  vrt::Vrt<CopyCountValue, true, 1, vrt::VrtBoxedValuePolicy> vrt_tree;
+  CopyCountValue::copy_cnt = 0;
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(vrt_tree.Compute("abc", [](const CopyCountValue *old_value) {
+      return CopyCountValue(nullptr == old_value ? 1 : old_value->value * 10);
+    }), true);
+  }
+  EXPECT_EQ(vrt_tree.Upsert("abcd", 5), true);
+  EXPECT_EQ(vrt_tree.Merge("abcd", 2, [](const CopyCountValue &old_value, int delta) {
+    return CopyCountValue(old_value.value * delta);
+  }), true);
+  // 新值直接构造在box上
+  EXPECT_EQ(CopyCountValue::copy_cnt, 0);
+  EXPECT_EQ(vrt_tree.FindAndApply("abc", [](const CopyCountValue &value) { EXPECT_EQ(value.value, 100); }), true);
+  EXPECT_EQ(vrt_tree.FindAndApply("abcd", [](const CopyCountValue &value) { EXPECT_EQ(value.value, 10); }), true);
+}
+
+TEST(MergeTest, ConcurrentTest) {
+  constexpr uint32_t kThreadNum = 4;
+  constexpr uint32_t kMergeCnt = 5000;
+  std::array<std::string, 4> keys = {"k", "key", "key1", "key2"};
+  vrt::Vrt<std::string, true, kThreadNum + 1> vrt_tree;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < kThreadNum; i++) {
+    threads.emplace_back([&vrt_tree, &keys]() {
+      for (uint32_t j = 0; j < kMergeCnt; j++) {
+        vrt_tree.Merge(keys[j % keys.size()], std::string("x"),
+                       [](const std::string &old_value, const std::string &delta) { return old_value + delta; });
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  size_t total_length = 0;
+  for (auto &key : keys) {
+    std::string value;
+    EXPECT_EQ(vrt_tree.Find(key, &value), true);
+    total_length += value.length();
+  }
+  EXPECT_EQ(total_length, kThreadNum * kMergeCnt);
+}
+
+TEST(MultiFindTest, RandomTest) {
+  constexpr uint32_t kMaxKeyLength = 8;
+  constexpr uint32_t kMaxKey = 100000;
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<int> distrib(-128, 127);
+  vrt::Vrt<std::string, true, 1> vrt_tree;
+  std::vector<std::string> keys(kMaxKey);
+  std::vector<std::string_view> find_keys(kMaxKey);
+  for (int i = 0; i < kMaxKey; i++) {
+    keys[i].resize(i % kMaxKeyLength + 1);
+    for (auto &c : keys[i]) {
+      c = distrib(gen);
+    }
+    find_keys[i] = keys[i];
+  }
+  for (int i = 0; i < kMaxKey; i += 2) {
+    vrt_tree.Upsert(keys[i], keys[i]);
+  }
+  std::vector<std::string> values(kMaxKey);
+  std::vector<uint64_t> found_bitmap((kMaxKey + 63) / 64);
+  auto found_cnt = vrt_tree.MultiFind(find_keys.data(), kMaxKey, values.data(), found_bitmap.data());
+  size_t expect_found_cnt = 0;
+  for (int i = 0; i < kMaxKey; i++) {
+    std::string value;
+    bool found = vrt_tree.Find(keys[i], &value);
+    EXPECT_EQ(found, ((found_bitmap[i / 64] >> (i % 64)) & 1) == 1);
+    if (found) {
+      expect_found_cnt++;
+      EXPECT_EQ(value, values[i]);
+    }
+  }
+  EXPECT_EQ(found_cnt, expect_found_cnt);
+}
+
+TEST(MultiUpsertTest, RandomTest) {
+  constexpr uint32_t kMaxKey = 200000;
+  constexpr uint32_t kBatchSize = 1000;
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<int> length_distrib(1, 6);
+  std::uniform_int_distribution<int> char_distrib(-128, 127);
+  vrt::Vrt<std::string, true, 1> vrt_tree;
+  std::map<std::string, std::string> expect;
+  std::vector<std::string> keys(kMaxKey);
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    keys[i].resize(length_distrib(gen));
+    for (auto &c : keys[i]) {
+      c = static_cast<char>(char_distrib(gen) % (i % 3 == 0 ? 128 : 20));
+    }
+  }
+  for (uint32_t i = 0; i < kMaxKey / 2; i++) {
+    vrt_tree.Upsert(keys[i], std::to_string(i));
+    expect[keys[i]] = std::to_string(i);
+  }
+  // 一半是已有的key，一半是新key，批内也有重复的key
+  std::uniform_int_distribution<uint32_t> index_distrib(0, kMaxKey - 1);
+  for (uint32_t batch = 0; batch < kMaxKey / kBatchSize; batch++) {
+    std::vector<std::pair<std::string_view, std::string>> kvs;
+    for (uint32_t i = 0; i < kBatchSize; i++) {
+      auto index = index_distrib(gen);
+      kvs.emplace_back(keys[index], std::to_string(batch * kBatchSize + i));
+      expect[keys[index]] = std::to_string(batch * kBatchSize + i);
+    }
+    std::set<std::string_view> batch_keys;
+    for (auto &kv : kvs) {
+      batch_keys.insert(kv.first);
+    }
+    EXPECT_EQ(vrt_tree.MultiUpsert(&kvs), batch_keys.size());
+  }
+  std::vector<std::pair<std::string, std::string>> result;
+  vrt_tree.Scan("", "", [&result](std::string_view key, const std::string &value) {
+    result.emplace_back(key, value);
+    return true;
+  });
+  EXPECT_EQ(result, (std::vector<std::pair<std::string, std::string>>(expect.begin(), expect.end())));
+  for (auto &[key, value] : expect) {
+    std::string find_value;
+    EXPECT_EQ(vrt_tree.Find(key, &find_value), true);
+    EXPECT_EQ(find_value, value);
+  }
+}
+
+TEST(MultiUpsertTest, EmptyTreeTest) {
+  std::vector<std::pair<std::string_view, std::string>> kvs = {
+      {"abcdefg", "0"}, {"ab", "1"}, {"abcght", "2"}, {"abqert", "3"}, {"abcghq", "4"}, {"abcgh", "5"}, {"", "6"},
+  };
+  auto expect = kvs;
+  vrt::Vrt<std::string, true, 1> vrt_tree;
+  EXPECT_EQ(vrt_tree.MultiUpsert(&kvs), 6);
+  for (int i = 0; i < 6; i++) {
+    std::string find_value;
+    EXPECT_EQ(vrt_tree.Find(expect[i].first, &find_value), true);
+    EXPECT_EQ(find_value, expect[i].second);
+  }
+}
+
+TEST(BulkLoadTest, RandomTest) {
+  constexpr uint32_t kMaxKeyLength = 8;
+  constexpr uint32_t kMaxKey = 100000;
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<int> distrib(-128, 127);
+  std::vector<std::pair<std::string, uint32_t>> kvs(kMaxKey);
+  std::map<std::string, uint32_t> expect;
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    kvs[i].first.resize(distrib(gen) % kMaxKeyLength + 1 + kMaxKeyLength / 2);
+    for (auto &c : kvs[i].first) {
+      c = distrib(gen) % 4;
+    }
+    kvs[i].second = i;
+  }
+  std::stable_sort(kvs.begin(), kvs.end(), [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+  for (auto &kv : kvs) {
+    expect[kv.first] = kv.second;
+  }
+  vrt::Vrt<uint32_t, true, 1> vrt_tree;
+  EXPECT_EQ(vrt_tree.BulkLoad(kvs.begin(), kvs.end()), true);
+  for (auto &[key, value] : expect) {
+    uint32_t find_value;
+    EXPECT_EQ(vrt_tree.Find(key, &find_value), true);
+    EXPECT_EQ(find_value, value);
+  }
+  auto iter = expect.begin();
+  EXPECT_EQ(vrt_tree.Scan("", "", [&iter](std::string_view key, const uint32_t &value) {
+    EXPECT_EQ(key, iter->first);
+    EXPECT_EQ(value, iter->second);
+    ++iter;
+    return true;
+  }), expect.size());
+  // 非空树不允许BulkLoad
+  EXPECT_EQ(vrt_tree.BulkLoad(kvs.begin(), kvs.end()), false);
+}
+
+TEST(BulkLoadTest, ErrTest) {
+  vrt::Vrt<std::string, true, 1> vrt_tree;
+  std::vector<std::pair<std::string_view, std::string>> unsorted_kvs = {{"b", "0"}, {"a", "1"}};
+  EXPECT_EQ(vrt_tree.BulkLoad(unsorted_kvs.begin(), unsorted_kvs.end()), false);
+  std::vector<std::pair<std::string_view, std::string>> empty_key_kvs = {{"", "0"}, {"a", "1"}};
+  EXPECT_EQ(vrt_tree.BulkLoad(empty_key_kvs.begin(), empty_key_kvs.end()), false);
+  std::string value;
+  EXPECT_EQ(vrt_tree.Find("a", &value), false);
+  std::vector<std::pair<std::string_view, std::string>> kvs = {{"a", "0"}, {"a", "1"}, {"ab", "2"}};
+  EXPECT_EQ(vrt_tree.BulkLoad(kvs.begin(), kvs.end()), true);
+  EXPECT_EQ(vrt_tree.Find("a", &value), true);
+  EXPECT_EQ(value, "1");
+  EXPECT_EQ(vrt_tree.Find("ab", &value), true);
+  EXPECT_EQ(value, "2");
+}
+
+TEST(SnapshotTest, NormalTest) {
+  vrt::Vrt<uint64_t, true, 1> vrt_tree;
+  std::map<std::string, uint64_t> expect;
+  for (uint64_t i = 0; i < 1000; i++) {
+    auto key = std::to_string(i * 7);
+    EXPECT_EQ(vrt_tree.Insert(key, nullptr, i), true);
+    expect[key] = i;
+  }
+  {
+    auto snapshot = vrt_tree.Snapshot();
+    for (uint64_t i = 0; i < 1000; i++) {
+      auto key = std::to_string(i * 7);
+      EXPECT_EQ(vrt_tree.Upsert(key, i + 1), true);
+      EXPECT_EQ(vrt_tree.FetchAdd(key, 1), true);
+      EXPECT_EQ(vrt_tree.Insert(std::to_string(i * 7 + 1), nullptr, i), true);
+      if (i % 2 == 0) {
+        EXPECT_EQ(vrt_tree.Delete(key), true);
+      }
+    }
+    EXPECT_EQ(vrt_tree.Insert("7", nullptr, 0), false);
+    EXPECT_EQ(vrt_tree.Update("0", 0), false);
+    auto iter = expect.begin();
+    EXPECT_EQ(snapshot.Scan("", "", [&iter](std::string_view key, const uint64_t &value) {
+      EXPECT_EQ(key, iter->first);
+      EXPECT_EQ(value, iter->second);
+      ++iter;
+      return true;
+    }), expect.size());
+    uint64_t value;
+    EXPECT_EQ(snapshot.Find("8", &value), false);
+    EXPECT_EQ(vrt_tree.Find("8", &value), true);
+    EXPECT_EQ(snapshot.Find("7", &value), true);
+    EXPECT_EQ(value, 1);
+    EXPECT_EQ(vrt_tree.Find("7", &value), true);
+    EXPECT_EQ(value, 3);
+  }
+  // 快照释放后恢复原地修改
+  uint64_t value;
+  EXPECT_EQ(vrt_tree.FetchAdd("7", 1), true);
+  EXPECT_EQ(vrt_tree.Find("7", &value), true);
+  EXPECT_EQ(value, 4);
+  EXPECT_EQ(vrt_tree.Find("0", &value), false);
+}
+
+TEST(SnapshotTest, ConcurrentTest) {
+  constexpr uint32_t kMaxKey = 20000;
+  vrt::Vrt<uint32_t, true, 4> vrt_tree;
+  for (uint32_t i = 0; i < kMaxKey; i++) {
+    vrt_tree.Insert(std::to_string(i), nullptr, 0);
+  }
+  std::atomic<bool> stop = false;
+  std::thread writer([&vrt_tree, &stop]() {
+    for (uint32_t round = 1; !stop.load(); round++) {
+      for (uint32_t i = 0; i < kMaxKey && !stop.load(); i += 3) {
+        vrt_tree.Upsert(std::to_string(i), round);
+        vrt_tree.Delete(std::to_string(i + 1));
+        vrt_tree.Insert(std::to_string(i + 1), nullptr, round);
+      }
+    }
+  });
+  for (int i = 0; i < 5; i++) {
+    auto snapshot = vrt_tree.Snapshot();
+    std::map<std::string, uint32_t> first_scan;
+    snapshot.Scan("", "", [&first_scan](std::string_view key, const uint32_t &value) {
+      first_scan[std::string(key)] = value;
+      return true;
+    });
+    // 写线程持续修改，同一个快照两次遍历的结果完全一致
+    auto iter = first_scan.begin();
+    EXPECT_EQ(snapshot.Scan("", "", [&iter](std::string_view key, const uint32_t &value) {
+      EXPECT_EQ(key, iter->first);
+      EXPECT_EQ(value, iter->second);
+      ++iter;
+      return true;
+    }), first_scan.size());
+  }
+  stop.store(true);
+  writer.join();
+}
+
 GTEST_API_ int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -4,6 +4,10 @@
  * @Last Modified by:   viktorika 
  * @Last Modified time: 2024-04-05 19:02:05 
  */
+#include <cerrno>
+#include <set>
+#include <thread>
+#include <vector>
 #include "gtest/gtest.h"
 #include "vrt_node.h"
 
@@ -458,6 +462,442 @@ TEST(AddChildTest, LeafNodeTest) {
   VrtNodeHelper<true>::DestroyNode<std::string>(child);
 }
 
+TEST(ResizeTest, Node4ToNode48Test) {
+  std::string key("1234567");
+  auto *node = VrtNodeHelper<true>::CreateVrtNode<Node4, std::string>(key, "456");
+  VrtNode<true> *childs[kFour];
+  for (int i = 0; i < kFour; i++) {
+    childs[i] = VrtNodeHelper<true>::CreateVrtNode<LeafNode, std::string>(key, "456");
+    EXPECT_EQ(node, VrtNodeHelper<true>::AddChild<std::string>(node, kFour - i, childs[i]));
+  }
+  auto *new_node = VrtNodeHelper<true>::CreateVrtNodeByResize<std::string>(node, 20);
+  EXPECT_EQ(new_node->type, Node48);
+  EXPECT_EQ(new_node->child_cnt, kFour);
+  EXPECT_EQ("456", VrtNodeHelper<true>::GetValue<std::string>(new_node));
+  EXPECT_EQ(key, VrtNodeHelper<true>::GetKey(new_node));
+  for (int i = 0; i < kFour; i++) {
+    EXPECT_EQ(childs[i], VrtNodeHelper<true>::FindChild(new_node, kFour - i));
+  }
+  auto *replace_value_node = VrtNodeHelper<true>::CreateVrtNodeByResize<std::string>(new_node, kFour, "789");
+  EXPECT_EQ(replace_value_node->type, Node4);
+  EXPECT_EQ("789", VrtNodeHelper<true>::GetValue<std::string>(replace_value_node));
+  // Node4的边按字节序重新排列
+  std::string edges;
+  VrtNodeHelper<true>::ForEachChild(replace_value_node, [&edges](char edge, VrtNode<true> *child) {
+    edges.push_back(edge);
+    return true;
+  });
+  EXPECT_EQ(edges, std::string("\x01\x02\x03\x04"));
+  VrtNodeHelper<true>::DestroyNode<std::string>(node);
+  VrtNodeHelper<true>::DestroyNode<std::string>(new_node);
+  VrtNodeHelper<true>::DestroyNode<std::string>(replace_value_node);
+  for (int i = 0; i < kFour; i++) {
+    VrtNodeHelper<true>::DestroyNode<std::string>(childs[i]);
+  }
+}
+
+TEST(ValueSlotTest, AlignTest) {
+  for (size_t key_length = 1; key_length <= 16; key_length++) {
+    std::string key(key_length, 'a');
+    auto *leaf_node = VrtNodeHelper<true>::CreateVrtNode<LeafNode, uint64_t>(key, 123);
+    auto *removed_node = VrtNodeHelper<true>::CreateVrtNodeByRemovePrefix<uint64_t>(leaf_node, 1);
+    auto *empty_node48 = VrtNodeHelper<true>::CreateVrtNodeWithoutValue<Node48>(key);
+    auto *node48 = VrtNodeHelper<true>::CreateVrtNodeByAddValue<uint64_t>(empty_node48, 456);
+    for (auto *node : {leaf_node, removed_node, node48}) {
+      auto *value = VrtNodeHelper<true>::GetValuePtr<uint64_t>(node);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(value) % alignof(uint64_t), 0);
+    }
+    EXPECT_EQ(VrtNodeHelper<true>::GetValue<uint64_t>(removed_node), 123);
+    EXPECT_EQ(VrtNodeHelper<true>::GetKey(removed_node), key.substr(1));
+    EXPECT_EQ(VrtNodeHelper<true>::GetValue<uint64_t>(node48), 456);
+    VrtNodeHelper<true>::DestroyNode<uint64_t>(leaf_node);
+    VrtNodeHelper<true>::DestroyNode<uint64_t>(removed_node);
+    VrtNodeHelper<true>::DestroyNode<uint64_t>(empty_node48);
+    VrtNodeHelper<true>::DestroyNode<uint64_t>(node48);
+  }
+}
+
+TEST(ShrinkTest, RemoveChildTest) {
+  std::string key("123");
+  auto *node = VrtNodeHelper<true>::CreateVrtNode<Node256, std::string>(key, "456");
+  VrtNode<true> *childs[kTwoFiveSix];
+  for (int i = 0; i < kTwoFiveSix; i++) {
+    childs[i] = VrtNodeHelper<true>::CreateVrtNodeWithoutValue<LeafNode>(key);
+    VrtNodeHelper<true>::AddChild<std::string>(node, i, childs[i]);
+  }
+  EXPECT_EQ(VrtNodeHelper<true>::GetChildCnt(node), kTwoFiveSix);
+  size_t child_cnt = kTwoFiveSix;
+  for (int i = 0; VrtNodeHelper<true>::GetNodeTypeByShrink(node, child_cnt - 1) == Node256; i++) {
+    VrtNodeHelper<true>::RemoveChildInPlace(node, i);
+    child_cnt--;
+    EXPECT_EQ(VrtNodeHelper<true>::FindChild(node, i), nullptr);
+  }
+  EXPECT_EQ(child_cnt, kNode256ShrinkCnt + 1);
+  EXPECT_EQ(VrtNodeHelper<true>::GetChildCnt(node), child_cnt);
+  auto removed_edge = static_cast<char>(kTwoFiveSix - 1);
+  auto *node48 = VrtNodeHelper<true>::CreateVrtNodeByRemoveChild<std::string>(
+      node, removed_edge, VrtNodeHelper<true>::GetNodeTypeByShrink(node, child_cnt - 1));
+  EXPECT_EQ(node48->type, Node48);
+  EXPECT_EQ(node48->child_cnt, kNode256ShrinkCnt);
+  EXPECT_EQ("456", VrtNodeHelper<true>::GetValue<std::string>(node48));
+  EXPECT_EQ(VrtNodeHelper<true>::FindChild(node48, removed_edge), nullptr);
+  for (int i = kTwoFiveSix - kNode256ShrinkCnt - 1; i < kTwoFiveSix - 1; i++) {
+    EXPECT_EQ(VrtNodeHelper<true>::FindChild(node48, i), childs[i]);
+  }
+  EXPECT_EQ(VrtNodeHelper<true>::GetNodeTypeByShrink(node48, kNode48ShrinkCnt + 1), Node48);
+  EXPECT_EQ(VrtNodeHelper<true>::GetNodeTypeByShrink(node48, kNode48ShrinkCnt), Node16);
+  VrtNodeHelper<true>::DestroyNode<std::string>(node);
+  VrtNodeHelper<true>::DestroyNode<std::string>(node48);
+  for (int i = 0; i < kTwoFiveSix; i++) {
+    VrtNodeHelper<true>::DestroyNode<std::string>(childs[i]);
+  }
+}
+
+TEST(ShrinkTest, MergeTest) {
+  auto *parent = VrtNodeHelper<true>::CreateVrtNodeWithoutValue<Node4>("ab");
+  auto *child = VrtNodeHelper<true>::CreateVrtNode<Node4, std::string>("de", "456");
+  auto *grandson = VrtNodeHelper<true>::CreateVrtNode<LeafNode, std::string>("g", "789");
+  VrtNodeHelper<true>::AddChild<std::string>(parent, 'c', child);
+  VrtNodeHelper<true>::AddChild<std::string>(child, 'f', grandson);
+  auto *merged_node = VrtNodeHelper<true>::CreateVrtNodeByMerge<std::string>(parent, 'c', child);
+  EXPECT_EQ(merged_node->type, Node4);
+  EXPECT_EQ(VrtNodeHelper<true>::GetKey(merged_node), "abcde");
+  EXPECT_EQ("456", VrtNodeHelper<true>::GetValue<std::string>(merged_node));
+  EXPECT_EQ(VrtNodeHelper<true>::FindChild(merged_node, 'f'), grandson);
+  VrtNodeHelper<true>::DestroyNode<std::string>(parent);
+  VrtNodeHelper<true>::DestroyNode<std::string>(child);
+  VrtNodeHelper<true>::DestroyNode<std::string>(merged_node);
+  VrtNodeHelper<true>::DestroyNode<std::string>(grandson);
+}
+
+TEST(ChildPtrTest, TypeTagTest) {
+  auto *node = VrtNodeHelper<true>::CreateVrtNodeWithoutValue<Node4>("123");
+  VrtNode<true> *childs[kFortyNight];
+  for (int i = 0; i < kFortyNight; i++) {
+    childs[i] = i % 2 == 0 ? VrtNodeHelper<true>::CreateVrtNode<LeafNode, std::string>("456", "789")
+                           : VrtNodeHelper<true>::CreateVrtNodeWithoutValue<Node16>("456");
+    auto *new_node = VrtNodeHelper<true>::AddChild<std::string>(node, i, childs[i]);
+    if (new_node != node) {
+      VrtNodeHelper<true>::DestroyNode<std::string>(node);
+      node = new_node;
+    }
+  }
+  EXPECT_EQ(node->type, Node256);
+  // 扩容时复制的指针带着类型
+  for (int i = 0; i < kFortyNight; i++) {
+    auto &child = VrtNodeHelper<true>::FindChild(node, i);
+    EXPECT_EQ(child.Get(), childs[i]);
+    EXPECT_EQ(child.GetType(), childs[i]->type);
+    EXPECT_EQ(VrtNodeHelper<true>::GetData(child, child.GetType()), VrtNodeHelper<true>::GetKeyView(childs[i]).data());
+  }
+  VrtChildPtr<true> null_child(nullptr);
+  EXPECT_EQ(null_child.Get(), nullptr);
+  EXPECT_EQ(null_child.GetType(), 0);
+  VrtNodeHelper<true>::DestroyTree<std::string>(node);
+}
+
+TEST(ChildPtrTest, InlineValueTest) {
+  uintptr_t payload;
+  for (int64_t value : {int64_t(0), int64_t(-1), int64_t(1) << 59, -(int64_t(1) << 60)}) {
+    EXPECT_EQ(VrtInlineValue<int64_t>::Encode(value, &payload), true);
+    auto child = VrtChildPtr<true>::CreateInline(payload);
+    EXPECT_EQ(child.IsInline(), true);
+    EXPECT_EQ(child != nullptr, true);
+    EXPECT_EQ(VrtInlineValue<int64_t>::Decode(child.GetPayload()), value);
+  }
+  EXPECT_EQ(VrtInlineValue<int64_t>::Encode(int64_t(1) << 60, &payload), false);
+  EXPECT_EQ(VrtInlineValue<int64_t>::Encode(INT64_MIN, &payload), false);
+  EXPECT_EQ(VrtInlineValue<uint64_t>::Encode((uint64_t(1) << 61) - 1, &payload), true);
+  EXPECT_EQ(VrtInlineValue<uint64_t>::Decode(payload), (uint64_t(1) << 61) - 1);
+  EXPECT_EQ(VrtInlineValue<uint64_t>::Encode(uint64_t(1) << 61, &payload), false);
+  EXPECT_EQ(VrtInlineValue<uint32_t>::Encode(UINT32_MAX, &payload), true);
+  EXPECT_EQ(VrtInlineValue<std::string>::kSupported, false);
+
+  // InlineLeaf和节点一样可以作为子节点被复制，合并时还原成叶子节点
+  auto *node = VrtNodeHelper<true>::CreateVrtNodeWithoutValue<Node4>("123");
+  EXPECT_EQ(VrtInlineValue<int64_t>::Encode(-5, &payload), true);
+  node = VrtNodeHelper<true>::AddChild<int64_t>(node, 'a', VrtChildPtr<true>::CreateInline(payload));
+  auto *new_node = VrtNodeHelper<true>::CreateVrtNodeByResize<int64_t>(node, kSixteen);
+  EXPECT_EQ(new_node->type, Node16);
+  EXPECT_EQ(VrtNodeHelper<true>::FindChild(new_node, 'a').IsInline(), true);
+  auto *merge_node = VrtNodeHelper<true>::CreateVrtNodeByMerge<int64_t>(new_node, 'a',
+                                                                         VrtNodeHelper<true>::FindChild(new_node, 'a'));
+  EXPECT_EQ(merge_node->type, LeafNode);
+  EXPECT_EQ(VrtNodeHelper<true>::GetKeyView(merge_node), "123a");
+  EXPECT_EQ(*VrtNodeHelper<true>::GetValuePtr<int64_t>(merge_node), -5);
+  VrtNodeHelper<true>::DestroyTree<int64_t>(node);
+  VrtNodeHelper<true>::DestroyTree<int64_t>(new_node);
+  VrtNodeHelper<true>::DestroyTree<int64_t>(merge_node);
+}
+
+TEST(NodeLayoutTest, LockFreeLayoutTest) {
+  // kWriteLock为false时节点没有锁，头部之后的布局依然正确
+  auto *node = VrtNodeHelper<false>::CreateVrtNode<Node4, std::string>("123", "456");
+  EXPECT_EQ(reinterpret_cast<char *>(static_cast<VrtNode4<false> *>(node)->edge) - reinterpret_cast<char *>(node),
+            sizeof(VrtNode<false>));
+  for (int i = 0; i < kSeventeen; i++) {
+    auto *child = VrtNodeHelper<false>::CreateVrtNode<LeafNode, std::string>(std::to_string(i), std::to_string(i));
+    auto *new_node = VrtNodeHelper<false>::AddChild<std::string>(node, i, child);
+    if (new_node != node) {
+      VrtNodeHelper<false>::DestroyNode<std::string>(node);
+      node = new_node;
+    }
+  }
+  EXPECT_EQ(node->type, Node48);
+  EXPECT_EQ(VrtNodeHelper<false>::GetKeyView(node), "123");
+  EXPECT_EQ(*VrtNodeHelper<false>::GetValuePtr<std::string>(node), "456");
+  for (int i = 0; i < kSeventeen; i++) {
+    VrtNode<false> *child = VrtNodeHelper<false>::FindChild(node, i);
+    EXPECT_EQ(VrtNodeHelper<false>::GetKeyView(child), std::to_string(i));
+    EXPECT_EQ(*VrtNodeHelper<false>::GetValuePtr<std::string>(child), std::to_string(i));
+  }
+  VrtNodeHelper<false>::DestroyTree<std::string>(node);
+}
+
+TEST(ValueBoxTest, NodeCopyTest) {
+  using Box = VrtValueBox<std::string>;
+  auto *node = VrtNodeHelper<true>::CreateVrtNode<Node4, Box>("123", std::string(1024, 'a'));
+  auto *value = VrtNodeHelper<true>::GetValuePtr<Box>(node)->Get();
+  for (int i = 0; i < kFive; i++) {
+    auto *child = VrtNodeHelper<true>::CreateVrtNode<LeafNode, Box>(std::to_string(i), std::to_string(i));
+    auto *new_node = VrtNodeHelper<true>::AddChild<Box>(node, i, child);
+    if (new_node != node) {
+      // 扩容后新旧节点引用同一个值
+      EXPECT_EQ(VrtNodeHelper<true>::GetValuePtr<Box>(new_node)->Get(), value);
+      EXPECT_EQ(VrtNodeHelper<true>::GetValuePtr<Box>(new_node)->GetRefCnt(), 2);
+      VrtNodeHelper<true>::DestroyNode<Box>(node);
+      node = new_node;
+    }
+  }
+  EXPECT_EQ(node->type, Node16);
+  EXPECT_EQ(VrtNodeHelper<true>::GetValuePtr<Box>(node)->GetRefCnt(), 1);
+  EXPECT_EQ(*VrtNodeHelper<true>::GetValuePtr<Box>(node)->Get(), std::string(1024, 'a'));
+  auto *prefix_node = VrtNodeHelper<true>::CreateVrtNodeByRemovePrefix<Box>(node, 2);
+  EXPECT_EQ(VrtNodeHelper<true>::GetValuePtr<Box>(prefix_node)->Get(), value);
+  VrtNodeHelper<true>::DestroyNode<Box>(node);
+  EXPECT_EQ(*VrtNodeHelper<true>::GetValuePtr<Box>(prefix_node)->Get(), std::string(1024, 'a'));
+  VrtNodeHelper<true>::DestroyTree<Box>(prefix_node);
+}
+
+TEST(RelocateValueTest, NodeGrowTest) {
+  using Value = std::vector<int>;
+  static_assert(VrtIsTriviallyRelocatable<Value>::value);
+  auto *node = VrtNodeHelper<true>::CreateVrtNode<Node4, Value>("123", 1024, 1);
+  auto *data = VrtNodeHelper<true>::GetValuePtr<Value>(node)->data();
+  for (int i = 0; i < kFive; i++) {
+    auto *child = VrtNodeHelper<true>::CreateVrtNode<LeafNode, Value>(std::to_string(i), 1, i);
+    auto *new_node = VrtNodeHelper<true>::AddChild<Value, true>(node, i, child);
+    if (new_node != node) {
+      // 扩容后值按字节搬到新节点上，旧节点上的字节不变，两边指向同一块缓冲区
+      EXPECT_EQ(VrtNodeHelper<true>::GetValuePtr<Value>(new_node)->data(), data);
+      EXPECT_EQ(VrtNodeHelper<true>::GetValuePtr<Value>(node)->data(), data);
+      VrtNodeHelper<true>::DestroyNode<Value>(node, false);
+      node = new_node;
+    }
+  }
+  EXPECT_EQ(node->type, Node16);
+  auto *prefix_node = VrtNodeHelper<true>::CreateVrtNodeByRemovePrefix<Value, true>(node, 2);
+  EXPECT_EQ(VrtNodeHelper<true>::GetValuePtr<Value>(prefix_node)->data(), data);
+  // EBR回收时通过指针上的标记跳过值的析构
+  auto *marked_node = VrtNodeHelper<true>::MarkValueRelocated(node);
+  EXPECT_TRUE(VrtNodeHelper<true>::IsValueRelocated(marked_node));
+  EXPECT_EQ(VrtNodeHelper<true>::ClearValueRelocated(marked_node), node);
+  VrtNodeDestroy<Value> destroy(marked_node);
+  EXPECT_EQ(*VrtNodeHelper<true>::GetValuePtr<Value>(prefix_node), Value(1024, 1));
+  VrtNodeHelper<true>::DestroyTree<Value>(prefix_node);
+}
+
+TEST(NodeLadderTest, FineLadderTest) {
+  using FineNodeHelper = VrtNodeHelper<true, MallocAllocator, VrtNodeLadder::kFine>;
+  auto *node = FineNodeHelper::CreateVrtNode<Node4, std::string>("123", "456");
+  std::vector<VrtNodeType> grow_types;
+  for (int i = 0; i < kFortyNight; i++) {
+    auto *child = FineNodeHelper::CreateVrtNode<LeafNode, std::string>(std::to_string(i), std::to_string(i));
+    auto *new_node = FineNodeHelper::AddChild<std::string>(node, i, child);
+    if (new_node != node) {
+      grow_types.push_back(static_cast<VrtNodeType>(new_node->type));
+      FineNodeHelper::DestroyNode<std::string>(node);
+      node = new_node;
+    }
+    EXPECT_EQ(node->type, FineNodeHelper::GetNodeTypeByChildCnt(i + 1));
+  }
+  EXPECT_EQ(grow_types, std::vector<VrtNodeType>({Node8, Node16, Node32, Node48, Node256}));
+  EXPECT_EQ(*FineNodeHelper::GetValuePtr<std::string>(node), "456");
+  std::string visited_edges;
+  FineNodeHelper::ForEachChild(node, [&visited_edges](char edge, VrtChildPtr<true> child) {
+    EXPECT_EQ(FineNodeHelper::GetKeyView(child), std::to_string(edge));
+    visited_edges.push_back(edge);
+    return true;
+  });
+  EXPECT_EQ(visited_edges.size(), kFortyNight);
+  // 缩容逐级回落，阈值比扩容低
+  auto *node32 = FineNodeHelper::CreateVrtNodeWithoutValue<Node32>("321");
+  for (int i = 0; i < kThirtyTwo; i++) {
+    EXPECT_EQ(FineNodeHelper::AddChild<std::string>(node32, i, FineNodeHelper::FindChild(node, i)), node32);
+  }
+  EXPECT_EQ(FineNodeHelper::GetNodeTypeByShrink(node, kNode256ShrinkCnt), Node48);
+  EXPECT_EQ(FineNodeHelper::GetNodeTypeByShrink(node32, kNode32ShrinkCnt + 1), Node32);
+  EXPECT_EQ(FineNodeHelper::GetNodeTypeByShrink(node32, kNode32ShrinkCnt), Node16);
+  auto *node8 = FineNodeHelper::CreateVrtNodeWithoutValue<Node8>("789");
+  EXPECT_EQ(FineNodeHelper::GetNodeTypeByShrink(node8, kNode8ShrinkCnt + 1), Node8);
+  EXPECT_EQ(FineNodeHelper::GetNodeTypeByShrink(node8, kNode8ShrinkCnt), Node4);
+  auto *prefix_node = FineNodeHelper::CreateVrtNodeByRemovePrefix<std::string>(node32, 1);
+  EXPECT_EQ(prefix_node->type, Node32);
+  EXPECT_EQ(FineNodeHelper::GetKeyView(prefix_node), "21");
+  EXPECT_EQ(FineNodeHelper::FindChild(prefix_node, 31), FineNodeHelper::FindChild(node, 31));
+  EXPECT_EQ(FineNodeHelper::GetChildCnt(prefix_node), kThirtyTwo);
+  FineNodeHelper::DestroyNode<std::string>(node8);
+  FineNodeHelper::DestroyNode<std::string>(node32);
+  FineNodeHelper::DestroyNode<std::string>(prefix_node);
+  FineNodeHelper::DestroyTree<std::string>(node);
+}
+
+TEST(VersionLockTest, NormalTest) {
+  auto *node = VrtNodeHelper<true>::CreateVrtNode<Node4, std::string>("123", "456");
+  auto version = node->ReadVersion();
+  EXPECT_EQ(VrtNode<true>::IsLocked(version), false);
+  // 每次加锁解锁后版本号都会变化，旧版本号加锁失败
+  node->Lock();
+  EXPECT_EQ(VrtNode<true>::IsLocked(node->ReadVersion()), true);
+  EXPECT_EQ(node->TryLock(version), false);
+  node->Unlock();
+  EXPECT_NE(node->ReadVersion(), version);
+  EXPECT_EQ(node->TryLock(version), false);
+  version = node->ReadVersion();
+  EXPECT_EQ(node->TryLock(version), true);
+  EXPECT_EQ(node->TryLock(version), false);
+  node->Unlock();
+  VrtNodeHelper<true>::DestroyNode<std::string>(node);
+}
+
+TEST(SlabAllocatorTest, SizeClassTest) {
+  for (size_t size = 1; size <= SlabAllocator::kMaxSize; size++) {
+    auto class_index = SlabAllocator::GetClassIndex(size);
+    EXPECT_LT(class_index, SlabAllocator::kClassCnt);
+    EXPECT_GE(SlabAllocator::GetClassSize(class_index), size);
+    if (class_index > 0) {
+      EXPECT_LT(SlabAllocator::GetClassSize(class_index - 1), size);
+    }
+  }
+}
+
+TEST(SlabAllocatorTest, AllocateTest) {
+  constexpr size_t kCnt = 1000;
+  std::vector<void *> ptrs;
+  std::set<void *> ptr_set;
+  for (size_t i = 0; i < kCnt; i++) {
+    auto size = (i * 37) % (SlabAllocator::kMaxSize + 512) + 1;
+    auto *ptr = SlabAllocator::Allocate(size);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t), 0);
+    memset(ptr, static_cast<int>(i), size);
+    ptrs.emplace_back(ptr);
+    ptr_set.insert(ptr);
+  }
+  EXPECT_EQ(ptr_set.size(), kCnt);
+  for (size_t i = 0; i < kCnt; i++) {
+    SlabAllocator::Deallocate(ptrs[i], (i * 37) % (SlabAllocator::kMaxSize + 512) + 1);
+  }
+  // 同一个线程释放后再申请会复用缓存中的对象
+  auto *ptr = SlabAllocator::Allocate(1);
+  EXPECT_EQ(ptr_set.count(ptr), 1);
+  SlabAllocator::Deallocate(ptr, 1);
+}
+
+TEST(SlabAllocatorTest, CrossThreadTest) {
+  constexpr size_t kCnt = 10000;
+  std::vector<void *> ptrs(kCnt);
+  std::thread producer([&ptrs]() {
+    for (size_t i = 0; i < kCnt; i++) {
+      ptrs[i] = SlabAllocator::Allocate(64);
+    }
+  });
+  producer.join();
+  // 其他线程申请的对象由这个线程释放，再由新线程从仓库取回
+  for (size_t i = 0; i < kCnt; i++) {
+    SlabAllocator::Deallocate(ptrs[i], 64);
+  }
+  std::set<void *> ptr_set(ptrs.begin(), ptrs.end());
+  size_t reuse_cnt = 0;
+  std::thread consumer([&ptr_set, &reuse_cnt]() {
+    for (size_t i = 0; i < SlabAllocator::kBatchSize; i++) {
+      reuse_cnt += ptr_set.count(SlabAllocator::Allocate(64));
+    }
+  });
+  consumer.join();
+  EXPECT_EQ(reuse_cnt, SlabAllocator::kBatchSize);
+}
+
+TEST(SlabAllocatorTest, NodeTest) {
+  using SlabNodeHelper = VrtNodeHelper<true, SlabAllocator>;
+  auto *node = SlabNodeHelper::CreateVrtNode<Node4, std::string>("123", "456");
+  auto *child = SlabNodeHelper::CreateVrtNodeWithoutValue<LeafNode>("789");
+  SlabNodeHelper::AddChild<std::string>(node, 'a', child);
+  auto *new_node = SlabNodeHelper::CreateVrtNodeByResize<std::string>(node, kFortyNight);
+  EXPECT_EQ(new_node->type, Node256);
+  EXPECT_EQ("456", SlabNodeHelper::GetValue<std::string>(new_node));
+  EXPECT_EQ(SlabNodeHelper::FindChild(new_node, 'a'), child);
+  SlabNodeHelper::DestroyNode<std::string>(node);
+  SlabNodeHelper::DestroyTree<std::string>(new_node);
+}
+
+TEST(HugePageAllocatorTest, AllocateTest) {
+  using Source = HugePageSlabSource<>;
+  // 连续申请的slab来自同一段按大页对齐的映射
+  auto *first_slab = static_cast<char *>(Source::AllocateSlab(SlabAllocator::kSlabSize));
+  auto *second_slab = static_cast<char *>(Source::AllocateSlab(SlabAllocator::kSlabSize));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(first_slab) % Source::kHugePageSize, 0);
+  EXPECT_EQ(second_slab, first_slab + SlabAllocator::kSlabSize);
+  memset(first_slab, 0, SlabAllocator::kSlabSize * 2);
+  // 一段映射用完后换一段新的
+  for (size_t i = 2; i < Source::kArenaSize / SlabAllocator::kSlabSize; i++) {
+    Source::AllocateSlab(SlabAllocator::kSlabSize);
+  }
+  auto *next_arena_slab = Source::AllocateSlab(SlabAllocator::kSlabSize);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(next_arena_slab) % Source::kHugePageSize, 0);
+
+  using Allocator = HugePageSlabAllocator<0>;
+  constexpr size_t kCnt = 1000;
+  std::vector<void *> ptrs;
+  for (size_t i = 0; i < kCnt; i++) {
+    auto *ptr = Allocator::Allocate(i % Allocator::kMaxSize + 1);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t), 0);
+    memset(ptr, static_cast<int>(i), i % Allocator::kMaxSize + 1);
+    ptrs.emplace_back(ptr);
+  }
+  EXPECT_EQ(std::set<void *>(ptrs.begin(), ptrs.end()).size(), kCnt);
+  for (size_t i = 0; i < kCnt; i++) {
+    Allocator::Deallocate(ptrs[i], i % Allocator::kMaxSize + 1);
+  }
+}
+
+TEST(HugePageAllocatorTest, NumaBindTest) {
+  using Source = HugePageSlabSource<0>;
+  auto *slab = Source::AllocateSlab(SlabAllocator::kSlabSize);
+  EXPECT_EQ(Source::GetNumaBindFailCnt(), 0);
+  // 查询slab所在页的内存策略，应该绑定在0号节点上
+  int mode = -1;
+  unsigned long node_mask[1] = {};
+  if (0 != syscall(SYS_get_mempolicy, &mode, node_mask, sizeof(node_mask) * 8 + 1, slab, MPOL_F_ADDR)) {
+    ASSERT_EQ(errno, ENOSYS);
+    GTEST_SKIP() << "the kernel does not support NUMA";
+  }
+  EXPECT_EQ(mode, MPOL_BIND);
+  EXPECT_EQ(node_mask[0], 1UL);
+}
+
+TEST(HugePageAllocatorTest, NodeTest) {
+  using HugePageNodeHelper = VrtNodeHelper<true, HugePageSlabAllocator<>>;
+  auto *node = HugePageNodeHelper::CreateVrtNode<Node4, std::string>("123", "456");
+  auto *child = HugePageNodeHelper::CreateVrtNodeWithoutValue<LeafNode>("789");
+  HugePageNodeHelper::AddChild<std::string>(node, 'a', child);
+  auto *new_node = HugePageNodeHelper::CreateVrtNodeByResize<std::string>(node, kFortyNight);
+  EXPECT_EQ(new_node->type, Node256);
+  EXPECT_EQ("456", HugePageNodeHelper::GetValue<std::string>(new_node));
+  EXPECT_EQ(HugePageNodeHelper::FindChild(new_node, 'a'), child);
+  HugePageNodeHelper::DestroyNode<std::string>(node);
+  HugePageNodeHelper::DestroyTree<std::string>(new_node);
+}
+
 GTEST_API_ int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();